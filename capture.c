@@ -0,0 +1,402 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "pool-buffer.h"
+#include "slurp.h"
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
+
+static int32_t max(int32_t a, int32_t b) {
+	return a > b ? a : b;
+}
+
+static int32_t min(int32_t a, int32_t b) {
+	return a < b ? a : b;
+}
+
+static bool is_bgr(uint32_t format) {
+	return format == WL_SHM_FORMAT_ABGR8888 || format == WL_SHM_FORMAT_XBGR8888;
+}
+
+/**
+ * Convert a little-endian ABGR8888 pixel to ARGB8888, the layout cairo reads.
+ */
+static uint32_t swap_red_blue(uint32_t pixel) {
+	return (pixel & 0xFF00FF00) | ((pixel & 0xFF) << 16) |
+		((pixel >> 16) & 0xFF);
+}
+
+static void swap_red_blue_row(uint8_t *row, uint32_t width) {
+	for (uint32_t x = 0; x < width; x++) {
+		uint32_t pixel;
+		memcpy(&pixel, row + (size_t)x * 4, sizeof(pixel));
+		pixel = swap_red_blue(pixel);
+		memcpy(row + (size_t)x * 4, &pixel, sizeof(pixel));
+	}
+}
+
+static void frame_handle_buffer(void *data,
+		struct zwlr_screencopy_frame_v1 *frame, uint32_t format,
+		uint32_t width, uint32_t height, uint32_t stride) {
+	struct slurp_output *output = data;
+	struct capture *capture = &output->capture;
+
+	// The BGR formats are swizzled once the copy is done, see
+	// frame_handle_ready
+	if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888 &&
+			!is_bgr(format)) {
+		fprintf(stderr, "unsupported screencopy format 0x%08x\n", format);
+		capture->failed = true;
+		return;
+	}
+
+	size_t size = (size_t)stride * height;
+	int fd = create_shm_file(size);
+	if (fd == -1) {
+		capture->failed = true;
+		return;
+	}
+	void *shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm_data == MAP_FAILED) {
+		close(fd);
+		capture->failed = true;
+		return;
+	}
+	capture->stats = &output->state->shm_stats;
+	shm_stats_map(capture->stats, size);
+	struct wl_shm_pool *pool = wl_shm_create_pool(output->state->shm, fd, size);
+	capture->buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+		stride, format);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	capture->data = shm_data;
+	capture->size = size;
+	capture->format = format;
+	capture->width = width;
+	capture->height = height;
+	capture->stride = stride;
+
+	zwlr_screencopy_frame_v1_copy(frame, capture->buffer);
+}
+
+static void frame_handle_flags(void *data,
+		struct zwlr_screencopy_frame_v1 *frame, uint32_t flags) {
+	struct slurp_output *output = data;
+	output->capture.flags = flags;
+}
+
+/**
+ * Flip the rows upside down, and swap the red and blue channels while they
+ * are at hand if swap_rb is set.
+ */
+static void flip_rows(struct capture *capture, bool swap_rb) {
+	uint8_t *row = malloc(capture->stride);
+	if (row == NULL) {
+		capture->failed = true;
+		return;
+	}
+	uint8_t *data = capture->data;
+	for (uint32_t y = 0; y < capture->height / 2; y++) {
+		uint8_t *top = data + y * capture->stride;
+		uint8_t *bottom = data + (capture->height - 1 - y) * capture->stride;
+		memcpy(row, top, capture->stride);
+		memcpy(top, bottom, capture->stride);
+		memcpy(bottom, row, capture->stride);
+		if (swap_rb) {
+			swap_red_blue_row(top, capture->width);
+			swap_red_blue_row(bottom, capture->width);
+		}
+	}
+	if (swap_rb && capture->height % 2 == 1) {
+		swap_red_blue_row(data + capture->height / 2 * capture->stride,
+			capture->width);
+	}
+	free(row);
+}
+
+/**
+ * Rotate and flip the pixels as the compositor does to display them, so that
+ * the capture has the orientation of the logical output. The red and blue
+ * channels are swapped during the copy if swap_rb is set.
+ */
+static void apply_transform(struct capture *capture, int32_t transform,
+		bool swap_rb) {
+	uint32_t src_width = capture->width, src_height = capture->height;
+	uint32_t width = src_width, height = src_height;
+	if (transform & WL_OUTPUT_TRANSFORM_90) {
+		width = src_height;
+		height = src_width;
+	}
+	uint32_t stride = width * 4;
+	size_t size = (size_t)stride * height;
+	int fd = create_shm_file(size);
+	if (fd == -1) {
+		capture->failed = true;
+		return;
+	}
+	uint8_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		capture->failed = true;
+		return;
+	}
+
+	const uint8_t *src = capture->data;
+	for (uint32_t y = 0; y < height; y++) {
+		uint32_t *dst = (uint32_t *)(data + (size_t)y * stride);
+		for (uint32_t x = 0; x < width; x++) {
+			// Source pixel shown at (x, y)
+			uint32_t u, v;
+			switch (transform & ~WL_OUTPUT_TRANSFORM_FLIPPED) {
+			case WL_OUTPUT_TRANSFORM_90:
+				u = src_width - 1 - y;
+				v = x;
+				break;
+			case WL_OUTPUT_TRANSFORM_180:
+				u = src_width - 1 - x;
+				v = src_height - 1 - y;
+				break;
+			case WL_OUTPUT_TRANSFORM_270:
+				u = y;
+				v = src_height - 1 - x;
+				break;
+			default:
+				u = x;
+				v = y;
+				break;
+			}
+			if (transform & WL_OUTPUT_TRANSFORM_FLIPPED) {
+				u = src_width - 1 - u;
+			}
+			uint32_t pixel;
+			memcpy(&pixel, src + (size_t)v * capture->stride + (size_t)u * 4,
+				sizeof(uint32_t));
+			dst[x] = swap_rb ? swap_red_blue(pixel) : pixel;
+		}
+	}
+
+	// The wl_buffer was only needed for the copy
+	wl_buffer_destroy(capture->buffer);
+	capture->buffer = NULL;
+	munmap(capture->data, capture->size);
+	shm_stats_unmap(capture->stats, capture->size);
+	shm_stats_map(capture->stats, size);
+	capture->data = data;
+	capture->size = size;
+	capture->width = width;
+	capture->height = height;
+	capture->stride = stride;
+}
+
+static void frame_handle_ready(void *data,
+		struct zwlr_screencopy_frame_v1 *frame, uint32_t tv_sec_hi,
+		uint32_t tv_sec_lo, uint32_t tv_nsec) {
+	struct slurp_output *output = data;
+	struct capture *capture = &output->capture;
+
+	zwlr_screencopy_frame_v1_destroy(frame);
+	capture->frame = NULL;
+
+	// Normalize the orientation and the channel order once so that readers
+	// don't have to care. The channels are swapped by the first pass over
+	// the pixels.
+	bool swap_rb = is_bgr(capture->format);
+	if (capture->flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT) {
+		flip_rows(capture, swap_rb);
+		if (capture->failed) {
+			return;
+		}
+		capture->flags &= ~ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT;
+		swap_rb = false;
+	}
+	if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		apply_transform(capture, output->transform, swap_rb);
+		if (capture->failed) {
+			return;
+		}
+		swap_rb = false;
+	}
+	if (swap_rb) {
+		for (uint32_t y = 0; y < capture->height; y++) {
+			swap_red_blue_row((uint8_t *)capture->data +
+				(size_t)y * capture->stride, capture->width);
+		}
+	}
+	if (is_bgr(capture->format)) {
+		capture->format = capture->format == WL_SHM_FORMAT_ABGR8888 ?
+			WL_SHM_FORMAT_ARGB8888 : WL_SHM_FORMAT_XRGB8888;
+	}
+
+	// Screen content is opaque, whatever the alpha channel says
+	capture->surface = cairo_image_surface_create_for_data(capture->data,
+		CAIRO_FORMAT_RGB24, capture->width, capture->height, capture->stride);
+	capture->done = true;
+}
+
+static void frame_handle_failed(void *data,
+		struct zwlr_screencopy_frame_v1 *frame) {
+	struct slurp_output *output = data;
+	fprintf(stderr, "failed to capture output\n");
+	output->capture.failed = true;
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
+	.buffer = frame_handle_buffer,
+	.flags = frame_handle_flags,
+	.ready = frame_handle_ready,
+	.failed = frame_handle_failed,
+};
+
+static bool wait_captures(struct slurp_state *state) {
+	// All captures are in flight at once, wait for each of them to settle
+	struct slurp_output *output;
+	bool pending = true;
+	while (pending) {
+		if (wl_display_dispatch_queue(state->display, state->queue) == -1) {
+			return false;
+		}
+		pending = false;
+		wl_list_for_each(output, &state->outputs, link) {
+			struct capture *capture = &output->capture;
+			if (capture->failed && capture->frame != NULL) {
+				zwlr_screencopy_frame_v1_destroy(capture->frame);
+				capture->frame = NULL;
+			}
+			if (capture->frame != NULL && !capture->done && !capture->failed) {
+				pending = true;
+			}
+		}
+	}
+
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->capture.failed) {
+			capture_finish(&output->capture);
+		}
+	}
+	return true;
+}
+
+bool capture_outputs(struct slurp_state *state) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		output->capture.frame = zwlr_screencopy_manager_v1_capture_output(
+			state->screencopy_manager, false, output->wl_output);
+		zwlr_screencopy_frame_v1_add_listener(output->capture.frame,
+			&frame_listener, output);
+	}
+	return wait_captures(state);
+}
+
+bool capture_region(struct slurp_state *state, const struct slurp_box *box) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		capture_finish(&output->capture);
+		struct slurp_box *geometry = &output->logical_geometry;
+		if (!slurp_box_intersect(geometry, box)) {
+			continue;
+		}
+		int32_t x1 = max(box->x, geometry->x);
+		int32_t y1 = max(box->y, geometry->y);
+		int32_t x2 = min(box->x + box->width, geometry->x + geometry->width);
+		int32_t y2 = min(box->y + box->height, geometry->y + geometry->height);
+		output->capture.region = (struct slurp_box){
+			.x = x1,
+			.y = y1,
+			.width = x2 - x1,
+			.height = y2 - y1,
+		};
+		output->capture.frame = zwlr_screencopy_manager_v1_capture_output_region(
+			state->screencopy_manager, false, output->wl_output,
+			x1 - geometry->x, y1 - geometry->y, x2 - x1, y2 - y1);
+		zwlr_screencopy_frame_v1_add_listener(output->capture.frame,
+			&frame_listener, output);
+	}
+	return wait_captures(state);
+}
+
+void capture_finish(struct capture *capture) {
+	if (capture->frame) {
+		zwlr_screencopy_frame_v1_destroy(capture->frame);
+	}
+	if (capture->surface) {
+		cairo_surface_destroy(capture->surface);
+	}
+	if (capture->tinted) {
+		cairo_surface_destroy(capture->tinted);
+	}
+	if (capture->buffer) {
+		wl_buffer_destroy(capture->buffer);
+	}
+	if (capture->data) {
+		munmap(capture->data, capture->size);
+		shm_stats_unmap(capture->stats, capture->size);
+	}
+	memset(capture, 0, sizeof(struct capture));
+}
+
+// Eight 32-bit pixels at a time
+typedef uint8_t u8x32 __attribute__((vector_size(32)));
+typedef uint16_t u16x32 __attribute__((vector_size(64)));
+
+bool capture_tint(struct capture *capture, uint32_t color) {
+	if (capture->surface == NULL) {
+		return true;
+	}
+	cairo_surface_t *tinted = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+		capture->width, capture->height);
+	if (cairo_surface_status(tinted) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(tinted);
+		return false;
+	}
+
+	uint16_t alpha = color & 0xFF;
+	// Both buffers are little-endian 32-bit pixels: bytes are B, G, R, X
+	uint16_t channels[4] = {
+		(color >> 8) & 0xFF,
+		(color >> 16) & 0xFF,
+		(color >> 24) & 0xFF,
+		0xFF,
+	};
+
+	u16x32 mul, add;
+	for (size_t i = 0; i < 32; i++) {
+		bool is_alpha = i % 4 == 3;
+		mul[i] = is_alpha ? 0 : 255 - alpha;
+		add[i] = is_alpha ? 255 * 255 : channels[i % 4] * alpha;
+	}
+
+	cairo_surface_flush(tinted);
+	uint8_t *dst = cairo_image_surface_get_data(tinted);
+	size_t dst_stride = cairo_image_surface_get_stride(tinted);
+	size_t row_size = (size_t)capture->width * 4;
+	for (uint32_t y = 0; y < capture->height; y++) {
+		const uint8_t *src_row =
+			(const uint8_t *)capture->data + (size_t)y * capture->stride;
+		uint8_t *dst_row = dst + (size_t)y * dst_stride;
+		size_t i = 0;
+		for (; i + 32 <= row_size; i += 32) {
+			u8x32 px;
+			memcpy(&px, src_row + i, sizeof(px));
+			u16x32 x = __builtin_convertvector(px, u16x32) * mul + add + 128;
+			// Exact rounded division by 255 for x <= 255 * 255
+			px = __builtin_convertvector((x + (x >> 8)) >> 8, u8x32);
+			memcpy(dst_row + i, &px, sizeof(px));
+		}
+		for (; i < row_size; i++) {
+			uint16_t c = src_row[i] * mul[i % 32] + add[i % 32] + 128;
+			dst_row[i] = (c + (c >> 8)) >> 8;
+		}
+	}
+	cairo_surface_mark_dirty(tinted);
+
+	if (capture->tinted != NULL) {
+		cairo_surface_destroy(capture->tinted);
+	}
+	capture->tinted = tinted;
+	return true;
+}
@@ -0,0 +1,232 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "content-edges.h"
+
+// Pixels summed across an axis into a profile
+#define EDGE_BAND_SIZE 32
+// Mean Sobel response (4 times the contrast of a step) of an edge. Weaker
+// local maxima are noise.
+#define EDGE_MIN_STRENGTH 96
+
+#define EDGE_LANES 16
+
+typedef int16_t i16xN __attribute__((vector_size(2 * EDGE_LANES)));
+typedef uint16_t u16xN __attribute__((vector_size(2 * EDGE_LANES)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+
+static void luma_row(const struct capture *capture, uint32_t y, uint8_t *dst) {
+	const uint8_t *src = (const uint8_t *)capture->data +
+		(size_t)y * capture->stride;
+	uint32_t x = 0;
+	for (; x + 8 <= capture->width; x += 8) {
+		u32x8 px;
+		memcpy(&px, src + (size_t)x * 4, sizeof(px));
+		// wl_shm formats are little-endian: bytes are B, G, R, A/X
+		u32x8 l = (((px >> 16) & 0xFF) * 77 + ((px >> 8) & 0xFF) * 150 +
+			(px & 0xFF) * 29) >> 8;
+		for (int i = 0; i < 8; i++) {
+			dst[x + i] = l[i];
+		}
+	}
+	for (; x < capture->width; x++) {
+		uint32_t px;
+		memcpy(&px, src + (size_t)x * 4, sizeof(px));
+		dst[x] = (((px >> 16) & 0xFF) * 77 + ((px >> 8) & 0xFF) * 150 +
+			(px & 0xFF) * 29) >> 8;
+	}
+}
+
+// Vectors are passed by pointer, their ABI depends on the enabled extensions
+
+static void load_luma(i16xN *v, const uint8_t *row) {
+	uint8_t bytes[EDGE_LANES];
+	memcpy(bytes, row, sizeof(bytes));
+	for (int i = 0; i < EDGE_LANES; i++) {
+		(*v)[i] = bytes[i];
+	}
+}
+
+static void abs_i16(i16xN *v) {
+	i16xN sign = *v >> 15;
+	*v = (*v ^ sign) - sign;
+}
+
+/**
+ * Accumulate the Sobel responses of row y, whose neighbors are above and
+ * below, into the profiles of its band: |Gx| per column into col_sums, |Gy|
+ * per column band into row_sums.
+ */
+static void sobel_row(const uint8_t *above, const uint8_t *row,
+		const uint8_t *below, int32_t width, uint16_t *col_sums,
+		uint32_t *row_sums) {
+	int32_t x = 1;
+	for (; x + EDGE_LANES + 1 <= width; x += EDGE_LANES) {
+		i16xN a0, a1, a2, b0, b2, c0, c1, c2;
+		load_luma(&a0, above + x - 1);
+		load_luma(&a1, above + x);
+		load_luma(&a2, above + x + 1);
+		load_luma(&b0, row + x - 1);
+		load_luma(&b2, row + x + 1);
+		load_luma(&c0, below + x - 1);
+		load_luma(&c1, below + x);
+		load_luma(&c2, below + x + 1);
+		i16xN gx = (a2 - a0) + 2 * (b2 - b0) + (c2 - c0);
+		i16xN gy = (c0 + 2 * c1 + c2) - (a0 + 2 * a1 + a2);
+		abs_i16(&gx);
+		abs_i16(&gy);
+
+		u16xN sums;
+		memcpy(&sums, &col_sums[x], sizeof(sums));
+		sums += (u16xN)gx;
+		memcpy(&col_sums[x], &sums, sizeof(sums));
+
+		for (int i = 0; i < EDGE_LANES; i++) {
+			row_sums[(x + i) / EDGE_BAND_SIZE] += gy[i];
+		}
+	}
+	for (; x + 1 < width; x++) {
+		int gx = (above[x + 1] - above[x - 1]) +
+			2 * (row[x + 1] - row[x - 1]) + (below[x + 1] - below[x - 1]);
+		int gy = (below[x - 1] + 2 * below[x] + below[x + 1]) -
+			(above[x - 1] + 2 * above[x] + above[x + 1]);
+		col_sums[x] += abs(gx);
+		row_sums[x / EDGE_BAND_SIZE] += abs(gy);
+	}
+}
+
+/**
+ * Turn a profile into snapping offsets: keep the local maxima above min, and
+ * point each pixel to the nearest one within radius.
+ */
+static void profile_offsets(const uint32_t *profile, int32_t len,
+		uint32_t min, int32_t radius, int8_t *offsets) {
+	int32_t last = -1 - radius;
+	for (int32_t i = 0; i < len; i++) {
+		uint32_t v = profile[i];
+		if (v >= min && (i == 0 || v >= profile[i - 1]) &&
+				(i + 1 == len || v > profile[i + 1])) {
+			last = i;
+		}
+		offsets[i] = i - last <= radius ? last - i : 0;
+	}
+	int32_t next = len + radius;
+	for (int32_t i = len - 1; i >= 0; i--) {
+		uint32_t v = profile[i];
+		if (v >= min && (i == 0 || v >= profile[i - 1]) &&
+				(i + 1 == len || v > profile[i + 1])) {
+			next = i;
+		}
+		if (next - i <= radius && (offsets[i] == 0 || next - i < -offsets[i])) {
+			offsets[i] = next - i;
+		}
+	}
+}
+
+static bool axis_init(struct content_edges_axis *axis, int32_t len,
+		int32_t bands) {
+	axis->len = len;
+	axis->bands = bands;
+	axis->offsets = calloc((size_t)len * bands, 1);
+	return axis->offsets != NULL;
+}
+
+static void *run_content_edges(void *data) {
+	struct content_edges *edges = data;
+	const struct capture *capture = edges->capture;
+	int32_t width = capture->width, height = capture->height;
+	int32_t row_bands = (height + EDGE_BAND_SIZE - 1) / EDGE_BAND_SIZE;
+	int32_t col_bands = (width + EDGE_BAND_SIZE - 1) / EDGE_BAND_SIZE;
+
+	uint8_t *luma = malloc((size_t)width * 3);
+	uint16_t *col_sums = malloc((size_t)width * sizeof(uint16_t));
+	uint32_t *profile = malloc((size_t)(width > height ? width : height) *
+		sizeof(uint32_t));
+	// |Gy| per column band, for all rows
+	uint32_t *row_sums = calloc((size_t)col_bands * height, sizeof(uint32_t));
+	if (luma == NULL || col_sums == NULL || profile == NULL ||
+			row_sums == NULL || !axis_init(&edges->x, width, row_bands) ||
+			!axis_init(&edges->y, height, col_bands)) {
+		goto out;
+	}
+
+	const uint32_t min = EDGE_MIN_STRENGTH * EDGE_BAND_SIZE;
+	// Three rows of luma, used as a ring
+	uint8_t *rows[3] = { luma, luma + width, luma + 2 * (size_t)width };
+	luma_row(capture, 0, rows[0]);
+	luma_row(capture, 1, rows[1]);
+	for (int32_t band = 0; band < row_bands; band++) {
+		memset(col_sums, 0, (size_t)width * sizeof(uint16_t));
+		int32_t end = (band + 1) * EDGE_BAND_SIZE;
+		for (int32_t y = band * EDGE_BAND_SIZE; y < end && y < height; y++) {
+			if (y == 0 || y + 1 == height) {
+				continue;
+			}
+			uint8_t *above = rows[(y - 1) % 3], *row = rows[y % 3],
+				*below = rows[(y + 1) % 3];
+			luma_row(capture, y + 1, below);
+			uint32_t *sums = &row_sums[(size_t)y * col_bands];
+			sobel_row(above, row, below, width, col_sums, sums);
+		}
+		for (int32_t x = 0; x < width; x++) {
+			profile[x] = col_sums[x];
+		}
+		profile_offsets(profile, width, min, edges->radius,
+			&edges->x.offsets[(size_t)band * width]);
+	}
+
+	for (int32_t band = 0; band < col_bands; band++) {
+		for (int32_t y = 0; y < height; y++) {
+			profile[y] = row_sums[(size_t)y * col_bands + band];
+		}
+		profile_offsets(profile, height, min, edges->radius,
+			&edges->y.offsets[(size_t)band * height]);
+	}
+
+	atomic_store_explicit(&edges->ready, true, memory_order_release);
+
+out:
+	free(luma);
+	free(col_sums);
+	free(profile);
+	free(row_sums);
+	return NULL;
+}
+
+bool content_edges_start(struct content_edges *edges,
+		const struct capture *capture, int32_t radius) {
+	memset(edges, 0, sizeof(struct content_edges));
+	atomic_init(&edges->ready, false);
+	if (capture->data == NULL || capture->width < 3 || capture->height < 3) {
+		return false;
+	}
+	edges->capture = capture;
+	edges->radius = radius < INT8_MAX ? radius : INT8_MAX;
+	edges->threaded = pthread_create(&edges->thread, NULL,
+		run_content_edges, edges) == 0;
+	return edges->threaded;
+}
+
+void content_edges_finish(struct content_edges *edges) {
+	if (edges->threaded) {
+		pthread_join(edges->thread, NULL);
+	}
+	free(edges->x.offsets);
+	free(edges->y.offsets);
+	memset(edges, 0, sizeof(struct content_edges));
+}
+
+void content_edges_snap(const struct content_edges *edges,
+		int32_t *x, int32_t *y) {
+	if (!atomic_load_explicit(&edges->ready, memory_order_acquire) ||
+			*x < 0 || *x >= edges->x.len || *y < 0 || *y >= edges->y.len) {
+		return;
+	}
+	int32_t band_x = *y / EDGE_BAND_SIZE, band_y = *x / EDGE_BAND_SIZE;
+	int32_t snapped_x = *x +
+		edges->x.offsets[(size_t)band_x * edges->x.len + *x];
+	*y += edges->y.offsets[(size_t)band_y * edges->y.len + *y];
+	*x = snapped_x;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "box.h"
+#include "edge-index.h"
+
+static int compare_edges(const void *a, const void *b) {
+	int32_t ea = *(const int32_t *)a, eb = *(const int32_t *)b;
+	return (ea > eb) - (ea < eb);
+}
+
+static bool edge_list_reserve(struct edge_list *list, size_t cap) {
+	if (cap <= list->cap) {
+		return true;
+	}
+	int32_t *edges = realloc(list->edges, cap * sizeof(int32_t));
+	if (edges == NULL) {
+		return false;
+	}
+	list->edges = edges;
+	list->cap = cap;
+	return true;
+}
+
+void edge_index_finish(struct edge_index *index) {
+	free(index->x.edges);
+	free(index->y.edges);
+	memset(index, 0, sizeof(struct edge_index));
+}
+
+bool edge_index_build(struct edge_index *index, struct wl_list *boxes) {
+	size_t n = 2 * wl_list_length(boxes);
+	if (!edge_list_reserve(&index->x, n) ||
+			!edge_list_reserve(&index->y, n)) {
+		return false;
+	}
+
+	index->x.len = index->y.len = 0;
+	struct slurp_box *box;
+	wl_list_for_each(box, boxes, link) {
+		// Selections include both of their corners, so the far edge is the
+		// last pixel inside the box
+		index->x.edges[index->x.len++] = box->x;
+		index->x.edges[index->x.len++] = box->x + box->width - 1;
+		index->y.edges[index->y.len++] = box->y;
+		index->y.edges[index->y.len++] = box->y + box->height - 1;
+	}
+
+	qsort(index->x.edges, index->x.len, sizeof(int32_t), compare_edges);
+	qsort(index->y.edges, index->y.len, sizeof(int32_t), compare_edges);
+	return true;
+}
+
+static size_t edge_list_lower_bound(const struct edge_list *list,
+		int32_t value) {
+	size_t lo = 0, hi = list->len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (list->edges[mid] < value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static bool edge_list_insert(struct edge_list *list, int32_t value) {
+	if (list->len == list->cap &&
+			!edge_list_reserve(list, list->cap ? list->cap * 2 : 16)) {
+		return false;
+	}
+	size_t i = edge_list_lower_bound(list, value);
+	memmove(&list->edges[i + 1], &list->edges[i],
+		(list->len - i) * sizeof(int32_t));
+	list->edges[i] = value;
+	list->len++;
+	return true;
+}
+
+static void edge_list_remove(struct edge_list *list, int32_t value) {
+	size_t i = edge_list_lower_bound(list, value);
+	if (i == list->len || list->edges[i] != value) {
+		return;
+	}
+	memmove(&list->edges[i], &list->edges[i + 1],
+		(list->len - i - 1) * sizeof(int32_t));
+	list->len--;
+}
+
+bool edge_index_add(struct edge_index *index, const struct slurp_box *box) {
+	return edge_list_insert(&index->x, box->x) &&
+		edge_list_insert(&index->x, box->x + box->width - 1) &&
+		edge_list_insert(&index->y, box->y) &&
+		edge_list_insert(&index->y, box->y + box->height - 1);
+}
+
+void edge_index_remove(struct edge_index *index, const struct slurp_box *box) {
+	edge_list_remove(&index->x, box->x);
+	edge_list_remove(&index->x, box->x + box->width - 1);
+	edge_list_remove(&index->y, box->y);
+	edge_list_remove(&index->y, box->y + box->height - 1);
+}
+
+int32_t edge_list_snap(const struct edge_list *list, int32_t value,
+		int32_t threshold) {
+	size_t lo = edge_list_lower_bound(list, value);
+
+	int32_t best = value;
+	int32_t best_dist = threshold + 1;
+	if (lo < list->len && list->edges[lo] - value < best_dist) {
+		best = list->edges[lo];
+		best_dist = best - value;
+	}
+	if (lo > 0 && value - list->edges[lo - 1] < best_dist) {
+		best = list->edges[lo - 1];
+	}
+	return best;
+}
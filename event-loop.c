@@ -0,0 +1,143 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event-loop.h"
+
+bool event_loop_init(struct event_loop *loop, struct wl_display *display) {
+	memset(loop, 0, sizeof(struct event_loop));
+	loop->display = display;
+	// The Wayland fd is dispatched by the loop itself
+	return event_loop_add_fd(loop, wl_display_get_fd(display), POLLIN,
+		NULL, NULL);
+}
+
+void event_loop_finish(struct event_loop *loop) {
+	free(loop->fds);
+	free(loop->sources);
+	memset(loop, 0, sizeof(struct event_loop));
+}
+
+bool event_loop_add_fd(struct event_loop *loop, int fd, short events,
+		event_loop_fd_func_t func, void *data) {
+	if (loop->len == loop->cap) {
+		size_t cap = loop->cap ? loop->cap * 2 : 4;
+		struct pollfd *fds = realloc(loop->fds, cap * sizeof(struct pollfd));
+		if (fds == NULL) {
+			return false;
+		}
+		loop->fds = fds;
+		struct event_loop_source *sources =
+			realloc(loop->sources, cap * sizeof(struct event_loop_source));
+		if (sources == NULL) {
+			return false;
+		}
+		loop->sources = sources;
+		loop->cap = cap;
+	}
+
+	loop->fds[loop->len] = (struct pollfd){ .fd = fd, .events = events };
+	loop->sources[loop->len] =
+		(struct event_loop_source){ .func = func, .data = data };
+	loop->len++;
+	return true;
+}
+
+static void compact(struct event_loop *loop) {
+	size_t j = 0;
+	for (size_t i = 0; i < loop->len; i++) {
+		if (loop->fds[i].fd < 0) {
+			continue;
+		}
+		loop->fds[j] = loop->fds[i];
+		loop->sources[j] = loop->sources[i];
+		j++;
+	}
+	loop->len = j;
+	loop->removed = false;
+}
+
+void event_loop_remove_fd(struct event_loop *loop, int fd) {
+	for (size_t i = 1; i < loop->len; i++) {
+		if (loop->fds[i].fd == fd) {
+			// Sources may remove themselves while being dispatched
+			loop->fds[i].fd = -1;
+			loop->removed = true;
+		}
+	}
+	if (!loop->dispatching) {
+		compact(loop);
+	}
+}
+
+void event_loop_set_queue(struct event_loop *loop,
+		event_loop_queue_func_t func, void *data) {
+	loop->dispatch_queue = func;
+	loop->queue_data = data;
+}
+
+static int dispatch_queue(struct event_loop *loop) {
+	if (loop->dispatch_queue == NULL) {
+		return 0;
+	}
+	return loop->dispatch_queue(loop->queue_data);
+}
+
+int event_loop_dispatch(struct event_loop *loop, int timeout) {
+	struct wl_display *display = loop->display;
+
+	while (wl_display_prepare_read(display) != 0) {
+		if (wl_display_dispatch_pending(display) < 0) {
+			return -1;
+		}
+	}
+	// Other threads can't read events until we do, the other queue stays
+	// empty from now on
+	if (dispatch_queue(loop) < 0) {
+		wl_display_cancel_read(display);
+		return -1;
+	}
+
+	loop->fds[0].events = POLLIN;
+	if (wl_display_flush(display) < 0) {
+		if (errno != EAGAIN) {
+			wl_display_cancel_read(display);
+			return -1;
+		}
+		// The socket is full, wait until we can write the rest
+		loop->fds[0].events |= POLLOUT;
+	}
+
+	if (poll(loop->fds, loop->len, timeout) < 0) {
+		wl_display_cancel_read(display);
+		return errno == EINTR ? 0 : -1;
+	}
+
+	if (loop->fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+		if (wl_display_read_events(display) < 0) {
+			return -1;
+		}
+	} else {
+		wl_display_cancel_read(display);
+	}
+	if (wl_display_dispatch_pending(display) < 0 || dispatch_queue(loop) < 0) {
+		return -1;
+	}
+
+	loop->dispatching = true;
+	for (size_t i = 1; i < loop->len; i++) {
+		struct pollfd *pfd = &loop->fds[i];
+		if (pfd->fd < 0 || pfd->revents == 0) {
+			continue;
+		}
+		loop->sources[i].func(pfd->fd, pfd->revents, loop->sources[i].data);
+	}
+	loop->dispatching = false;
+	if (loop->removed) {
+		compact(loop);
+	}
+
+	return 0;
+}
@@ -0,0 +1,346 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "libslurp.h"
+
+enum format_op_type {
+	FORMAT_LITERAL,
+	FORMAT_X,
+	FORMAT_Y,
+	FORMAT_WIDTH,
+	FORMAT_HEIGHT,
+	FORMAT_OUTPUT_X,
+	FORMAT_OUTPUT_Y,
+	FORMAT_OUTPUT_WIDTH,
+	FORMAT_OUTPUT_HEIGHT,
+	FORMAT_LABEL,
+	FORMAT_OUTPUT_NAME,
+};
+
+struct format_op {
+	enum format_op_type type;
+	size_t offset, len; // of a literal, in slurp_format::literals
+};
+
+struct slurp_format {
+	enum slurp_format_style style;
+	struct format_op *ops;
+	size_t ops_len;
+	char *literals;
+	bool needs_output;
+
+	// Records appended since the last flush
+	char *data;
+	size_t len, cap;
+};
+
+static bool reserve(struct slurp_format *format, size_t len) {
+	if (format->len + len <= format->cap) {
+		return true;
+	}
+	size_t cap = format->cap ? format->cap : 256;
+	while (cap < format->len + len) {
+		cap *= 2;
+	}
+	char *data = realloc(format->data, cap);
+	if (data == NULL) {
+		return false;
+	}
+	format->data = data;
+	format->cap = cap;
+	return true;
+}
+
+static void append(struct slurp_format *format, const char *str, size_t len) {
+	if (reserve(format, len)) {
+		memcpy(&format->data[format->len], str, len);
+		format->len += len;
+	}
+}
+
+static void append_str(struct slurp_format *format, const char *str) {
+	append(format, str, strlen(str));
+}
+
+static void append_int(struct slurp_format *format, int32_t value) {
+	char digits[12];
+	size_t i = sizeof(digits);
+	// Negate as unsigned, INT32_MIN has no positive counterpart
+	uint32_t n = value < 0 ? -(uint32_t)value : (uint32_t)value;
+	do {
+		digits[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n > 0);
+	if (value < 0) {
+		digits[--i] = '-';
+	}
+	append(format, &digits[i], sizeof(digits) - i);
+}
+
+static void append_escaped(const char *bytes, size_t len, void *data) {
+	append(data, bytes, len);
+}
+
+static void append_json_string(struct slurp_format *format, const char *str) {
+	json_escape_string(str, append_escaped, format);
+}
+
+static int32_t output_width(const struct slurp_box *box,
+		const struct slurp_box *output) {
+	int32_t width = output->x + output->width - box->x;
+	return box->width < width ? box->width : width;
+}
+
+static int32_t output_height(const struct slurp_box *box,
+		const struct slurp_box *output) {
+	int32_t height = output->y + output->height - box->y;
+	return box->height < height ? box->height : height;
+}
+
+static bool add_op(struct slurp_format *format, size_t *cap,
+		struct format_op op) {
+	if (format->ops_len == *cap) {
+		*cap = *cap ? *cap * 2 : 8;
+		struct format_op *ops = realloc(format->ops, *cap * sizeof(*ops));
+		if (ops == NULL) {
+			return false;
+		}
+		format->ops = ops;
+	}
+	// Merge adjacent literals
+	if (op.type == FORMAT_LITERAL && format->ops_len > 0) {
+		struct format_op *last = &format->ops[format->ops_len - 1];
+		if (last->type == FORMAT_LITERAL &&
+				last->offset + last->len == op.offset) {
+			last->len += op.len;
+			return true;
+		}
+	}
+	format->ops[format->ops_len++] = op;
+	return true;
+}
+
+/**
+ * Returns the operation of the sequence %c, or FORMAT_LITERAL if there is
+ * none.
+ */
+static enum format_op_type sequence_type(char c) {
+	switch (c) {
+	case 'x':
+		return FORMAT_X;
+	case 'y':
+		return FORMAT_Y;
+	case 'w':
+		return FORMAT_WIDTH;
+	case 'h':
+		return FORMAT_HEIGHT;
+	case 'X':
+		return FORMAT_OUTPUT_X;
+	case 'Y':
+		return FORMAT_OUTPUT_Y;
+	case 'W':
+		return FORMAT_OUTPUT_WIDTH;
+	case 'H':
+		return FORMAT_OUTPUT_HEIGHT;
+	case 'l':
+		return FORMAT_LABEL;
+	case 'o':
+		return FORMAT_OUTPUT_NAME;
+	default:
+		return FORMAT_LITERAL;
+	}
+}
+
+static bool compile(struct slurp_format *format, const char *str) {
+	format->literals = strdup(str);
+	if (format->literals == NULL) {
+		return false;
+	}
+	size_t cap = 0;
+	for (size_t i = 0; str[i] != '\0'; i++) {
+		struct format_op op = { .type = FORMAT_LITERAL, .offset = i, .len = 1 };
+		// Unknown sequences are kept as is
+		if (str[i] == '%' && (op.type = sequence_type(str[i + 1])) !=
+				FORMAT_LITERAL) {
+			i++;
+		}
+		switch (op.type) {
+		case FORMAT_OUTPUT_X:
+		case FORMAT_OUTPUT_Y:
+		case FORMAT_OUTPUT_WIDTH:
+		case FORMAT_OUTPUT_HEIGHT:
+			format->needs_output = true;
+			break;
+		default:
+			break;
+		}
+		if (!add_op(format, &cap, op)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct slurp_format *slurp_format_compile(const char *str,
+		enum slurp_format_style style) {
+	struct slurp_format *format = calloc(1, sizeof(struct slurp_format));
+	if (format == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	format->style = style;
+	// JSON records have a fixed layout
+	if (style != SLURP_FORMAT_JSON && !compile(format, str)) {
+		fprintf(stderr, "allocation failed\n");
+		slurp_format_destroy(format);
+		return NULL;
+	}
+	return format;
+}
+
+void slurp_format_destroy(struct slurp_format *format) {
+	if (format == NULL) {
+		return;
+	}
+	free(format->ops);
+	free(format->literals);
+	free(format->data);
+	free(format);
+}
+
+bool slurp_format_needs_output(const struct slurp_format *format) {
+	return format->needs_output;
+}
+
+static void append_json(struct slurp_format *format,
+		const struct slurp_box *box, const struct slurp_box *output,
+		bool final) {
+	append_str(format, "{\"x\":");
+	append_int(format, box->x);
+	append_str(format, ",\"y\":");
+	append_int(format, box->y);
+	append_str(format, ",\"width\":");
+	append_int(format, box->width);
+	append_str(format, ",\"height\":");
+	append_int(format, box->height);
+	append_str(format, ",\"label\":");
+	append_json_string(format, box->label);
+	append_str(format, ",\"output\":");
+	if (output == NULL) {
+		append_str(format, "null");
+	} else {
+		append_json_string(format, output->label);
+		append_str(format, ",\"output_x\":");
+		append_int(format, box->x - output->x);
+		append_str(format, ",\"output_y\":");
+		append_int(format, box->y - output->y);
+		append_str(format, ",\"output_width\":");
+		append_int(format, output_width(box, output));
+		append_str(format, ",\"output_height\":");
+		append_int(format, output_height(box, output));
+	}
+	if (final) {
+		append_str(format, ",\"final\":true");
+	}
+	append_str(format, "}\n");
+}
+
+static void append_record(struct slurp_format *format,
+		const struct slurp_box *box, const struct slurp_box *output,
+		bool final) {
+	if (format->style == SLURP_FORMAT_JSON) {
+		append_json(format, box, output, final);
+		return;
+	}
+
+	for (size_t i = 0; i < format->ops_len; i++) {
+		const struct format_op *op = &format->ops[i];
+		switch (op->type) {
+		case FORMAT_LITERAL:
+			append(format, &format->literals[op->offset], op->len);
+			break;
+		case FORMAT_X:
+			append_int(format, box->x);
+			break;
+		case FORMAT_Y:
+			append_int(format, box->y);
+			break;
+		case FORMAT_WIDTH:
+			append_int(format, box->width);
+			break;
+		case FORMAT_HEIGHT:
+			append_int(format, box->height);
+			break;
+		case FORMAT_OUTPUT_X:
+			assert(output);
+			append_int(format, box->x - output->x);
+			break;
+		case FORMAT_OUTPUT_Y:
+			assert(output);
+			append_int(format, box->y - output->y);
+			break;
+		case FORMAT_OUTPUT_WIDTH:
+			assert(output);
+			append_int(format, output_width(box, output));
+			break;
+		case FORMAT_OUTPUT_HEIGHT:
+			assert(output);
+			append_int(format, output_height(box, output));
+			break;
+		case FORMAT_LABEL:
+			if (box->label) {
+				append_str(format, box->label);
+			}
+			break;
+		case FORMAT_OUTPUT_NAME:
+			append_str(format, output && output->label ?
+				output->label : "<unknown>");
+			break;
+		}
+	}
+	if (format->style == SLURP_FORMAT_NUL) {
+		append(format, "", 1);
+	}
+}
+
+void slurp_format_append(struct slurp_format *format,
+		const struct slurp_box *box, const struct slurp_box *output) {
+	append_record(format, box, output, false);
+}
+
+void slurp_format_append_final(struct slurp_format *format,
+		const struct slurp_box *box, const struct slurp_box *output) {
+	append_record(format, box, output, true);
+}
+
+const char *slurp_format_data(const struct slurp_format *format, size_t *len) {
+	*len = format->len;
+	return format->data;
+}
+
+void slurp_format_reset(struct slurp_format *format) {
+	format->len = 0;
+}
+
+bool slurp_format_flush(struct slurp_format *format, int fd) {
+	size_t offset = 0;
+	while (offset < format->len) {
+		ssize_t n = write(fd, &format->data[offset], format->len - offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			format->len = 0;
+			return false;
+		}
+		offset += n;
+	}
+	format->len = 0;
+	return true;
+}
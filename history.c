@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "lock.h"
+
+#define HISTORY_MAGIC 0x534c5250 // "SLRP"
+#define HISTORY_VERSION 1
+
+bool history_open(struct history *history) {
+	history->fd = -1;
+	history->file = NULL;
+
+	char path[MAX_PATH_SIZE];
+	if (!get_runtime_file_path(path, "history")) {
+		return false;
+	}
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 00600);
+	if (fd == -1) {
+		fprintf(stderr, "failed to open history file\n");
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+	bool fresh = (size_t)st.st_size != sizeof(struct history_file);
+	if (fresh && ftruncate(fd, sizeof(struct history_file)) == -1) {
+		fprintf(stderr, "failed to resize history file\n");
+		close(fd);
+		return false;
+	}
+
+	struct history_file *file = mmap(NULL, sizeof(struct history_file),
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (file == MAP_FAILED) {
+		fprintf(stderr, "failed to map history file\n");
+		close(fd);
+		return false;
+	}
+	if (fresh || file->magic != HISTORY_MAGIC ||
+			file->version != HISTORY_VERSION ||
+			file->head >= HISTORY_SIZE || file->count > HISTORY_SIZE) {
+		// Stale or corrupt, start over
+		flock(fd, LOCK_EX);
+		memset(file, 0, sizeof(struct history_file));
+		file->magic = HISTORY_MAGIC;
+		file->version = HISTORY_VERSION;
+		flock(fd, LOCK_UN);
+	}
+
+	history->fd = fd;
+	history->file = file;
+	return true;
+}
+
+void history_close(struct history *history) {
+	if (history->file != NULL) {
+		munmap(history->file, sizeof(struct history_file));
+	}
+	if (history->fd != -1) {
+		close(history->fd);
+	}
+	history->fd = -1;
+	history->file = NULL;
+}
+
+void history_push(struct history *history, const struct history_entry *entry) {
+	struct history_file *file = history->file;
+	flock(history->fd, LOCK_EX);
+	uint32_t head = file->count == 0 ? 0 : (file->head + 1) % HISTORY_SIZE;
+	file->entries[head] = *entry;
+	file->head = head;
+	if (file->count < HISTORY_SIZE) {
+		file->count++;
+	}
+	flock(history->fd, LOCK_UN);
+}
+
+bool history_get(struct history *history, size_t n, struct history_entry *entry) {
+	struct history_file *file = history->file;
+	flock(history->fd, LOCK_SH);
+	bool found = n >= 1 && n <= file->count;
+	if (found) {
+		size_t i = (file->head + HISTORY_SIZE - (n - 1)) % HISTORY_SIZE;
+		*entry = file->entries[i];
+	}
+	flock(history->fd, LOCK_UN);
+	// The file may be written by other processes, never trust its strings
+	entry->output_name[sizeof(entry->output_name) - 1] = '\0';
+	entry->label[sizeof(entry->label) - 1] = '\0';
+	return found;
+}
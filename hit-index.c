@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "box.h"
+#include "hit-index.h"
+
+// Bounds the number of cells a large box is listed in
+#define HIT_INDEX_MAX_CELLS 32
+#define HIT_INDEX_MIN_CELL_SIZE 64
+
+struct hit_entry {
+	struct slurp_box *box;
+	int64_t size;
+	size_t order;
+};
+
+static int64_t box_area(const struct slurp_box *box) {
+	return (int64_t)box->width * box->height;
+}
+
+static int compare_hit_entries(const void *a, const void *b) {
+	const struct hit_entry *ea = a, *eb = b;
+	if (ea->size != eb->size) {
+		return (ea->size > eb->size) - (ea->size < eb->size);
+	}
+	// Later boxes first, like a linear scan keeping the last smallest box
+	return (ea->order < eb->order) - (ea->order > eb->order);
+}
+
+void hit_index_finish(struct hit_index *index) {
+	size_t n_cells = (size_t)index->columns * index->rows;
+	for (size_t i = 0; i < n_cells && index->cells != NULL; i++) {
+		free(index->cells[i].boxes);
+	}
+	free(index->cells);
+	memset(index, 0, sizeof(struct hit_index));
+}
+
+/**
+ * Get the range of cells overlapping box, clamped to the grid. Returns false
+ * if there is none.
+ */
+static bool cell_range(const struct hit_index *index,
+		const struct slurp_box *box, int32_t *col0, int32_t *col1,
+		int32_t *row0, int32_t *row1) {
+	if (index->cells == NULL || box->width <= 0 || box->height <= 0) {
+		return false;
+	}
+	int64_t c0 = ((int64_t)box->x - index->x) / index->cell_size;
+	int64_t c1 = ((int64_t)box->x + box->width - 1 - index->x) /
+		index->cell_size;
+	int64_t r0 = ((int64_t)box->y - index->y) / index->cell_size;
+	int64_t r1 = ((int64_t)box->y + box->height - 1 - index->y) /
+		index->cell_size;
+	// Division truncates toward zero, left of the origin is below 0 anyway
+	if ((int64_t)box->x + box->width <= index->x ||
+			(int64_t)box->y + box->height <= index->y ||
+			c0 >= index->columns || r0 >= index->rows) {
+		return false;
+	}
+	*col0 = c0 < 0 ? 0 : c0;
+	*col1 = c1 >= index->columns ? index->columns - 1 : c1;
+	*row0 = r0 < 0 ? 0 : r0;
+	*row1 = r1 >= index->rows ? index->rows - 1 : r1;
+	return true;
+}
+
+static bool in_grid(const struct hit_index *index, const struct slurp_box *box) {
+	return index->cells != NULL && box->x >= index->x && box->y >= index->y &&
+		(int64_t)box->x + box->width <=
+			index->x + (int64_t)index->columns * index->cell_size &&
+		(int64_t)box->y + box->height <=
+			index->y + (int64_t)index->rows * index->cell_size;
+}
+
+static bool cell_insert(struct hit_cell *cell, size_t pos,
+		struct slurp_box *box) {
+	if (cell->len == cell->cap) {
+		size_t cap = cell->cap ? cell->cap * 2 : 4;
+		struct slurp_box **boxes =
+			realloc(cell->boxes, cap * sizeof(struct slurp_box *));
+		if (boxes == NULL) {
+			return false;
+		}
+		cell->boxes = boxes;
+		cell->cap = cap;
+	}
+	memmove(&cell->boxes[pos + 1], &cell->boxes[pos],
+		(cell->len - pos) * sizeof(struct slurp_box *));
+	cell->boxes[pos] = box;
+	cell->len++;
+	return true;
+}
+
+bool hit_index_build(struct hit_index *index, struct wl_list *boxes,
+		const struct slurp_box *bounds) {
+	hit_index_finish(index);
+
+	size_t len = wl_list_length(boxes);
+	struct hit_entry *sorted = malloc((len ? len : 1) * sizeof(struct hit_entry));
+	if (sorted == NULL) {
+		return false;
+	}
+
+	int64_t x0 = INT64_MAX, y0 = INT64_MAX, x1 = INT64_MIN, y1 = INT64_MIN;
+	if (bounds != NULL && bounds->width > 0 && bounds->height > 0) {
+		x0 = bounds->x;
+		y0 = bounds->y;
+		x1 = (int64_t)bounds->x + bounds->width;
+		y1 = (int64_t)bounds->y + bounds->height;
+	}
+
+	// Empty boxes can't contain any point
+	size_t n = 0, order = 0;
+	struct slurp_box *box;
+	wl_list_for_each(box, boxes, link) {
+		order++;
+		if (box->width <= 0 || box->height <= 0) {
+			continue;
+		}
+		sorted[n++] = (struct hit_entry){
+			.box = box,
+			.size = box_area(box),
+			.order = order,
+		};
+		if (box->x < x0) {
+			x0 = box->x;
+		}
+		if (box->y < y0) {
+			y0 = box->y;
+		}
+		if ((int64_t)box->x + box->width > x1) {
+			x1 = (int64_t)box->x + box->width;
+		}
+		if ((int64_t)box->y + box->height > y1) {
+			y1 = (int64_t)box->y + box->height;
+		}
+	}
+	if (x0 > x1) {
+		free(sorted);
+		index->valid = true;
+		return true;
+	}
+	qsort(sorted, n, sizeof(struct hit_entry), compare_hit_entries);
+
+	int64_t extent = x1 - x0 > y1 - y0 ? x1 - x0 : y1 - y0;
+	int64_t cell_size = (extent + HIT_INDEX_MAX_CELLS - 1) / HIT_INDEX_MAX_CELLS;
+	index->cell_size = cell_size > HIT_INDEX_MIN_CELL_SIZE ?
+		cell_size : HIT_INDEX_MIN_CELL_SIZE;
+	index->x = x0;
+	index->y = y0;
+	index->columns = (x1 - x0 + index->cell_size - 1) / index->cell_size;
+	index->rows = (y1 - y0 + index->cell_size - 1) / index->cell_size;
+
+	size_t n_cells = (size_t)index->columns * index->rows;
+	index->cells = calloc(n_cells ? n_cells : 1, sizeof(struct hit_cell));
+	if (index->cells == NULL) {
+		free(sorted);
+		hit_index_finish(index);
+		return false;
+	}
+
+	// Entries are added smallest first, so each cell stays sorted
+	for (size_t i = 0; i < n; i++) {
+		int32_t col0, col1, row0, row1;
+		cell_range(index, sorted[i].box, &col0, &col1, &row0, &row1);
+		for (int32_t row = row0; row <= row1; row++) {
+			for (int32_t col = col0; col <= col1; col++) {
+				struct hit_cell *cell =
+					&index->cells[(size_t)row * index->columns + col];
+				if (!cell_insert(cell, cell->len, sorted[i].box)) {
+					free(sorted);
+					hit_index_finish(index);
+					return false;
+				}
+			}
+		}
+	}
+
+	free(sorted);
+	index->valid = true;
+	return true;
+}
+
+bool hit_index_add(struct hit_index *index, struct slurp_box *box) {
+	if (!index->valid || box->width <= 0 || box->height <= 0) {
+		return true;
+	}
+	if (!in_grid(index, box)) {
+		// Rebuilt with a larger grid when it's next needed
+		index->valid = false;
+		return true;
+	}
+
+	int32_t col0, col1, row0, row1;
+	cell_range(index, box, &col0, &col1, &row0, &row1);
+	int64_t size = box_area(box);
+	for (int32_t row = row0; row <= row1; row++) {
+		for (int32_t col = col0; col <= col1; col++) {
+			struct hit_cell *cell =
+				&index->cells[(size_t)row * index->columns + col];
+			// The box is the last one, it goes before those of the same size
+			size_t pos = 0;
+			while (pos < cell->len && box_area(cell->boxes[pos]) < size) {
+				pos++;
+			}
+			if (!cell_insert(cell, pos, box)) {
+				index->valid = false;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void hit_index_remove(struct hit_index *index, const struct slurp_box *box) {
+	int32_t col0, col1, row0, row1;
+	if (!index->valid || !cell_range(index, box, &col0, &col1, &row0, &row1)) {
+		return;
+	}
+	for (int32_t row = row0; row <= row1; row++) {
+		for (int32_t col = col0; col <= col1; col++) {
+			struct hit_cell *cell =
+				&index->cells[(size_t)row * index->columns + col];
+			for (size_t i = 0; i < cell->len; i++) {
+				if (cell->boxes[i] == box) {
+					memmove(&cell->boxes[i], &cell->boxes[i + 1],
+						(cell->len - i - 1) * sizeof(struct slurp_box *));
+					cell->len--;
+					break;
+				}
+			}
+		}
+	}
+}
+
+struct slurp_box *hit_index_query(const struct hit_index *index,
+		int32_t x, int32_t y) {
+	if (index->cells == NULL || x < index->x || y < index->y) {
+		return NULL;
+	}
+	int64_t col = ((int64_t)x - index->x) / index->cell_size;
+	int64_t row = ((int64_t)y - index->y) / index->cell_size;
+	if (col >= index->columns || row >= index->rows) {
+		return NULL;
+	}
+
+	const struct hit_cell *cell =
+		&index->cells[(size_t)row * index->columns + col];
+	for (size_t i = 0; i < cell->len; i++) {
+		if (slurp_box_contains(cell->boxes[i], x, y)) {
+			return cell->boxes[i];
+		}
+	}
+	return NULL;
+}
+
+void hit_index_for_each(const struct hit_index *index,
+		const struct slurp_box *area,
+		void (*func)(struct slurp_box *box, void *data), void *data) {
+	int32_t col0, col1, row0, row1;
+	if (!cell_range(index, area, &col0, &col1, &row0, &row1)) {
+		return;
+	}
+	for (int32_t row = row0; row <= row1; row++) {
+		for (int32_t col = col0; col <= col1; col++) {
+			const struct hit_cell *cell =
+				&index->cells[(size_t)row * index->columns + col];
+			for (size_t i = 0; i < cell->len; i++) {
+				func(cell->boxes[i], data);
+			}
+		}
+	}
+}
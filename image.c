@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+#include <cairo/cairo.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "slurp.h"
+
+/**
+ * Copies one output capture into its part of the image. Each output covers a
+ * disjoint part of the image, so jobs can run concurrently.
+ */
+struct blit_job {
+	pthread_t thread;
+	bool threaded;
+	const struct capture *capture;
+	enum image_format format;
+	uint8_t *data;
+	size_t stride;
+	// Destination rectangle, in image pixels
+	int32_t x, y, width, height;
+	bool ok;
+};
+
+static void blit_pixel(enum image_format format, uint8_t *dst, uint32_t px) {
+	switch (format) {
+	case IMAGE_FORMAT_PNG:
+		// CAIRO_FORMAT_RGB24 has the same layout as XRGB8888
+		px |= 0xFF000000;
+		memcpy(dst, &px, sizeof(px));
+		break;
+	case IMAGE_FORMAT_PPM:
+		dst[0] = (px >> 16) & 0xFF;
+		dst[1] = (px >> 8) & 0xFF;
+		dst[2] = px & 0xFF;
+		break;
+	}
+}
+
+static void *run_blit_job(void *data) {
+	struct blit_job *job = data;
+	const struct capture *capture = job->capture;
+	size_t bpp = job->format == IMAGE_FORMAT_PNG ? 4 : 3;
+	if (job->width <= 0 || job->height <= 0) {
+		job->ok = true;
+		return NULL;
+	}
+
+	// Nearest neighbor, with a precomputed source column per image column
+	uint32_t *columns = malloc(job->width * sizeof(uint32_t));
+	if (columns == NULL) {
+		job->ok = false;
+		return NULL;
+	}
+	for (int32_t x = 0; x < job->width; x++) {
+		columns[x] = (uint64_t)x * capture->width / job->width;
+	}
+
+	for (int32_t y = 0; y < job->height; y++) {
+		uint32_t src_y = (uint64_t)y * capture->height / job->height;
+		const uint8_t *src = (const uint8_t *)capture->data +
+			(size_t)src_y * capture->stride;
+		uint8_t *dst = job->data + (size_t)(job->y + y) * job->stride +
+			(size_t)job->x * bpp;
+		for (int32_t x = 0; x < job->width; x++) {
+			uint32_t px;
+			memcpy(&px, src + (size_t)columns[x] * 4, sizeof(px));
+			blit_pixel(job->format, dst + (size_t)x * bpp, px);
+		}
+	}
+
+	free(columns);
+	job->ok = true;
+	return NULL;
+}
+
+static cairo_status_t write_png_stream(void *closure,
+		const unsigned char *data, unsigned int length) {
+	FILE *stream = closure;
+	if (fwrite(data, 1, length, stream) != length) {
+		return CAIRO_STATUS_WRITE_ERROR;
+	}
+	return CAIRO_STATUS_SUCCESS;
+}
+
+enum image_format image_format_from_path(const char *path) {
+	const char *ext = strrchr(path, '.');
+	if (ext != NULL && strcmp(ext, ".ppm") == 0) {
+		return IMAGE_FORMAT_PPM;
+	}
+	return IMAGE_FORMAT_PNG;
+}
+
+bool write_region_image(struct slurp_state *state, const struct slurp_box *box,
+		enum image_format format, FILE *stream) {
+	struct slurp_output *output;
+	size_t n_jobs = 0;
+	double scale = 1;
+	wl_list_for_each(output, &state->outputs, link) {
+		const struct capture *capture = &output->capture;
+		if (!capture->done) {
+			continue;
+		}
+		// Captures are in the logical orientation, see apply_transform.
+		// Both axes count in case the compositor rounded one of them.
+		double scale_x = (double)capture->width / capture->region.width;
+		double scale_y = (double)capture->height / capture->region.height;
+		double capture_scale = scale_x > scale_y ? scale_x : scale_y;
+		if (capture_scale > scale) {
+			scale = capture_scale;
+		}
+		n_jobs++;
+	}
+	if (n_jobs == 0) {
+		fprintf(stderr, "nothing was captured\n");
+		return false;
+	}
+
+	int32_t width = ceil(box->width * scale);
+	int32_t height = ceil(box->height * scale);
+
+	cairo_surface_t *surface = NULL;
+	uint8_t *data;
+	size_t stride;
+	if (format == IMAGE_FORMAT_PNG) {
+		surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+		if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy(surface);
+			fprintf(stderr, "failed to create image\n");
+			return false;
+		}
+		cairo_surface_flush(surface);
+		data = cairo_image_surface_get_data(surface);
+		stride = cairo_image_surface_get_stride(surface);
+	} else {
+		stride = (size_t)width * 3;
+		// Parts of the region outside of any output stay black
+		data = calloc(height, stride);
+		if (data == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+	}
+
+	struct blit_job *jobs = calloc(n_jobs, sizeof(struct blit_job));
+	if (jobs == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		if (surface) {
+			cairo_surface_destroy(surface);
+		} else {
+			free(data);
+		}
+		return false;
+	}
+
+	size_t i = 0;
+	wl_list_for_each(output, &state->outputs, link) {
+		const struct capture *capture = &output->capture;
+		if (!capture->done) {
+			continue;
+		}
+		const struct slurp_box *region = &capture->region;
+		struct blit_job *job = &jobs[i++];
+		job->capture = capture;
+		job->format = format;
+		job->data = data;
+		job->stride = stride;
+		// Round both edges so that adjacent outputs don't overlap
+		job->x = lround((region->x - box->x) * scale);
+		job->y = lround((region->y - box->y) * scale);
+		job->width = lround((region->x + region->width - box->x) * scale) - job->x;
+		job->height = lround((region->y + region->height - box->y) * scale) - job->y;
+		if (job->x + job->width > width) {
+			job->width = width - job->x;
+		}
+		if (job->y + job->height > height) {
+			job->height = height - job->y;
+		}
+	}
+
+	// Run the last job on this thread, and the others on their own
+	bool ok = true;
+	for (i = 0; i + 1 < n_jobs; i++) {
+		jobs[i].threaded = pthread_create(&jobs[i].thread, NULL,
+			run_blit_job, &jobs[i]) == 0;
+		if (!jobs[i].threaded) {
+			run_blit_job(&jobs[i]);
+		}
+	}
+	run_blit_job(&jobs[n_jobs - 1]);
+	for (i = 0; i < n_jobs; i++) {
+		if (jobs[i].threaded) {
+			pthread_join(jobs[i].thread, NULL);
+		}
+		ok = ok && jobs[i].ok;
+	}
+	free(jobs);
+
+	if (!ok) {
+		fprintf(stderr, "allocation failed\n");
+	} else if (format == IMAGE_FORMAT_PNG) {
+		cairo_surface_mark_dirty(surface);
+		ok = cairo_surface_write_to_png_stream(surface, write_png_stream,
+			stream) == CAIRO_STATUS_SUCCESS;
+	} else {
+		ok = fprintf(stream, "P6\n%d %d\n255\n", width, height) > 0 &&
+			fwrite(data, stride, height, stream) == (size_t)height;
+	}
+	if (ok && fflush(stream) != 0) {
+		ok = false;
+	}
+
+	if (surface) {
+		cairo_surface_destroy(surface);
+	} else {
+		free(data);
+	}
+	return ok;
+}
@@ -5,6 +5,9 @@
 #include <stdint.h>
 #include <wayland-client.h>
 
+// Symbols exported by libslurp, which hides all others
+#define SLURP_API __attribute__((visibility("default")))
+
 struct slurp_box {
 	int32_t x, y;
 	int32_t width, height;
@@ -12,10 +15,12 @@ struct slurp_box {
 	struct wl_list link;
 };
 
-bool box_intersect(const struct slurp_box *a, const struct slurp_box *b);
+SLURP_API bool slurp_box_intersect(const struct slurp_box *a,
+	const struct slurp_box *b);
 
-bool in_box(const struct slurp_box *box, int32_t x, int32_t y);
+SLURP_API bool slurp_box_contains(const struct slurp_box *box,
+	int32_t x, int32_t y);
 
-int32_t box_size(const struct slurp_box *box);
+SLURP_API int32_t slurp_box_size(const struct slurp_box *box);
 
 #endif
@@ -0,0 +1,54 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <cairo/cairo.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "box.h"
+
+struct shm_stats;
+struct slurp_state;
+struct slurp_output;
+struct zwlr_screencopy_frame_v1;
+
+/**
+ * A copy of an output's content in a wl_shm buffer, in a format cairo can
+ * read directly.
+ */
+struct capture {
+	struct shm_stats *stats;
+	struct zwlr_screencopy_frame_v1 *frame;
+	struct wl_buffer *buffer;
+	cairo_surface_t *surface;
+	cairo_surface_t *tinted; // see capture_tint
+	void *data;
+	size_t size;
+	uint32_t format; // enum wl_shm_format
+	uint32_t width, height, stride;
+	uint32_t flags; // enum zwlr_screencopy_frame_v1_flags
+	struct slurp_box region; // captured logical area, if not the whole output
+	bool done, failed;
+};
+
+/**
+ * Capture all outputs and wait for the captures to complete. Outputs which
+ * couldn't be captured are left with an empty capture.
+ */
+bool capture_outputs(struct slurp_state *state);
+/**
+ * Capture the part of each output covered by box, in logical coordinates, and
+ * wait for the captures to complete. Outputs outside of box are left with an
+ * empty capture.
+ */
+bool capture_region(struct slurp_state *state, const struct slurp_box *box);
+void capture_finish(struct capture *capture);
+/**
+ * Blend color (in RRGGBBAA format) over a copy of the captured pixels, once,
+ * so that a frozen frame can be painted in a single pass. The capture itself
+ * is left as captured. Returns false if the copy can't be allocated.
+ */
+bool capture_tint(struct capture *capture, uint32_t color);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef _CONTENT_EDGES_H
+#define _CONTENT_EDGES_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct capture;
+
+/**
+ * Nearest strong edge of each pixel along one axis, per band of pixels across
+ * it. Offsets are 0 if there is no edge within the snapping radius.
+ */
+struct content_edges_axis {
+	int8_t *offsets; // bands * len
+	int32_t len, bands;
+};
+
+/**
+ * Visual edges of an output capture, computed on a background thread. The
+ * capture must be left untouched until content_edges_finish.
+ */
+struct content_edges {
+	pthread_t thread;
+	bool threaded;
+	atomic_bool ready;
+
+	const struct capture *capture; // in the logical orientation
+	int32_t radius; // in capture pixels, at most INT8_MAX
+
+	struct content_edges_axis x; // vertical edges, to snap x
+	struct content_edges_axis y; // horizontal edges, to snap y
+};
+
+bool content_edges_start(struct content_edges *edges,
+	const struct capture *capture, int32_t radius);
+void content_edges_finish(struct content_edges *edges);
+
+/**
+ * Snap x and y, in capture pixels, to the nearest edges in O(1). Nothing is
+ * changed until the edges are ready.
+ */
+void content_edges_snap(const struct content_edges *edges,
+	int32_t *x, int32_t *y);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _EDGE_INDEX_H
+#define _EDGE_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+struct slurp_box;
+
+struct edge_list {
+	int32_t *edges; // sorted, may contain duplicates
+	size_t len, cap;
+};
+
+/**
+ * Sorted vertical (x) and horizontal (y) edges of a set of boxes, used to
+ * snap freeform selections in O(log n).
+ */
+struct edge_index {
+	struct edge_list x, y;
+};
+
+void edge_index_finish(struct edge_index *index);
+bool edge_index_build(struct edge_index *index, struct wl_list *boxes);
+bool edge_index_add(struct edge_index *index, const struct slurp_box *box);
+void edge_index_remove(struct edge_index *index, const struct slurp_box *box);
+
+/**
+ * Return the edge closest to value within threshold, or value itself if
+ * there is none.
+ */
+int32_t edge_list_snap(const struct edge_list *list, int32_t value,
+	int32_t threshold);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <wayland-client.h>
+
+typedef void (*event_loop_fd_func_t)(int fd, short revents, void *data);
+typedef int (*event_loop_queue_func_t)(void *data);
+
+struct event_loop_source {
+	event_loop_fd_func_t func;
+	void *data;
+};
+
+/**
+ * A poll(2)-based loop multiplexing the Wayland connection with other file
+ * descriptors. Index 0 is always the Wayland display fd.
+ */
+struct event_loop {
+	struct wl_display *display;
+	struct pollfd *fds;
+	struct event_loop_source *sources;
+	size_t len, cap;
+	bool dispatching;
+	bool removed;
+	// Dispatches another event queue of the display, if set
+	event_loop_queue_func_t dispatch_queue;
+	void *queue_data;
+};
+
+bool event_loop_init(struct event_loop *loop, struct wl_display *display);
+void event_loop_finish(struct event_loop *loop);
+bool event_loop_add_fd(struct event_loop *loop, int fd, short events,
+	event_loop_fd_func_t func, void *data);
+void event_loop_remove_fd(struct event_loop *loop, int fd);
+/**
+ * Call func whenever the events of another queue must be dispatched: once
+ * the display is read, and before waiting for it. func returns -1 if the
+ * connection failed.
+ */
+void event_loop_set_queue(struct event_loop *loop,
+	event_loop_queue_func_t func, void *data);
+/**
+ * Wait for events and dispatch them. Returns -1 if the Wayland connection
+ * failed.
+ */
+int event_loop_dispatch(struct event_loop *loop, int timeout);
+
+#endif
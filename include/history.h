@@ -0,0 +1,45 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_SIZE 16
+
+struct history_entry {
+	int32_t x, y, width, height;
+	// Logical geometry of the output containing the top left corner, with
+	// a zero width if unknown
+	int32_t output_x, output_y, output_width, output_height;
+	char output_name[64];
+	char label[256];
+};
+
+struct history_file {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t head; // index of the most recent entry
+	uint32_t count;
+	struct history_entry entries[HISTORY_SIZE];
+};
+
+/**
+ * Ring of the last selections for a Wayland display, stored in a file mapped
+ * from the runtime directory next to the lock file.
+ */
+struct history {
+	int fd;
+	struct history_file *file;
+};
+
+bool history_open(struct history *history);
+void history_close(struct history *history);
+void history_push(struct history *history, const struct history_entry *entry);
+/**
+ * Get the nth previous selection, starting at 1 for the most recent one.
+ * Returns false if there is no such entry.
+ */
+bool history_get(struct history *history, size_t n, struct history_entry *entry);
+
+#endif
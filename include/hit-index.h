@@ -0,0 +1,57 @@
+#ifndef _HIT_INDEX_H
+#define _HIT_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+struct slurp_box;
+
+struct hit_cell {
+	struct slurp_box **boxes; // smallest first
+	size_t len, cap;
+};
+
+/**
+ * Uniform grid over a set of boxes, to find the smallest box containing a
+ * point without testing all of them. Each cell lists the boxes overlapping
+ * it, smallest first.
+ */
+struct hit_index {
+	bool valid; // false if the boxes changed since the last build
+	int32_t x, y; // origin of the grid
+	int32_t cell_size;
+	int32_t columns, rows;
+	struct hit_cell *cells; // columns * rows
+};
+
+void hit_index_finish(struct hit_index *index);
+/**
+ * Build the index of boxes. The grid covers them and bounds, if not NULL,
+ * which boxes added later are expected to be within.
+ */
+bool hit_index_build(struct hit_index *index, struct wl_list *boxes,
+	const struct slurp_box *bounds);
+/**
+ * Add box, which must be the last one in the list the index was built from.
+ * A box outside of the grid invalidates the index instead.
+ */
+bool hit_index_add(struct hit_index *index, struct slurp_box *box);
+void hit_index_remove(struct hit_index *index, const struct slurp_box *box);
+
+/**
+ * Return the smallest box containing x, y, or NULL. Among boxes of the same
+ * size, the last one in the list wins. The index must be valid.
+ */
+struct slurp_box *hit_index_query(const struct hit_index *index,
+	int32_t x, int32_t y);
+/**
+ * Call func for each box in the cells overlapping area. A box overlapping
+ * several of them is passed once per cell. The index must be valid.
+ */
+void hit_index_for_each(const struct hit_index *index,
+	const struct slurp_box *area,
+	void (*func)(struct slurp_box *box, void *data), void *data);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+struct slurp_state;
+struct slurp_box;
+
+enum image_format {
+	IMAGE_FORMAT_PNG,
+	IMAGE_FORMAT_PPM,
+};
+
+/**
+ * Pick the image format from the file name extension, PNG by default.
+ */
+enum image_format image_format_from_path(const char *path);
+
+/**
+ * Assemble the output captures made by capture_region into a single image of
+ * box and encode it to stream. The image uses the highest scale of the
+ * captured outputs.
+ */
+bool write_region_image(struct slurp_state *state, const struct slurp_box *box,
+	enum image_format format, FILE *stream);
+
+#endif
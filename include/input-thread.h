@@ -0,0 +1,110 @@
+#ifndef _INPUT_THREAD_H
+#define _INPUT_THREAD_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+// Must be a power of two
+#define INPUT_RING_SIZE 1024
+
+enum input_event_type {
+	INPUT_POINTER_ENTER,
+	INPUT_POINTER_LEAVE,
+	INPUT_POINTER_MOTION,
+	INPUT_POINTER_BUTTON,
+	INPUT_KEYBOARD_KEYMAP,
+	INPUT_KEYBOARD_KEY,
+	INPUT_KEYBOARD_MODIFIERS,
+	INPUT_TOUCH_DOWN,
+	INPUT_TOUCH_UP,
+	INPUT_TOUCH_MOTION,
+	INPUT_TOUCH_CANCEL,
+};
+
+/**
+ * A seat event, with the arguments of the Wayland event it comes from.
+ */
+struct input_event {
+	enum input_event_type type;
+	void *data; // listener data of the device
+	struct wl_surface *surface; // enter and touch down
+	uint32_t serial, time;
+	int32_t id; // touch point
+	wl_fixed_t x, y;
+	// button and state, key and state, modifiers and group, or keymap
+	// format, fd and size
+	uint32_t args[4];
+};
+
+/**
+ * Single-producer single-consumer queue of events, without locks.
+ */
+struct input_ring {
+	struct input_event events[INPUT_RING_SIZE];
+	// On separate cache lines, each one is only written by one side
+	alignas(64) atomic_size_t head; // next event to read
+	alignas(64) atomic_size_t tail; // next event to write
+};
+
+/**
+ * Reads and dispatches the events of queue on its own thread, so that they
+ * keep being read while the main thread renders. Listeners of objects on
+ * queue push normalized events with input_thread_push, the main thread pops
+ * them with input_thread_peek and input_thread_pop when wake_fd is readable.
+ */
+struct input_thread {
+	struct wl_display *display;
+	struct wl_event_queue *queue;
+	pthread_t thread;
+	bool running;
+	int stop_fd, wake_fd; // eventfds
+	atomic_bool wake_pending;
+	struct input_ring ring;
+};
+
+bool input_thread_init(struct input_thread *input, struct wl_display *display);
+bool input_thread_start(struct input_thread *input);
+/**
+ * Join the thread, after which objects on the queue can be destroyed.
+ */
+void input_thread_stop(struct input_thread *input);
+/**
+ * Stop the thread if needed, drop the events left and destroy the queue.
+ */
+void input_thread_finish(struct input_thread *input);
+
+/**
+ * Called from the input thread. Waits for the main thread if the ring is
+ * full.
+ */
+void input_thread_push(struct input_thread *input,
+	const struct input_event *event);
+
+/**
+ * Called from the main thread when wake_fd is readable, before popping.
+ */
+void input_thread_clear_wake(struct input_thread *input);
+/**
+ * Returns the next event, or NULL if there is none.
+ */
+const struct input_event *input_thread_peek(struct input_thread *input);
+void input_thread_pop(struct input_thread *input);
+/**
+ * Called from the main thread. Drops the events left, e.g. once the seats
+ * they refer to are gone.
+ */
+void input_thread_drop(struct input_thread *input);
+/**
+ * Called from the main thread before destroying surface, so that queued
+ * events don't refer to it anymore. Events read after the surface is
+ * destroyed have no surface already.
+ */
+void input_thread_forget_surface(struct input_thread *input,
+	const struct wl_surface *surface);
+
+#endif
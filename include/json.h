@@ -0,0 +1,66 @@
+#ifndef _JSON_H
+#define _JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+enum json_token {
+	JSON_ERROR,
+	JSON_END,
+	JSON_OBJECT_START,
+	JSON_OBJECT_END,
+	JSON_ARRAY_START,
+	JSON_ARRAY_END,
+	JSON_KEY,
+	JSON_STRING,
+	JSON_NUMBER,
+	JSON_TRUE,
+	JSON_FALSE,
+	JSON_NULL,
+};
+
+#define JSON_MAX_DEPTH 128
+
+/**
+ * A pull parser returning one token at a time without building a tree. The
+ * only allocation is a scratch buffer for decoded strings, reused between
+ * tokens.
+ */
+struct json_parser {
+	const char *data;
+	size_t len, pos;
+
+	// container stack: true for objects, false for arrays
+	bool in_object[JSON_MAX_DEPTH];
+	size_t depth;
+	bool expect_key;
+
+	// value of the last JSON_KEY or JSON_STRING token
+	char *str;
+	size_t str_len, str_cap;
+	// value of the last JSON_NUMBER token
+	double number;
+};
+
+void json_parser_init(struct json_parser *parser, const char *data, size_t len);
+void json_parser_finish(struct json_parser *parser);
+enum json_token json_next(struct json_parser *parser);
+/**
+ * Skip the value starting with token, including nested containers.
+ */
+bool json_skip(struct json_parser *parser, enum json_token token);
+
+/**
+ * Pass str to write as a quoted JSON string, in pieces, or null if str is
+ * NULL. Control characters and DEL are escaped, bytes above 0x7F are copied
+ * as is.
+ */
+void json_escape_string(const char *str,
+	void (*emit)(const char *bytes, size_t len, void *data), void *data);
+/**
+ * Write str to stream with json_escape_string.
+ */
+void json_write_string(FILE *stream, const char *str);
+
+#endif
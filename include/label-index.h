@@ -0,0 +1,60 @@
+#ifndef _LABEL_INDEX_H
+#define _LABEL_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+struct slurp_box;
+
+struct label_gram {
+	uint32_t key; // length and bytes of the n-gram, 0 if the slot is free
+	uint32_t *ids; // ascending
+	size_t len, cap;
+};
+
+/**
+ * Index of the 1, 2 and 3-grams of box labels, ignoring ASCII case, to find
+ * the labels containing a string without scanning all of them. Labeled boxes
+ * are identified by the order they were added in, which doesn't change when
+ * others are removed.
+ */
+struct label_index {
+	bool valid; // false if the ids need to be assigned again
+	struct slurp_box **boxes; // by id, NULL once removed
+	char **labels; // by id, lowercase, NULL once removed
+	size_t len, cap;
+	size_t removed; // ids left unused by removals
+	struct label_gram *grams; // hash table
+	size_t grams_len, grams_cap;
+};
+
+void label_index_finish(struct label_index *index);
+bool label_index_build(struct label_index *index, struct wl_list *boxes);
+/**
+ * Add box, which must come after the other boxes in the list the index was
+ * built from.
+ */
+bool label_index_add(struct label_index *index, struct slurp_box *box);
+/**
+ * Remove box. Once most ids are unused, the index is invalidated instead so
+ * that the next build packs them again.
+ */
+void label_index_remove(struct label_index *index, const struct slurp_box *box);
+
+/**
+ * Store the ids of the boxes whose label contains query, in ascending order,
+ * into matches, which must have room for index->len ids. Returns the number
+ * of matches. The index must be valid.
+ */
+size_t label_index_search(const struct label_index *index, const char *query,
+	uint32_t *matches);
+/**
+ * Check whether the label of box id starts with the len bytes of prefix,
+ * ignoring ASCII case like the search does.
+ */
+bool label_index_has_prefix(const struct label_index *index, uint32_t id,
+	const char *prefix, size_t len);
+
+#endif
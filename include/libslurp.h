@@ -0,0 +1,287 @@
+#ifndef _LIBSLURP_H
+#define _LIBSLURP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+
+#include "box.h"
+
+/**
+ * A selection on a Wayland connection owned by the caller. All objects are
+ * created on a queue of their own, so that slurp never dispatches the
+ * caller's events: the caller drives the selection by reading the display
+ * from its own event loop and calling slurp_dispatch_pending, until
+ * slurp_is_running returns false.
+ */
+struct slurp_state;
+
+/**
+ * Rendering quality levels, each one dropping more than the previous one.
+ */
+enum slurp_quality {
+	SLURP_QUALITY_FULL,
+	SLURP_QUALITY_REDUCED_SCALE, // half resolution, needs wp_viewporter
+	SLURP_QUALITY_NO_CHOICE_BOXES,
+	SLURP_QUALITY_NO_DIMENSIONS,
+	SLURP_QUALITY_LEVELS,
+};
+
+/**
+ * Colors are in RRGGBBAA format.
+ */
+struct slurp_options {
+	uint32_t background_color;
+	uint32_t border_color;
+	uint32_t selection_color;
+	uint32_t choice_color;
+	const char *font_family;
+	uint32_t border_weight;
+	bool display_dimensions;
+	bool single_point;
+	bool restrict_selection;
+	bool crosshairs;
+	bool output_boxes; // add the outputs to the predefined boxes
+	// Typing narrows the predefined boxes to those with a matching label,
+	// and Enter selects the best match
+	bool filter_labels;
+	double aspect_ratio; // height / width, 0 if not fixed
+	uint32_t snap_threshold; // 0 to disable edge snapping
+	// Snap freeform selections to the visual edges of the outputs, found in
+	// a capture taken by slurp_start
+	bool content_snap;
+	uint32_t magnifier_zoom; // 0 to disable the magnifier
+	// Draw the selection where the pointer is expected to be when the frame
+	// is presented. The result is not affected.
+	bool predict;
+	// Render time above which the quality is lowered while dragging, in
+	// milliseconds. 0 to always render at full quality.
+	double frame_budget;
+	bool frozen;
+	// Render opaque overlays to 16-bit buffers if the compositor supports
+	// them, halving memory and bandwidth at the cost of color banding
+	bool low_memory;
+	// Read pointer, keyboard and touch events on a separate thread, so that
+	// they aren't delayed by rendering. The caller must then watch the fd
+	// returned by slurp_get_input_fd.
+	bool input_thread;
+	// Fail early if slurp_save_result_image can't be used
+	bool capture_result;
+	// Fail early if slurp_offer_clipboard can't be used
+	bool clipboard;
+	// Only resolve outputs, slurp_start can't be used
+	bool query;
+};
+
+SLURP_API void slurp_options_init(struct slurp_options *options);
+
+/**
+ * Bind the globals slurp needs on display. Errors are printed to stderr and
+ * NULL is returned. In query mode, outputs can be looked up on return.
+ */
+SLURP_API struct slurp_state *slurp_create(struct wl_display *display,
+	const struct slurp_options *options);
+/**
+ * Destroy the overlay if needed, and all objects created by slurp. The
+ * display is left connected.
+ */
+SLURP_API void slurp_destroy(struct slurp_state *state);
+
+/**
+ * Add predefined boxes. Boxes and their labels are copied. Boxes can be
+ * changed while the selection is running.
+ */
+SLURP_API bool slurp_add_boxes(struct slurp_state *state,
+	const struct slurp_box *boxes, size_t len);
+/**
+ * Remove the first predefined box with the geometry of box, and its label if
+ * box has one. Returns false if there is no such box.
+ */
+SLURP_API bool slurp_remove_box(struct slurp_state *state,
+	const struct slurp_box *box);
+SLURP_API void slurp_clear_boxes(struct slurp_state *state);
+/**
+ * Make the following slurp_add_boxes, slurp_remove_box and slurp_clear_boxes
+ * calls apply to the layer called name, created if needed. NULL is the
+ * default layer, which also contains the outputs if output_boxes is set.
+ *
+ * Only the boxes of the active layer are displayed and selectable. The user
+ * cycles through the layers with Tab, starting with the default layer if it
+ * has been used and in order of creation otherwise.
+ */
+SLURP_API bool slurp_set_layer(struct slurp_state *state, const char *name);
+
+/**
+ * Display the overlay and start the selection.
+ */
+SLURP_API bool slurp_start(struct slurp_state *state);
+SLURP_API bool slurp_is_running(struct slurp_state *state);
+SLURP_API void slurp_cancel(struct slurp_state *state);
+/**
+ * Destroy the overlay and wait for the compositor to unmap it, e.g. before
+ * capturing the screen.
+ */
+SLURP_API void slurp_unmap(struct slurp_state *state);
+
+/**
+ * Dispatch the events read for slurp's objects. Must be called after reading
+ * the display, and before waiting for it again once the caller is prepared
+ * to read it (wl_display_prepare_read), so that no events are left behind.
+ * Returns -1 if the connection failed.
+ */
+SLURP_API int slurp_dispatch_pending(struct slurp_state *state);
+
+/**
+ * Returns a file descriptor which becomes readable when the input thread has
+ * events, or -1 without input_thread. slurp_dispatch_input must then be
+ * called. The display must be read with wl_display_prepare_read and
+ * wl_display_read_events (or wl_display_dispatch), which lets both threads
+ * read it.
+ */
+SLURP_API int slurp_get_input_fd(struct slurp_state *state);
+/**
+ * Apply the events read by the input thread. Consecutive motion events are
+ * merged.
+ */
+SLURP_API void slurp_dispatch_input(struct slurp_state *state);
+
+typedef void (*slurp_selection_func)(const struct slurp_box *selection,
+	void *data);
+
+/**
+ * Call func when the selection changes while the user is dragging, at most
+ * once per presented frame. Intermediate changes are dropped.
+ */
+SLURP_API void slurp_set_selection_handler(struct slurp_state *state,
+	slurp_selection_func func, void *data);
+
+/**
+ * Returns true if the selection was stopped by an error, which was printed
+ * to stderr.
+ */
+SLURP_API bool slurp_has_failed(struct slurp_state *state);
+/**
+ * Returns the selected box, or NULL if the selection was cancelled or
+ * failed. The box is owned by state.
+ */
+SLURP_API const struct slurp_box *slurp_get_result(struct slurp_state *state);
+/**
+ * Returns the logical geometry of the output containing the top left corner
+ * of box, labelled with the output name, or NULL if there is none.
+ */
+SLURP_API const struct slurp_box *slurp_find_output(struct slurp_state *state,
+	const struct slurp_box *box);
+/**
+ * Returns the logical geometry of the nth output, or NULL past the last one.
+ */
+SLURP_API const struct slurp_box *slurp_get_output(struct slurp_state *state,
+	size_t index);
+
+/**
+ * Print box according to format, see slurp(1). output is the box returned by
+ * slurp_find_output, or NULL if unknown.
+ */
+SLURP_API void slurp_print_box(FILE *stream, const struct slurp_box *box,
+	const struct slurp_box *output, const char *format);
+
+enum slurp_format_style {
+	SLURP_FORMAT_TEXT, // the format string
+	SLURP_FORMAT_NUL, // the format string, followed by a NUL byte
+	SLURP_FORMAT_JSON, // a JSON object per line, the format string is unused
+};
+
+/**
+ * A format string compiled once, to print many boxes. Records are appended
+ * to a buffer which is written at once.
+ */
+struct slurp_format;
+
+SLURP_API struct slurp_format *slurp_format_compile(const char *format,
+	enum slurp_format_style style);
+SLURP_API void slurp_format_destroy(struct slurp_format *format);
+/**
+ * Returns true if output can't be NULL in slurp_format_append, because the
+ * format uses output-relative coordinates.
+ */
+SLURP_API bool slurp_format_needs_output(const struct slurp_format *format);
+/**
+ * Append a record for box. output is the box returned by slurp_find_output,
+ * or NULL if unknown.
+ */
+SLURP_API void slurp_format_append(struct slurp_format *format,
+	const struct slurp_box *box, const struct slurp_box *output);
+/**
+ * Append the record of the final selection of a stream. JSON records get a
+ * "final":true member, the other styles are unchanged.
+ */
+SLURP_API void slurp_format_append_final(struct slurp_format *format,
+	const struct slurp_box *box, const struct slurp_box *output);
+/**
+ * Returns the records appended since the last reset or flush.
+ */
+SLURP_API const char *slurp_format_data(const struct slurp_format *format,
+	size_t *len);
+SLURP_API void slurp_format_reset(struct slurp_format *format);
+/**
+ * Write the records to fd and reset. Returns false on error.
+ */
+SLURP_API bool slurp_format_flush(struct slurp_format *format, int fd);
+
+/**
+ * Counters of a run, to compare machines and compositors.
+ */
+struct slurp_stats {
+	uint64_t motion_events; // pointer, touch and tablet
+	uint64_t coalesced_motion_events; // merged without being applied
+	uint64_t shm_allocated; // bytes of buffers and captures, in total
+	uint64_t shm_mapped; // bytes of buffers and captures, currently
+	uint64_t buffer_resizes; // buffers re-created with another size
+};
+
+struct slurp_output_stats {
+	uint64_t frames; // rendered
+	uint64_t dropped_frames; // skipped because no buffer was free
+	double render_min, render_max, render_total; // in milliseconds
+};
+
+SLURP_API void slurp_get_stats(struct slurp_state *state,
+	struct slurp_stats *stats);
+/**
+ * Store the counters of the nth output, in the order of slurp_get_output.
+ * Returns false past the last output.
+ */
+SLURP_API bool slurp_get_output_stats(struct slurp_state *state,
+	size_t index, struct slurp_output_stats *stats);
+
+/**
+ * Store the number of frames rendered at each quality level, over all
+ * outputs, into frames.
+ */
+SLURP_API void slurp_get_quality_frames(struct slurp_state *state,
+	uint64_t frames[static SLURP_QUALITY_LEVELS]);
+
+/**
+ * Capture the selected region and save it to path as PNG, or PPM if path ends
+ * with ".ppm". If path is "-", PNG is written to stdout. The overlay is
+ * unmapped first.
+ */
+SLURP_API bool slurp_save_result_image(struct slurp_state *state,
+	const char *path);
+
+/**
+ * Offer data as text on the clipboard of the seat which made the selection,
+ * then unmap the overlay and free the buffers it used. The display must be
+ * dispatched while slurp_is_offering returns true to answer paste requests.
+ * SIGPIPE should be ignored, a client may close its end early.
+ */
+SLURP_API bool slurp_offer_clipboard(struct slurp_state *state,
+	const char *data, size_t len);
+
+/**
+ * Returns false once another client has set the clipboard.
+ */
+SLURP_API bool slurp_is_offering(struct slurp_state *state);
+
+#endif
@@ -1,6 +1,23 @@
 #ifndef _LOCK_H
 #define _LOCK_H
 
-bool acquire_lock();
+#include <stdbool.h>
+
+// Maximum path length for files in the runtime directory
+#define MAX_PATH_SIZE 512
+
+/**
+ * Calculate the path of the per-display file with the given extension in the
+ * runtime directory and store it in path.
+ *
+ * Return false if no path could be determined.
+ */
+bool get_runtime_file_path(char path[MAX_PATH_SIZE], const char *extension);
+
+/**
+ * Lock the per-display lock file. Return the file descriptor holding the
+ * lock, which is released when it is closed, or -1 on failure.
+ */
+int acquire_lock();
 
 #endif
@@ -0,0 +1,18 @@
+#ifndef _MAGNIFIER_H
+#define _MAGNIFIER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct slurp_output;
+
+bool magnifier_init_output(struct slurp_output *output);
+void magnifier_finish_output(struct slurp_output *output);
+/**
+ * Center the lens of output on the given position, in global logical
+ * coordinates.
+ */
+void magnifier_move(struct slurp_output *output, int32_t x, int32_t y);
+void magnifier_hide(struct slurp_output *output);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _OUTPUT_INDEX_H
+#define _OUTPUT_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#define OUTPUT_INDEX_MAX 64
+
+struct slurp_box;
+struct slurp_output;
+
+/**
+ * Output edges along one axis. Sets of outputs are bitmasks of indices into
+ * output_index::outputs.
+ */
+struct output_index_axis {
+	int32_t starts[OUTPUT_INDEX_MAX]; // sorted
+	int32_t ends[OUTPUT_INDEX_MAX]; // sorted, exclusive
+	// Outputs with one of the first i starts
+	uint64_t starts_before[OUTPUT_INDEX_MAX + 1];
+	// Outputs with one of the ends from i on
+	uint64_t ends_from[OUTPUT_INDEX_MAX + 1];
+};
+
+/**
+ * Logical geometries of the outputs, to find the outputs intersecting a box
+ * in O(log n) instead of testing each of them.
+ */
+struct output_index {
+	struct slurp_output *outputs[OUTPUT_INDEX_MAX];
+	size_t len;
+	bool valid; // false if there are too many outputs to index
+	struct output_index_axis x, y;
+};
+
+void output_index_build(struct output_index *index, struct wl_list *outputs);
+
+/**
+ * Return the set of outputs intersecting box, the index must be valid.
+ */
+uint64_t output_index_query(const struct output_index *index,
+	const struct slurp_box *box);
+
+#endif
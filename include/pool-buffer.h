@@ -4,20 +4,46 @@
 #include <cairo/cairo.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <wayland-client.h>
 
+/**
+ * Shared memory used by buffers and captures.
+ */
+struct shm_stats {
+	uint64_t allocated; // in bytes, since the start
+	uint64_t mapped; // in bytes, currently
+	uint64_t resizes; // buffers re-created because the size changed
+};
+
 struct pool_buffer {
+	struct shm_stats *stats;
 	struct wl_buffer *buffer;
 	cairo_surface_t *surface;
 	cairo_t *cairo;
 	uint32_t width, height;
+	uint32_t format; // enum wl_shm_format
 	void *data;
 	size_t size;
 	bool busy;
 };
 
+/**
+ * format is one of ARGB8888, XRGB8888 and RGB565, which cairo can draw to.
+ */
 struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-	struct pool_buffer pool[static 2], uint32_t width, uint32_t height);
+	struct shm_stats *stats, struct pool_buffer pool[static 2],
+	uint32_t width, uint32_t height, uint32_t format);
 void finish_buffer(struct pool_buffer *buffer);
+int create_shm_file(off_t size);
+
+static inline void shm_stats_map(struct shm_stats *stats, size_t size) {
+	stats->allocated += size;
+	stats->mapped += size;
+}
+
+static inline void shm_stats_unmap(struct shm_stats *stats, size_t size) {
+	stats->mapped -= size;
+}
 
 #endif
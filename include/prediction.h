@@ -0,0 +1,41 @@
+#ifndef _PREDICTION_H
+#define _PREDICTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Motion of a dragged selection corner, used to extrapolate it to the time
+ * the next frame is presented.
+ */
+struct slurp_motion {
+	bool active; // while dragging
+	bool has_time, has_velocity;
+	uint32_t time; // of the last motion event, in ms
+	double received; // when the last motion event was handled, in ms
+	int32_t x, y;
+	double velocity_x, velocity_y; // logical pixels per ms
+
+	// Corner drawn by the last frame, without and with prediction
+	bool drawn;
+	int32_t drawn_x, drawn_y;
+	int32_t predicted_x, predicted_y;
+};
+
+double motion_now(void);
+void motion_start(struct slurp_motion *motion);
+void motion_stop(struct slurp_motion *motion);
+/**
+ * Record a motion event. When tracing, this reports how far the last frame
+ * drawn was from the new position with and without prediction.
+ */
+void motion_record(struct slurp_motion *motion, int32_t x, int32_t y,
+	uint32_t time);
+/**
+ * Extrapolate x and y to the presentation of a frame drawn now. Returns false
+ * if the motion can't be predicted, e.g. because the pointer stopped.
+ */
+bool motion_predict(const struct slurp_motion *motion, double now,
+	double frame_period, int32_t *x, int32_t *y);
+
+#endif
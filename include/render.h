@@ -1,8 +1,23 @@
 #ifndef _RENDER_H
 #define _RENDER_H
 
+struct slurp_box;
+struct slurp_box_layer;
 struct slurp_output;
 
 void render(struct slurp_output *output);
 
+/**
+ * Destroy the choice box rasters of layer for output, or for all outputs if
+ * output is NULL.
+ */
+void destroy_choice_rasters(struct slurp_box_layer *layer,
+	struct slurp_output *output);
+/**
+ * Repaint the area of box in the choice box rasters of layer, after box was
+ * added to or removed from its boxes and its hit index.
+ */
+void update_choice_rasters(struct slurp_box_layer *layer,
+	const struct slurp_box *box);
+
 #endif
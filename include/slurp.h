@@ -6,9 +6,21 @@
 #include <wayland-client.h>
 
 #include "box.h"
+#include "libslurp.h"
+#include "capture.h"
+#include "content-edges.h"
+#include "edge-index.h"
+#include "hit-index.h"
+#include "input-thread.h"
+#include "label-index.h"
+#include "output-index.h"
+#include "prediction.h"
 #include "cursor-shape-v1-client-protocol.h"
 #include "pool-buffer.h"
+#include "tablet-unstable-v2-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
 #include "xdg-output-unstable-v1-client-protocol.h"
 
 #define TOUCH_ID_EMPTY -1
@@ -19,24 +31,102 @@ struct slurp_selection {
   int32_t anchor_x, anchor_y;
   struct slurp_box selection;
   bool has_selection;
+
+  struct slurp_motion motion;
+  struct slurp_box predicted; // drawn instead of selection while dragging
+  bool has_prediction;
+  double predicted_at; // motion_now() when predicted was computed
+};
+
+/**
+ * Choice boxes of a layer drawn for an output, kept as a mask until the boxes
+ * or the output change.
+ */
+struct choice_raster {
+  struct slurp_output *output;
+  struct wl_list link; // slurp_box_layer::rasters
+  cairo_surface_t *mask; // NULL if no box intersects the output
+  struct slurp_box geometry; // of the output when drawn
+  int32_t scale;
+};
+
+/**
+ * A named set of predefined boxes, with its own indices. Only the active
+ * layer is displayed and selectable.
+ */
+struct slurp_box_layer {
+  char *name; // NULL for the default layer
+  struct wl_list link; // slurp_state::layers
+  struct wl_list boxes; // slurp_box::link
+  struct edge_index edge_index;
+  struct hit_index hit_index;
+  struct label_index label_index;
+  struct wl_list rasters; // choice_raster::link
+};
+
+#define FILTER_QUERY_MAX 256
+
+/**
+ * Boxes of the active layer whose label contains the typed query. The ids
+ * are those of the layer's label index.
+ */
+struct box_filter {
+  char query[FILTER_QUERY_MAX];
+  size_t query_len;
+  struct slurp_box_layer *layer; // the matches are for
+  bool active; // query isn't empty
+  uint32_t *matches; // ascending
+  size_t matches_len;
+  uint8_t *matched; // by id
+  size_t matched_len; // ids covered by matched, the index may have grown
+  struct slurp_box *best; // selected by Enter, NULL if nothing matches
+};
+
+/**
+ * A cursor theme loaded for a scale, shared by the outputs with this scale.
+ */
+struct slurp_cursor_theme {
+  int32_t scale;
+  struct wl_cursor_theme *theme; // NULL if it failed to load
+  struct wl_cursor_image *image;
+  struct wl_list link; // slurp_state::cursor_themes
 };
 
 struct slurp_state {
   bool running;
+  bool failed; // stopped by an error
+  bool unmapped; // no overlay is mapped
+  bool query; // only bind what is needed to resolve outputs
   bool edit_anchor;
 
   struct wl_display *display;
+  // Our objects are on their own queue, never dispatching the caller's events
+  struct wl_event_queue *queue;
+  struct wl_display *display_wrapper; // creates objects on queue
   struct wl_registry *registry;
   struct wl_shm *shm;
+  bool shm_rgb565; // advertised by the compositor
   struct wl_compositor *compositor;
   struct zwlr_layer_shell_v1 *layer_shell;
   struct zxdg_output_manager_v1 *xdg_output_manager;
   struct wp_cursor_shape_manager_v1 *cursor_shape_manager;
+  struct zwlr_screencopy_manager_v1 *screencopy_manager;
+  struct zwp_tablet_manager_v2 *tablet_manager;
+  struct wl_subcompositor *subcompositor;
+  struct wp_viewporter *viewporter;
+  struct wl_data_device_manager *data_device_manager;
   struct wl_list outputs; // slurp_output::link
+  struct output_index output_index;
   struct wl_list seats;   // slurp_seat::link
+  struct slurp_seat *input_seat; // of the last button, key or touch
 
   struct xkb_context *xkb_context;
 
+  // Without cursor-shape, themes are loaded on the first enter of each scale
+  const char *cursor_theme_name;
+  int cursor_size;
+  struct wl_list cursor_themes; // slurp_cursor_theme::link
+
   struct {
     uint32_t background;
     uint32_t border;
@@ -51,12 +141,53 @@ struct slurp_state {
   bool single_point;
   bool restrict_selection;
   bool crosshairs;
+  uint32_t magnifier_zoom; // 0 if the magnifier is disabled
+  bool frozen; // use output captures as the background
+  bool low_memory; // 16-bit buffers when the overlay is opaque
   bool resizing_selection;
-  struct wl_list boxes; // slurp_box::link
+  struct wl_list layers; // slurp_box_layer::link, default layer first
+  struct slurp_box_layer *layer; // active, NULL until slurp_start
+  struct slurp_box_layer *edit_layer; // changed by slurp_add_boxes & co
+  bool output_boxes;
+  bool filter_labels; // typing filters the boxes by label
+  struct box_filter filter;
+  uint32_t snap_threshold;
+  bool content_snap; // snap to the visual edges of the outputs
   bool fixed_aspect_ratio;
   double aspect_ratio; // h / w
+  bool predict; // extrapolate the selection while dragging
+  double frame_budget; // in ms, 0 if the quality is never lowered
+  uint64_t quality_frames[SLURP_QUALITY_LEVELS];
+  struct shm_stats shm_stats;
+  uint64_t motion_events, coalesced_motion_events;
 
   struct slurp_box result;
+
+  // Pointers, keyboards and touchscreens are read on the input thread
+  bool input_threaded;
+  struct input_thread input;
+
+  // Clipboard served once the overlay is gone
+  struct wl_data_device *data_device;
+  struct wl_data_source *data_source; // NULL once replaced by another client
+  char *clipboard;
+  size_t clipboard_len;
+
+  slurp_selection_func selection_func;
+  void *selection_data;
+  bool selection_changed; // since the last presented frame
+  struct slurp_box changed_selection;
+};
+
+struct slurp_lens {
+  struct wl_surface *surface;
+  struct wl_subsurface *subsurface;
+  struct wl_callback *frame_callback;
+  struct pool_buffer buffers[2];
+  int32_t x, y; // center, in global logical coordinates
+  bool dirty, mapped;
+  int32_t *columns; // source column of each lens buffer column
+  int32_t columns_len;
 };
 
 struct slurp_output {
@@ -67,6 +198,8 @@ struct slurp_output {
   struct slurp_box geometry;
   struct slurp_box logical_geometry;
   int32_t scale;
+  int32_t refresh; // in mHz, 0 if unknown
+  int32_t transform; // enum wl_output_transform
 
   struct wl_surface *surface;
   struct zwlr_layer_surface_v1 *layer_surface;
@@ -77,18 +210,27 @@ struct slurp_output {
   bool configured;
   bool dirty;
   int32_t width, height;
+  struct wp_viewport *viewport; // NULL if the scale can't be reduced
+  enum slurp_quality quality; // of the next frame
+  double render_scale; // buffer pixels per logical pixel, of the last frame
   struct pool_buffer buffers[2];
   struct pool_buffer *current_buffer;
+  bool opaque; // the opaque region covers the surface
+  struct slurp_output_stats stats;
 
-  struct wl_cursor_theme *cursor_theme;
-  struct wl_cursor_image *cursor_image;
+  struct capture capture;
+  struct content_edges content_edges;
+  struct slurp_lens lens;
 };
 
 struct slurp_seat {
   struct wl_surface *cursor_surface;
+  // Attached to cursor_surface, which is left as is when it doesn't change
+  struct slurp_cursor_theme *cursor;
   struct slurp_state *state;
   struct wl_seat *wl_seat;
   struct wl_list link; // slurp_state::seats
+  uint32_t serial; // of the last button, key or touch
 
   // keyboard:
   struct wl_keyboard *wl_keyboard;
@@ -109,13 +251,41 @@ struct slurp_seat {
   // touch:
   struct wl_touch *wl_touch;
   int32_t touch_id;
+
+  // tablet:
+  struct zwp_tablet_seat_v2 *tablet_seat;
+  struct wl_list tablet_tools; // slurp_tablet_tool::link
+  // of the last tool which came in proximity, NULL once it left
+  struct slurp_selection *tablet_selection;
 };
 
-bool box_intersect(const struct slurp_box *a, const struct slurp_box *b);
+struct slurp_tablet_tool {
+  struct slurp_seat *seat;
+  struct zwp_tablet_tool_v2 *tool;
+  struct wl_list link; // slurp_seat::tablet_tools
+  struct wl_surface *cursor_surface;
+  struct slurp_cursor_theme *cursor; // attached to cursor_surface
+  struct slurp_selection selection;
+  bool down;
+
+  // Events accumulated until the next frame event
+  struct {
+    bool proximity_in, proximity_out;
+    uint32_t proximity_serial;
+    struct slurp_output *output;
+    bool motion;
+    wl_fixed_t x, y;
+    bool down, up;
+    bool cancel;
+  } pending;
+};
 
 static inline struct slurp_selection *
 slurp_seat_current_selection(struct slurp_seat *seat) {
-  return seat->touch_selection.has_selection ? &seat->touch_selection
-                                             : &seat->pointer_selection;
+  if (seat->touch_selection.has_selection) {
+    return &seat->touch_selection;
+  }
+  return seat->tablet_selection != NULL ? seat->tablet_selection
+                                        : &seat->pointer_selection;
 }
 #endif
@@ -0,0 +1,21 @@
+#ifndef _SWAY_IPC_H
+#define _SWAY_IPC_H
+
+#include <stdbool.h>
+
+struct slurp_box;
+
+typedef void (*sway_ipc_window_func_t)(const struct slurp_box *box, void *data);
+
+/**
+ * Query the window tree over the sway/i3 IPC socket given by SWAYSOCK or
+ * I3SOCK, and call func for each visible window. The box label is the window
+ * title. If borders is false, the box only covers the window content.
+ *
+ * Only GET_TREE is sent, so the socket may be a stand-in replaying a recorded
+ * reply, which is how this is checked without a compositor.
+ */
+bool sway_ipc_get_windows(bool borders, sway_ipc_window_func_t func,
+	void *data);
+
+#endif
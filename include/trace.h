@@ -0,0 +1,35 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdio.h>
+
+/**
+ * Chrome trace event format output, enabled by setting SLURP_TRACE to a file
+ * path. The file can be loaded in Perfetto or chrome://tracing.
+ */
+extern FILE *trace_file;
+
+void trace_write_event(const char *name, char phase);
+void trace_write_counter(const char *name, double value);
+
+// When tracing is disabled, each of these costs a single branch
+
+static inline void trace_begin(const char *name) {
+	if (trace_file != NULL) {
+		trace_write_event(name, 'B');
+	}
+}
+
+static inline void trace_end(const char *name) {
+	if (trace_file != NULL) {
+		trace_write_event(name, 'E');
+	}
+}
+
+static inline void trace_counter(const char *name, double value) {
+	if (trace_file != NULL) {
+		trace_write_counter(name, value);
+	}
+}
+
+#endif
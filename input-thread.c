@@ -0,0 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "input-thread.h"
+#include "trace.h"
+
+static void signal_fd(int fd) {
+	uint64_t one = 1;
+	while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+		// Retry
+	}
+}
+
+static void *input_thread_run(void *data) {
+	struct input_thread *input = data;
+	struct wl_display *display = input->display;
+	struct pollfd fds[] = {
+		{ .fd = wl_display_get_fd(display), .events = POLLIN },
+		{ .fd = input->stop_fd, .events = POLLIN },
+	};
+
+	while (true) {
+		while (wl_display_prepare_read_queue(display, input->queue) != 0) {
+			if (wl_display_dispatch_queue_pending(display, input->queue) < 0) {
+				return NULL;
+			}
+		}
+
+		// Requests are flushed by the main thread
+		if (poll(fds, 2, -1) < 0) {
+			wl_display_cancel_read(display);
+			if (errno == EINTR) {
+				continue;
+			}
+			return NULL;
+		}
+		if (fds[1].revents & POLLIN) {
+			wl_display_cancel_read(display);
+			return NULL;
+		}
+
+		if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+			if (wl_display_read_events(display) < 0) {
+				return NULL;
+			}
+		} else {
+			wl_display_cancel_read(display);
+		}
+		trace_begin("input_dispatch");
+		int ret = wl_display_dispatch_queue_pending(display, input->queue);
+		trace_end("input_dispatch");
+		if (ret < 0) {
+			return NULL;
+		}
+	}
+}
+
+bool input_thread_init(struct input_thread *input, struct wl_display *display) {
+	memset(input, 0, sizeof(*input));
+	input->display = display;
+	input->stop_fd = input->wake_fd = -1;
+	input->queue = wl_display_create_queue(display);
+	if (input->queue == NULL) {
+		fprintf(stderr, "failed to create input event queue\n");
+		return false;
+	}
+	input->stop_fd = eventfd(0, EFD_CLOEXEC);
+	input->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (input->stop_fd < 0 || input->wake_fd < 0) {
+		perror("eventfd");
+		return false;
+	}
+	return true;
+}
+
+bool input_thread_start(struct input_thread *input) {
+	// Signals are the application's business, e.g. main.c reads them from a
+	// signalfd: the thread inherits a mask blocking all of them, so that the
+	// kernel never picks it to handle one
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int ret = pthread_create(&input->thread, NULL, input_thread_run, input);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		fprintf(stderr, "failed to start input thread: %s\n", strerror(ret));
+		return false;
+	}
+	input->running = true;
+	return true;
+}
+
+void input_thread_stop(struct input_thread *input) {
+	if (input->running) {
+		signal_fd(input->stop_fd);
+		pthread_join(input->thread, NULL);
+		input->running = false;
+	}
+}
+
+void input_thread_finish(struct input_thread *input) {
+	input_thread_stop(input);
+	input_thread_drop(input);
+	if (input->queue != NULL) {
+		wl_event_queue_destroy(input->queue);
+		input->queue = NULL;
+	}
+	if (input->stop_fd >= 0) {
+		close(input->stop_fd);
+	}
+	if (input->wake_fd >= 0) {
+		close(input->wake_fd);
+	}
+	input->stop_fd = input->wake_fd = -1;
+}
+
+void input_thread_push(struct input_thread *input,
+		const struct input_event *event) {
+	struct input_ring *ring = &input->ring;
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) ==
+			INPUT_RING_SIZE) {
+		// The main thread is stalled: wait rather than drop events, unless
+		// it is stopping the thread
+		struct pollfd stop = { .fd = input->stop_fd, .events = POLLIN };
+		trace_begin("input_ring_full");
+		int ret = poll(&stop, 1, 1);
+		trace_end("input_ring_full");
+		if (ret > 0) {
+			if (event->type == INPUT_KEYBOARD_KEYMAP) {
+				close((int)event->args[1]);
+			}
+			return;
+		}
+	}
+	ring->events[tail & (INPUT_RING_SIZE - 1)] = *event;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	// One wakeup until the main thread starts popping again
+	if (!atomic_exchange(&input->wake_pending, true)) {
+		signal_fd(input->wake_fd);
+	}
+}
+
+void input_thread_clear_wake(struct input_thread *input) {
+	atomic_store(&input->wake_pending, false);
+	uint64_t count;
+	while (read(input->wake_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+		// Retry
+	}
+}
+
+void input_thread_drop(struct input_thread *input) {
+	const struct input_event *event;
+	while ((event = input_thread_peek(input)) != NULL) {
+		// Keymaps not consumed yet
+		if (event->type == INPUT_KEYBOARD_KEYMAP) {
+			close((int)event->args[1]);
+		}
+		input_thread_pop(input);
+	}
+}
+
+void input_thread_forget_surface(struct input_thread *input,
+		const struct wl_surface *surface) {
+	struct input_ring *ring = &input->ring;
+	// Events up to tail belong to the main thread until they are popped
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	for (size_t i = head; i != tail; i++) {
+		struct input_event *event = &ring->events[i & (INPUT_RING_SIZE - 1)];
+		if (event->surface == surface) {
+			event->surface = NULL;
+		}
+	}
+}
+
+const struct input_event *input_thread_peek(struct input_thread *input) {
+	struct input_ring *ring = &input->ring;
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+		return NULL;
+	}
+	return &ring->events[head & (INPUT_RING_SIZE - 1)];
+}
+
+void input_thread_pop(struct input_thread *input) {
+	struct input_ring *ring = &input->ring;
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
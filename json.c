@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+void json_parser_init(struct json_parser *parser, const char *data, size_t len) {
+	memset(parser, 0, sizeof(struct json_parser));
+	parser->data = data;
+	parser->len = len;
+}
+
+void json_parser_finish(struct json_parser *parser) {
+	free(parser->str);
+	memset(parser, 0, sizeof(struct json_parser));
+}
+
+static bool str_push(struct json_parser *parser, const char *bytes, size_t len) {
+	if (parser->str_len + len + 1 > parser->str_cap) {
+		size_t cap = parser->str_cap ? parser->str_cap : 64;
+		while (cap < parser->str_len + len + 1) {
+			cap *= 2;
+		}
+		char *str = realloc(parser->str, cap);
+		if (str == NULL) {
+			return false;
+		}
+		parser->str = str;
+		parser->str_cap = cap;
+	}
+	memcpy(parser->str + parser->str_len, bytes, len);
+	parser->str_len += len;
+	parser->str[parser->str_len] = '\0';
+	return true;
+}
+
+static void skip_whitespace(struct json_parser *parser) {
+	while (parser->pos < parser->len) {
+		char c = parser->data[parser->pos];
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			break;
+		}
+		parser->pos++;
+	}
+}
+
+static int parse_hex4(struct json_parser *parser, uint32_t *out) {
+	if (parser->len - parser->pos < 4) {
+		return -1;
+	}
+	uint32_t value = 0;
+	for (size_t i = 0; i < 4; i++) {
+		char c = parser->data[parser->pos++];
+		value <<= 4;
+		if (c >= '0' && c <= '9') {
+			value |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			value |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			value |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+	*out = value;
+	return 0;
+}
+
+static bool push_utf8(struct json_parser *parser, uint32_t cp) {
+	char buf[4];
+	size_t len;
+	if (cp < 0x80) {
+		buf[0] = cp;
+		len = 1;
+	} else if (cp < 0x800) {
+		buf[0] = 0xC0 | (cp >> 6);
+		buf[1] = 0x80 | (cp & 0x3F);
+		len = 2;
+	} else if (cp < 0x10000) {
+		buf[0] = 0xE0 | (cp >> 12);
+		buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+		buf[2] = 0x80 | (cp & 0x3F);
+		len = 3;
+	} else {
+		buf[0] = 0xF0 | (cp >> 18);
+		buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+		buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+		buf[3] = 0x80 | (cp & 0x3F);
+		len = 4;
+	}
+	return str_push(parser, buf, len);
+}
+
+static bool parse_string(struct json_parser *parser) {
+	parser->pos++; // opening quote
+	parser->str_len = 0;
+	if (!str_push(parser, "", 0)) {
+		return false;
+	}
+
+	while (parser->pos < parser->len) {
+		// Copy runs of plain characters at once
+		size_t start = parser->pos;
+		while (parser->pos < parser->len) {
+			char c = parser->data[parser->pos];
+			if (c == '"' || c == '\\') {
+				break;
+			}
+			parser->pos++;
+		}
+		if (!str_push(parser, parser->data + start, parser->pos - start)) {
+			return false;
+		}
+		if (parser->pos == parser->len) {
+			return false;
+		}
+
+		char c = parser->data[parser->pos++];
+		if (c == '"') {
+			return true;
+		}
+		if (parser->pos == parser->len) {
+			return false;
+		}
+		char esc = parser->data[parser->pos++];
+		const char *unescaped = NULL;
+		switch (esc) {
+		case '"': unescaped = "\""; break;
+		case '\\': unescaped = "\\"; break;
+		case '/': unescaped = "/"; break;
+		case 'b': unescaped = "\b"; break;
+		case 'f': unescaped = "\f"; break;
+		case 'n': unescaped = "\n"; break;
+		case 'r': unescaped = "\r"; break;
+		case 't': unescaped = "\t"; break;
+		case 'u':;
+			uint32_t cp;
+			if (parse_hex4(parser, &cp) < 0) {
+				return false;
+			}
+			if (cp >= 0xD800 && cp < 0xDC00 && parser->len - parser->pos >= 6 &&
+					parser->data[parser->pos] == '\\' &&
+					parser->data[parser->pos + 1] == 'u') {
+				uint32_t low;
+				parser->pos += 2;
+				if (parse_hex4(parser, &low) < 0 ||
+						low < 0xDC00 || low >= 0xE000) {
+					return false;
+				}
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+			} else if (cp >= 0xD800 && cp < 0xE000) {
+				// Lone surrogates have no UTF-8 encoding
+				cp = 0xFFFD;
+			}
+			if (!push_utf8(parser, cp)) {
+				return false;
+			}
+			continue;
+		default:
+			return false;
+		}
+		if (!str_push(parser, unescaped, 1)) {
+			return false;
+		}
+	}
+	return false;
+}
+
+static bool parse_literal(struct json_parser *parser, const char *literal) {
+	size_t len = strlen(literal);
+	if (parser->len - parser->pos < len ||
+			memcmp(parser->data + parser->pos, literal, len) != 0) {
+		return false;
+	}
+	parser->pos += len;
+	return true;
+}
+
+static bool parse_number(struct json_parser *parser) {
+	// strtod needs a NUL-terminated string, copy the number out
+	size_t start = parser->pos;
+	while (parser->pos < parser->len &&
+			strchr("+-0123456789.eE", parser->data[parser->pos]) != NULL) {
+		parser->pos++;
+	}
+	char buf[64];
+	size_t len = parser->pos - start;
+	if (len == 0 || len >= sizeof(buf)) {
+		return false;
+	}
+	memcpy(buf, parser->data + start, len);
+	buf[len] = '\0';
+	char *end;
+	parser->number = strtod(buf, &end);
+	return *end == '\0';
+}
+
+static enum json_token push_container(struct json_parser *parser, bool object) {
+	if (parser->depth == JSON_MAX_DEPTH) {
+		return JSON_ERROR;
+	}
+	parser->in_object[parser->depth++] = object;
+	parser->expect_key = object;
+	parser->pos++;
+	return object ? JSON_OBJECT_START : JSON_ARRAY_START;
+}
+
+static enum json_token pop_container(struct json_parser *parser, bool object) {
+	if (parser->depth == 0 || parser->in_object[parser->depth - 1] != object) {
+		return JSON_ERROR;
+	}
+	parser->depth--;
+	parser->pos++;
+	return object ? JSON_OBJECT_END : JSON_ARRAY_END;
+}
+
+enum json_token json_next(struct json_parser *parser) {
+	skip_whitespace(parser);
+	if (parser->pos < parser->len &&
+			(parser->data[parser->pos] == ',' || parser->data[parser->pos] == ':')) {
+		// Separators carry no information once the container is known
+		if (parser->data[parser->pos] == ',' && parser->depth > 0) {
+			parser->expect_key = parser->in_object[parser->depth - 1];
+		}
+		parser->pos++;
+		skip_whitespace(parser);
+	}
+	if (parser->pos == parser->len) {
+		return parser->depth == 0 ? JSON_END : JSON_ERROR;
+	}
+
+	char c = parser->data[parser->pos];
+	switch (c) {
+	case '{':
+		return push_container(parser, true);
+	case '}':
+		return pop_container(parser, true);
+	case '[':
+		return push_container(parser, false);
+	case ']':
+		return pop_container(parser, false);
+	case '"':
+		if (!parse_string(parser)) {
+			return JSON_ERROR;
+		}
+		if (parser->expect_key) {
+			parser->expect_key = false;
+			return JSON_KEY;
+		}
+		return JSON_STRING;
+	case 't':
+		return parse_literal(parser, "true") ? JSON_TRUE : JSON_ERROR;
+	case 'f':
+		return parse_literal(parser, "false") ? JSON_FALSE : JSON_ERROR;
+	case 'n':
+		return parse_literal(parser, "null") ? JSON_NULL : JSON_ERROR;
+	default:
+		return parse_number(parser) ? JSON_NUMBER : JSON_ERROR;
+	}
+}
+
+bool json_skip(struct json_parser *parser, enum json_token token) {
+	if (token != JSON_OBJECT_START && token != JSON_ARRAY_START) {
+		return token != JSON_ERROR && token != JSON_END;
+	}
+	size_t depth = parser->depth - 1;
+	while (parser->depth > depth) {
+		enum json_token next = json_next(parser);
+		if (next == JSON_ERROR || next == JSON_END) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void json_escape_string(const char *str,
+		void (*emit)(const char *bytes, size_t len, void *data), void *data) {
+	if (str == NULL) {
+		emit("null", 4, data);
+		return;
+	}
+	static const char hex[] = "0123456789abcdef";
+	emit("\"", 1, data);
+	const char *run = str;
+	for (const char *c = str; ; c++) {
+		unsigned char ch = *c;
+		bool escaped = ch == '"' || ch == '\\' || ch < 0x20 || ch == 0x7F;
+		if (!escaped && ch != '\0') {
+			continue;
+		}
+		// Copy the bytes which don't need escaping at once
+		emit(run, c - run, data);
+		run = c + 1;
+		if (ch == '\0') {
+			break;
+		}
+		char seq[] = { '\\', ch, '0', '0', hex[ch >> 4], hex[ch & 0xF] };
+		size_t seq_len = 2;
+		switch (ch) {
+		case '\n':
+			seq[1] = 'n';
+			break;
+		case '\r':
+			seq[1] = 'r';
+			break;
+		case '\t':
+			seq[1] = 't';
+			break;
+		case '"':
+		case '\\':
+			break;
+		default:
+			seq[1] = 'u';
+			seq_len = sizeof(seq);
+		}
+		emit(seq, seq_len, data);
+	}
+	emit("\"", 1, data);
+}
+
+static void write_stream(const char *bytes, size_t len, void *data) {
+	fwrite(bytes, 1, len, data);
+}
+
+void json_write_string(FILE *stream, const char *str) {
+	json_escape_string(str, write_stream, stream);
+}
@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+
+#include "box.h"
+#include "label-index.h"
+
+#define LABEL_GRAM_MAX 3
+
+static char lower(char c) {
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static uint32_t gram_key(const char *s, size_t len) {
+	uint32_t key = len << 24;
+	for (size_t i = 0; i < len; i++) {
+		key |= (uint32_t)(uint8_t)s[i] << (16 - 8 * i);
+	}
+	return key;
+}
+
+static size_t gram_slot(const struct label_index *index, uint32_t key) {
+	size_t mask = index->grams_cap - 1;
+	size_t i = (key * UINT32_C(2654435761)) & mask;
+	while (index->grams[i].key != 0 && index->grams[i].key != key) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static bool grams_grow(struct label_index *index) {
+	size_t cap = index->grams_cap ? index->grams_cap * 2 : 1024;
+	struct label_gram *grams = calloc(cap, sizeof(struct label_gram));
+	if (grams == NULL) {
+		return false;
+	}
+	struct label_gram *old = index->grams;
+	size_t old_cap = index->grams_cap;
+	index->grams = grams;
+	index->grams_cap = cap;
+	for (size_t i = 0; i < old_cap; i++) {
+		if (old[i].key != 0) {
+			index->grams[gram_slot(index, old[i].key)] = old[i];
+		}
+	}
+	free(old);
+	return true;
+}
+
+static bool gram_add(struct label_index *index, uint32_t key, uint32_t id) {
+	// Keep the table at most half full
+	if (2 * (index->grams_len + 1) > index->grams_cap && !grams_grow(index)) {
+		return false;
+	}
+	struct label_gram *gram = &index->grams[gram_slot(index, key)];
+	if (gram->key == 0) {
+		gram->key = key;
+		index->grams_len++;
+	}
+	// Ids are added in ascending order, a label can repeat an n-gram
+	if (gram->len > 0 && gram->ids[gram->len - 1] == id) {
+		return true;
+	}
+	if (gram->len == gram->cap) {
+		size_t cap = gram->cap ? gram->cap * 2 : 4;
+		uint32_t *ids = realloc(gram->ids, cap * sizeof(uint32_t));
+		if (ids == NULL) {
+			return false;
+		}
+		gram->ids = ids;
+		gram->cap = cap;
+	}
+	gram->ids[gram->len++] = id;
+	return true;
+}
+
+void label_index_finish(struct label_index *index) {
+	for (size_t i = 0; i < index->grams_cap; i++) {
+		free(index->grams[i].ids);
+	}
+	free(index->grams);
+	for (size_t i = 0; i < index->len; i++) {
+		free(index->labels[i]);
+	}
+	free(index->labels);
+	free(index->boxes);
+	memset(index, 0, sizeof(struct label_index));
+}
+
+/**
+ * Give box the next id and index the n-grams of its label.
+ */
+static bool index_label(struct label_index *index, struct slurp_box *box) {
+	if (index->len == index->cap) {
+		size_t cap = index->cap ? index->cap * 2 : 64;
+		struct slurp_box **boxes =
+			realloc(index->boxes, cap * sizeof(struct slurp_box *));
+		if (boxes == NULL) {
+			return false;
+		}
+		index->boxes = boxes;
+		char **labels = realloc(index->labels, cap * sizeof(char *));
+		if (labels == NULL) {
+			return false;
+		}
+		index->labels = labels;
+		index->cap = cap;
+	}
+
+	char *label = strdup(box->label);
+	if (label == NULL) {
+		return false;
+	}
+	uint32_t id = index->len++;
+	index->boxes[id] = box;
+	index->labels[id] = label;
+	size_t label_len = strlen(label);
+	for (size_t i = 0; i < label_len; i++) {
+		label[i] = lower(label[i]);
+	}
+	for (size_t i = 0; i < label_len; i++) {
+		for (size_t n = 1; n <= LABEL_GRAM_MAX && i + n <= label_len; n++) {
+			if (!gram_add(index, gram_key(&label[i], n), id)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool label_index_build(struct label_index *index, struct wl_list *boxes) {
+	label_index_finish(index);
+
+	struct slurp_box *box;
+	wl_list_for_each(box, boxes, link) {
+		if (box->label != NULL && !index_label(index, box)) {
+			label_index_finish(index);
+			return false;
+		}
+	}
+
+	index->valid = true;
+	return true;
+}
+
+bool label_index_add(struct label_index *index, struct slurp_box *box) {
+	if (!index->valid || box->label == NULL) {
+		return true;
+	}
+	if (!index_label(index, box)) {
+		index->valid = false;
+		return false;
+	}
+	return true;
+}
+
+static const struct label_gram *gram_find(const struct label_index *index,
+		const char *s, size_t len) {
+	if (index->grams_cap == 0) {
+		return NULL;
+	}
+	const struct label_gram *gram = &index->grams[gram_slot(index,
+		gram_key(s, len))];
+	return gram->key != 0 ? gram : NULL;
+}
+
+size_t label_index_search(const struct label_index *index, const char *query,
+		uint32_t *matches) {
+	size_t query_len = strlen(query);
+	char *lowered = malloc(query_len + 1);
+	if (lowered == NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i <= query_len; i++) {
+		lowered[i] = lower(query[i]);
+	}
+
+	if (query_len == 0) {
+		size_t n = 0;
+		for (size_t id = 0; id < index->len; id++) {
+			if (index->labels[id] != NULL) {
+				matches[n++] = id;
+			}
+		}
+		free(lowered);
+		return n;
+	}
+
+	// Short queries are n-grams themselves. Otherwise, start from the
+	// n-gram of the query with the fewest labels and check each of them.
+	const struct label_gram *best = NULL;
+	size_t gram_len = query_len < LABEL_GRAM_MAX ? query_len : LABEL_GRAM_MAX;
+	for (size_t i = 0; i + gram_len <= query_len; i++) {
+		const struct label_gram *gram = gram_find(index, &lowered[i], gram_len);
+		if (gram == NULL) {
+			free(lowered);
+			return 0;
+		}
+		if (best == NULL || gram->len < best->len) {
+			best = gram;
+		}
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < best->len; i++) {
+		uint32_t id = best->ids[i];
+		if (query_len <= LABEL_GRAM_MAX ||
+				strstr(index->labels[id], lowered) != NULL) {
+			matches[n++] = id;
+		}
+	}
+	free(lowered);
+	return n;
+}
+
+bool label_index_has_prefix(const struct label_index *index, uint32_t id,
+		const char *prefix, size_t len) {
+	const unsigned char *label = (const unsigned char *)index->labels[id];
+	for (size_t i = 0; i < len; i++) {
+		// The terminator of a shorter label never equals a query byte
+		if (label[i] != (unsigned char)lower(prefix[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void gram_remove(struct label_index *index, uint32_t key, uint32_t id) {
+	struct label_gram *gram = &index->grams[gram_slot(index, key)];
+	size_t lo = 0, hi = gram->len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (gram->ids[mid] < id) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	// A label can repeat an n-gram, which is then already gone
+	if (lo < gram->len && gram->ids[lo] == id) {
+		memmove(&gram->ids[lo], &gram->ids[lo + 1],
+			(gram->len - lo - 1) * sizeof(uint32_t));
+		gram->len--;
+	}
+}
+
+void label_index_remove(struct label_index *index,
+		const struct slurp_box *box) {
+	if (!index->valid || box->label == NULL) {
+		return;
+	}
+
+	// Look for the id among the boxes sharing the rarest n-gram of the label
+	size_t label_len = strlen(box->label);
+	size_t gram_len = label_len < LABEL_GRAM_MAX ? label_len : LABEL_GRAM_MAX;
+	const struct label_gram *best = NULL;
+	for (size_t i = 0; gram_len > 0 && i + gram_len <= label_len; i++) {
+		char gram[LABEL_GRAM_MAX];
+		for (size_t j = 0; j < gram_len; j++) {
+			gram[j] = lower(box->label[i + j]);
+		}
+		const struct label_gram *found = gram_find(index, gram, gram_len);
+		if (found != NULL && (best == NULL || found->len < best->len)) {
+			best = found;
+		}
+	}
+	size_t id = index->len;
+	if (best != NULL) {
+		for (size_t i = 0; i < best->len; i++) {
+			if (index->boxes[best->ids[i]] == box) {
+				id = best->ids[i];
+				break;
+			}
+		}
+	} else {
+		// Empty labels have no n-grams
+		for (size_t i = 0; i < index->len; i++) {
+			if (index->boxes[i] == box) {
+				id = i;
+				break;
+			}
+		}
+	}
+	if (id == index->len) {
+		return;
+	}
+
+	const char *label = index->labels[id];
+	for (size_t i = 0; i < label_len; i++) {
+		for (size_t n = 1; n <= LABEL_GRAM_MAX && i + n <= label_len; n++) {
+			gram_remove(index, gram_key(&label[i], n), id);
+		}
+	}
+	free(index->labels[id]);
+	index->labels[id] = NULL;
+	index->boxes[id] = NULL;
+	index->removed++;
+	if (2 * index->removed > index->len) {
+		index->valid = false;
+	}
+}
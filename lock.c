@@ -3,19 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/file.h>
+#include <unistd.h>
 
 #include "lock.h"
 
-// Maximum path length for the lock file
-#define MAX_PATH_SIZE 512
-
-/**
- * Calculate the path to use for the lock file and store it in
- * path.
- *
- * Return false if no path could be determined.
- */
-bool get_lockfile_path(char path[MAX_PATH_SIZE]) {
+bool get_runtime_file_path(char path[MAX_PATH_SIZE], const char *extension) {
 	char *runtime_dir = getenv("XDG_RUNTIME_DIR");
 	if (!runtime_dir) {
 		// Use the /tmp directory if we couldn't get a normal runtime dir
@@ -27,30 +19,32 @@ bool get_lockfile_path(char path[MAX_PATH_SIZE]) {
 		return false;
 	}
 
-	if (snprintf(path, MAX_PATH_SIZE, "%s/slurp-%s.lock", runtime_dir, display) >= MAX_PATH_SIZE) {
-		fprintf(stderr, "lockfile path was too long\n");
+	if (snprintf(path, MAX_PATH_SIZE, "%s/slurp-%s.%s", runtime_dir, display,
+			extension) >= MAX_PATH_SIZE) {
+		fprintf(stderr, "%s file path was too long\n", extension);
 		return false;
 	}
 
 	return true;
 }
 
-bool acquire_lock() {
+int acquire_lock() {
 	char lockfile[MAX_PATH_SIZE];
-	if (!get_lockfile_path(lockfile)) {
-		return false;
+	if (!get_runtime_file_path(lockfile, "lock")) {
+		return -1;
 	}
 	// Open the lock file for write, creating with user read/write if necessary
 	int fd = open(lockfile, O_WRONLY|O_CREAT, 00600);
 	if (fd == -1) {
 		fprintf(stderr, "failed to open lock file\n");
-		return false;
+		return -1;
 	}
 	if (flock(fd, LOCK_EX|LOCK_NB)) {
 		fprintf(stderr, "another slurp process is running for this wayland session\n");
-		return false;
+		close(fd);
+		return -1;
 	}
-	return true;
+	return fd;
 }
 
 
@@ -0,0 +1,211 @@
+#include <cairo/cairo.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "magnifier.h"
+#include "pool-buffer.h"
+#include "slurp.h"
+
+// Size of the lens, in logical pixels
+#define LENS_SIZE 160
+// Distance between the cursor and the lens, in logical pixels
+#define LENS_OFFSET 24
+
+static void render_lens(struct slurp_output *output);
+
+static void lens_frame_handle_done(void *data, struct wl_callback *callback,
+		uint32_t time) {
+	struct slurp_output *output = data;
+
+	wl_callback_destroy(callback);
+	output->lens.frame_callback = NULL;
+
+	if (output->lens.dirty) {
+		render_lens(output);
+	}
+}
+
+static const struct wl_callback_listener lens_frame_listener = {
+	.done = lens_frame_handle_done,
+};
+
+bool magnifier_init_output(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	struct slurp_lens *lens = &output->lens;
+
+	lens->surface = wl_compositor_create_surface(state->compositor);
+	lens->subsurface = wl_subcompositor_get_subsurface(state->subcompositor,
+		lens->surface, output->surface);
+	// Lens updates must not wait for a commit of the whole overlay
+	wl_subsurface_set_desync(lens->subsurface);
+
+	// Let input go through to the overlay surface
+	struct wl_region *region = wl_compositor_create_region(state->compositor);
+	wl_surface_set_input_region(lens->surface, region);
+	wl_region_destroy(region);
+	return true;
+}
+
+void magnifier_finish_output(struct slurp_output *output) {
+	struct slurp_lens *lens = &output->lens;
+	if (lens->surface == NULL) {
+		return;
+	}
+	finish_buffer(&lens->buffers[0]);
+	finish_buffer(&lens->buffers[1]);
+	if (lens->frame_callback) {
+		wl_callback_destroy(lens->frame_callback);
+	}
+	wl_subsurface_destroy(lens->subsurface);
+	wl_surface_destroy(lens->surface);
+	free(lens->columns);
+	memset(lens, 0, sizeof(struct slurp_lens));
+}
+
+void magnifier_move(struct slurp_output *output, int32_t x, int32_t y) {
+	struct slurp_lens *lens = &output->lens;
+	if (lens->surface == NULL || output->capture.data == NULL ||
+			!output->configured) {
+		return;
+	}
+	lens->x = x;
+	lens->y = y;
+	lens->dirty = true;
+	if (lens->frame_callback == NULL) {
+		render_lens(output);
+	}
+}
+
+void magnifier_hide(struct slurp_output *output) {
+	struct slurp_lens *lens = &output->lens;
+	if (lens->surface == NULL || !lens->mapped) {
+		return;
+	}
+	lens->dirty = false;
+	lens->mapped = false;
+	wl_surface_attach(lens->surface, NULL, 0, 0);
+	wl_surface_commit(lens->surface);
+}
+
+/**
+ * Nearest-neighbor upscale of the capture window around the lens center
+ * into the lens buffer. Only the lens area is touched.
+ */
+static void blit_lens(struct slurp_output *output, struct pool_buffer *buffer) {
+	struct slurp_state *state = output->state;
+	struct slurp_lens *lens = &output->lens;
+	struct capture *capture = &output->capture;
+	struct slurp_box *geometry = &output->logical_geometry;
+
+	// Capture pixels per logical pixel
+	double capture_scale_x = (double)capture->width / geometry->width;
+	double capture_scale_y = (double)capture->height / geometry->height;
+	double zoom = state->magnifier_zoom;
+	double center_x = lens->x - geometry->x + 0.5;
+	double center_y = lens->y - geometry->y + 0.5;
+
+	int32_t size = buffer->width;
+	int32_t *columns = lens->columns;
+	for (int32_t i = 0; i < size; i++) {
+		double logical = center_x +
+			((i + 0.5) / output->scale - LENS_SIZE / 2.0) / zoom;
+		columns[i] = (int32_t)floor(logical * capture_scale_x);
+	}
+
+	uint32_t *dst = buffer->data;
+	uint32_t dst_stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32,
+		buffer->width) / sizeof(uint32_t);
+	int32_t prev_row = INT32_MIN;
+	for (int32_t j = 0; j < (int32_t)buffer->height; j++) {
+		double logical = center_y +
+			((j + 0.5) / output->scale - LENS_SIZE / 2.0) / zoom;
+		int32_t row = (int32_t)floor(logical * capture_scale_y);
+		uint32_t *dst_row = dst + j * dst_stride;
+		if (row == prev_row) {
+			// Upscaled rows repeat, copy the previous one
+			memcpy(dst_row, dst_row - dst_stride, size * sizeof(uint32_t));
+			continue;
+		}
+		prev_row = row;
+
+		if (row < 0 || row >= (int32_t)capture->height) {
+			memset(dst_row, 0, size * sizeof(uint32_t));
+			continue;
+		}
+		const uint32_t *src_row = (const uint32_t *)
+			((const uint8_t *)capture->data + row * capture->stride);
+		for (int32_t i = 0; i < size; i++) {
+			int32_t col = columns[i];
+			dst_row[i] = (col < 0 || col >= (int32_t)capture->width) ?
+				0 : src_row[col] | 0xFF000000;
+		}
+	}
+}
+
+static void render_lens(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	struct slurp_lens *lens = &output->lens;
+	struct slurp_box *geometry = &output->logical_geometry;
+
+	int32_t buffer_size = LENS_SIZE * output->scale;
+	struct pool_buffer *buffer = get_next_buffer(state->shm, &state->shm_stats,
+		lens->buffers, buffer_size, buffer_size, WL_SHM_FORMAT_ARGB8888);
+	if (buffer == NULL) {
+		return;
+	}
+	if (lens->columns_len < buffer_size) {
+		int32_t *columns = realloc(lens->columns, buffer_size * sizeof(int32_t));
+		if (columns == NULL) {
+			return;
+		}
+		lens->columns = columns;
+		lens->columns_len = buffer_size;
+	}
+
+	cairo_surface_flush(buffer->surface);
+	blit_lens(output, buffer);
+	cairo_surface_mark_dirty(buffer->surface);
+
+	// Outline the magnified cursor pixel and the lens
+	cairo_t *cairo = buffer->cairo;
+	cairo_identity_matrix(cairo);
+	cairo_scale(cairo, output->scale, output->scale);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+	uint32_t color = state->colors.border;
+	cairo_set_source_rgba(cairo, (color >> 24 & 0xFF) / 255.0,
+		(color >> 16 & 0xFF) / 255.0, (color >> 8 & 0xFF) / 255.0,
+		(color & 0xFF) / 255.0);
+	cairo_set_line_width(cairo, 1);
+	double pixel = state->magnifier_zoom;
+	cairo_rectangle(cairo, (LENS_SIZE - pixel) / 2.0, (LENS_SIZE - pixel) / 2.0,
+		pixel, pixel);
+	cairo_rectangle(cairo, 0.5, 0.5, LENS_SIZE - 1, LENS_SIZE - 1);
+	cairo_stroke(cairo);
+	cairo_surface_flush(buffer->surface);
+
+	// Keep the lens next to the cursor, inside the output
+	int32_t x = lens->x - geometry->x + LENS_OFFSET;
+	int32_t y = lens->y - geometry->y + LENS_OFFSET;
+	if (x + LENS_SIZE > geometry->width) {
+		x = lens->x - geometry->x - LENS_OFFSET - LENS_SIZE;
+	}
+	if (y + LENS_SIZE > geometry->height) {
+		y = lens->y - geometry->y - LENS_OFFSET - LENS_SIZE;
+	}
+	wl_subsurface_set_position(lens->subsurface, x, y);
+
+	buffer->busy = true;
+	lens->frame_callback = wl_surface_frame(lens->surface);
+	wl_callback_add_listener(lens->frame_callback, &lens_frame_listener, output);
+	wl_surface_attach(lens->surface, buffer->buffer, 0, 0);
+	wl_surface_damage_buffer(lens->surface, 0, 0, buffer_size, buffer_size);
+	wl_surface_set_buffer_scale(lens->surface, output->scale);
+	wl_surface_commit(lens->surface);
+	// The subsurface position is applied with the parent state
+	wl_surface_commit(output->surface);
+
+	lens->mapped = true;
+	lens->dirty = false;
+}
@@ -1,945 +1,710 @@
 #define _POSIX_C_SOURCE 200809L
 
-#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
-#include <wayland-cursor.h>
-#include <xkbcommon/xkbcommon.h>
-#include <linux/input-event-codes.h>
 
-#include "slurp.h"
-#include "render.h"
+#include "libslurp.h"
+#include "event-loop.h"
 #include "lock.h"
+#include "history.h"
+#include "json.h"
+#include "sway-ipc.h"
 
-#define BG_COLOR 0xFFFFFF40
-#define BORDER_COLOR 0x000000FF
-#define SELECTION_COLOR 0x00000000
-#define FONT_FAMILY "sans-serif"
+// Formatted records are written in batches of this size in query mode
+#define QUERY_FLUSH_SIZE 65536
 
-static void noop() {
-	// This space intentionally left blank
-}
-
-static void set_output_dirty(struct slurp_output *output);
+static const char usage[] =
+	"Usage: slurp [options...]\n"
+	"\n"
+	"  -h           Show help message and quit.\n"
+	"  -d           Display dimensions of selection.\n"
+	"  -b #rrggbbaa Set background color.\n"
+	"  -c #rrggbbaa Set border color.\n"
+	"  -s #rrggbbaa Set selection color.\n"
+	"  -B #rrggbbaa Set option box color.\n"
+	"  -F s         Set the font family for the dimensions.\n"
+	"  -w n         Set border weight.\n"
+	"  -f s         Set output format.\n"
+	"  -J           Print JSON objects, one per line, instead of the format.\n"
+	"  -0           Terminate records with a NUL byte instead of a newline.\n"
+	"  -o           Select a display output.\n"
+	"  -p           Select a single point.\n"
+	"  -r           Restrict selection to predefined boxes.\n"
+	"  -a w:h       Force aspect ratio.\n"
+	"  -x           Display crosshairs across active display output.\n"
+	"  -S n         Snap selection edges to predefined boxes within n pixels.\n"
+	"  -t n         Cancel the selection after n seconds.\n"
+	"  -l           Keep reading box updates from stdin during selection.\n"
+	"  -m n         Display a magnifier with a zoom factor of n.\n"
+	"  -z           Freeze the screen content during selection.\n"
+	"  -W           Add predefined boxes for sway/i3 windows.\n"
+	"  -I           Same as -W, without window borders.\n"
+	"  -H n         Print the nth previous selection and quit.\n"
+	"  -R           Add predefined boxes for previous selections.\n"
+	"  -q           Format boxes from stdin without displaying anything.\n"
+	"  -C file      Save the selected region as PNG or PPM to file (- for stdout).\n"
+	"  -u           Print the selection whenever it changes while dragging.\n"
+	"  -P           Predict the pointer motion to reduce the drawing latency.\n"
+	"  -G ms        Lower the quality while dragging if rendering exceeds ms.\n"
+	"  -k           Filter predefined boxes by label when typing.\n"
+	"  -E           Snap selection edges to edges in the screen content.\n"
+	"  -M           Use 16-bit buffers when the overlay is opaque.\n"
+	"  -y           Copy the result to the clipboard.\n";
+
+static uint32_t parse_color(const char *color) {
+	if (color[0] == '#') {
+		++color;
+	}
 
-static int max(int a, int b) {
-	return (a > b) ? a : b;
+	int len = strlen(color);
+	if (len != 6 && len != 8) {
+		fprintf(stderr, "Invalid color %s, "
+				"defaulting to color 0xFFFFFFFF\n", color);
+		return 0xFFFFFFFF;
+	}
+	uint32_t res = (uint32_t)strtoul(color, NULL, 16);
+	if (strlen(color) == 6) {
+		res = (res << 8) | 0xFF;
+	}
+	return res;
 }
 
-static int min(int a, int b) {
-	return (a < b) ? a : b;
+static bool parse_box(const char *line, struct slurp_box *box) {
+	return sscanf(line, "%d,%d %dx%d %m[^\n]", &box->x, &box->y,
+			&box->width, &box->height, &box->label) >= 4;
 }
 
-static struct slurp_output *output_from_surface(struct slurp_state *state,
-	struct wl_surface *surface);
+/**
+ * Parse a "@name" line, which starts a layer of boxes. "@" alone goes back to
+ * the default layer, and name is set to NULL.
+ */
+static bool parse_layer(const char *line, char **name) {
+	if (line[0] != '@') {
+		return false;
+	}
+	line++;
+	size_t len = strcspn(line, "\n");
+	*name = len > 0 ? strndup(line, len) : NULL;
+	return true;
+}
 
-static void move_seat(struct slurp_seat *seat, wl_fixed_t surface_x,
-		wl_fixed_t surface_y,
-		struct slurp_selection *current_selection) {
-	int x = wl_fixed_to_int(surface_x) +
-		current_selection->current_output->logical_geometry.x;
-	int y = wl_fixed_to_int(surface_y) + current_selection->current_output->logical_geometry.y;
+/**
+ * Predefined boxes collected before the selection starts.
+ */
+struct box_array {
+	struct slurp_box *data;
+	size_t len, cap;
+};
 
-	if (seat->state->edit_anchor) {
-		current_selection->anchor_x += x - current_selection->x;
-		current_selection->anchor_y += y - current_selection->y;
+static bool box_array_add(struct box_array *array, const struct slurp_box *box) {
+	if (array->len == array->cap) {
+		size_t cap = array->cap ? array->cap * 2 : 64;
+		struct slurp_box *data = realloc(array->data, cap * sizeof(*data));
+		if (data == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+		array->data = data;
+		array->cap = cap;
 	}
-
-	current_selection->x = x;
-	current_selection->y = y;
+	struct slurp_box *b = &array->data[array->len++];
+	*b = *box;
+	b->label = box->label ? strdup(box->label) : NULL;
+	return true;
 }
 
-static void seat_update_selection(struct slurp_seat *seat) {
-	seat->pointer_selection.has_selection = false;
-
-	// find smallest box intersecting the cursor
-	struct slurp_box *box;
-	wl_list_for_each(box, &seat->state->boxes, link) {
-		if (in_box(box, seat->pointer_selection.x,
-			   seat->pointer_selection.y)) {
-			if (seat->pointer_selection.has_selection &&
-				box_size(
-					&seat->pointer_selection.selection) <
-					box_size(box)) {
-				continue;
-			}
-			seat->pointer_selection.selection = *box;
-			seat->pointer_selection.has_selection = true;
-		}
+static void box_array_finish(struct box_array *array) {
+	for (size_t i = 0; i < array->len; i++) {
+		free(array->data[i].label);
 	}
+	free(array->data);
 }
 
-static void seat_set_outputs_dirty(struct slurp_seat *seat) {
-	struct slurp_state *state = seat->state;
-	struct slurp_output *output;
-	wl_list_for_each(output, &seat->state->outputs, link) {
-		struct slurp_box *geometry = &output->logical_geometry;
-		if (box_intersect(geometry, &seat->pointer_selection.selection) ||
-				box_intersect(geometry, &seat->touch_selection.selection) ||
-				(state->crosshairs && in_box(geometry, seat->pointer_selection.x, seat->pointer_selection.y))) {
-			set_output_dirty(output);
-		}
-	}
+/**
+ * Add the collected boxes to the current layer of state, and empty array.
+ */
+static bool box_array_flush(struct box_array *array,
+		struct slurp_state *state) {
+	bool ok = slurp_add_boxes(state, array->data, array->len);
+	for (size_t i = 0; i < array->len; i++) {
+		free(array->data[i].label);
+	}
+	array->len = 0;
+	return ok;
 }
 
-static void handle_active_selection_motion(struct slurp_seat *seat, struct slurp_selection *current_selection) {
-	if(seat->state->restrict_selection){
-		return;
-	}
+static void handle_window(const struct slurp_box *box, void *data) {
+	struct box_array *boxes = data;
+	box_array_add(boxes, box);
+}
 
-	seat->state->resizing_selection = true;
+/**
+ * Box records read from stdin while the selection is running.
+ */
+struct live_boxes {
+	struct slurp_state *state;
+	struct event_loop *event_loop;
+	char *buffer; // partial records
+	size_t len, cap;
+};
 
-	int32_t anchor_x = current_selection->anchor_x;
-	int32_t anchor_y = current_selection->anchor_y;
-	int32_t dist_x = current_selection->x - anchor_x;
-	int32_t dist_y = current_selection->y - anchor_y;
+/**
+ * Apply a box record from a live source: "[+ ]<box>" adds a box, "- <box>"
+ * removes a matching box and "=" removes all boxes. The operator must be
+ * followed by a space so that boxes at negative coordinates stay additions.
+ * "@name" makes the following records apply to another layer.
+ */
+static void handle_box_record(struct slurp_state *state, const char *line) {
+	char *layer;
+	if (parse_layer(line, &layer)) {
+		slurp_set_layer(state, layer);
+		free(layer);
+		return;
+	}
 
-	current_selection->has_selection = true;
-	// selection includes the seat and anchor positions
-	int32_t width = abs(dist_x) + 1;
-	int32_t height = abs(dist_y) + 1;
-	if (seat->state->aspect_ratio) {
-		width = max(width, height / seat->state->aspect_ratio);
-		height = max(height, width * seat->state->aspect_ratio);
+	char op = '+';
+	if ((line[0] == '+' || line[0] == '-' || line[0] == '=') &&
+			strchr(" \t\n", line[1]) != NULL) {
+		// strchr also matches the terminator, for a bare "="
+		op = line[0];
+		line++;
 	}
-	current_selection->selection.x = dist_x > 0 ? anchor_x : anchor_x - (width - 1);
-	current_selection->selection.y = dist_y > 0 ? anchor_y : anchor_y - (height - 1);
-	current_selection->selection.width = width;
-	current_selection->selection.height = height;
-}
 
-static void pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
-		uint32_t serial, struct wl_surface *surface,
-		wl_fixed_t surface_x, wl_fixed_t surface_y) {
-	struct slurp_seat *seat = data;
-	struct slurp_output *output = output_from_surface(seat->state, surface);
-	if (output == NULL) {
+	if (op == '=') {
+		slurp_clear_boxes(state);
 		return;
 	}
 
-	// the places the cursor moved away from are also dirty
-	if (seat->pointer_selection.has_selection || seat->state->crosshairs) {
-		seat_set_outputs_dirty(seat);
+	if (line[strspn(line, " \t")] == '\0') {
+		return;
 	}
-
-	// TODO: handle multiple overlapping outputs
-	seat->pointer_selection.current_output = output;
-
-	move_seat(seat, surface_x, surface_y, &seat->pointer_selection);
-
-	switch (seat->button_state) {
-	case WL_POINTER_BUTTON_STATE_RELEASED:
-		seat_update_selection(seat);
-		break;
-	case WL_POINTER_BUTTON_STATE_PRESSED:
-		handle_active_selection_motion(seat, &seat->pointer_selection);
-		break;
+	struct slurp_box in_box = {0};
+	if (!parse_box(line, &in_box)) {
+		fprintf(stderr, "invalid box format: %s\n", line);
+		return;
 	}
 
-	seat_set_outputs_dirty(seat);
-
-	if (output->state->cursor_shape_manager) {
-		struct wp_cursor_shape_device_v1 *device =
-			wp_cursor_shape_manager_v1_get_pointer(
-				output->state->cursor_shape_manager, wl_pointer);
-		wp_cursor_shape_device_v1_set_shape(device, serial,
-			WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CROSSHAIR);
-		wp_cursor_shape_device_v1_destroy(device);
+	if (op == '+') {
+		slurp_add_boxes(state, &in_box, 1);
 	} else {
-		wl_surface_set_buffer_scale(seat->cursor_surface, output->scale);
-		wl_surface_attach(seat->cursor_surface,
-			wl_cursor_image_get_buffer(output->cursor_image), 0, 0);
-		wl_pointer_set_cursor(wl_pointer, serial, seat->cursor_surface,
-			output->cursor_image->hotspot_x / output->scale,
-			output->cursor_image->hotspot_y / output->scale);
-		wl_surface_commit(seat->cursor_surface);
+		slurp_remove_box(state, &in_box);
 	}
+	free(in_box.label);
 }
 
-static void pointer_handle_leave(void *data, struct wl_pointer *wl_pointer,
-		uint32_t serial, struct wl_surface *surface) {
-	struct slurp_seat *seat = data;
-
-	// TODO: handle multiple overlapping outputs
-	seat->pointer_selection.current_output = NULL;
-}
-
-static void pointer_handle_motion(void *data, struct wl_pointer *wl_pointer,
-		uint32_t time, wl_fixed_t surface_x, wl_fixed_t surface_y) {
-	struct slurp_seat *seat = data;
-	struct slurp_state *state = seat->state;
-
-	// the places the cursor moved away from are also dirty
-	if (seat->pointer_selection.has_selection || state->crosshairs) {
-		seat_set_outputs_dirty(seat);
-	}
+static void handle_live_boxes(int fd, short revents, void *data) {
+	struct live_boxes *live = data;
 
-	move_seat(seat, surface_x, surface_y, &seat->pointer_selection);
-
-	switch (seat->button_state) {
-	case WL_POINTER_BUTTON_STATE_RELEASED:
-		seat_update_selection(seat);
-		break;
-	case WL_POINTER_BUTTON_STATE_PRESSED:
-		handle_active_selection_motion(seat, &seat->pointer_selection);
-		break;
-	}
-
-	if (seat->pointer_selection.has_selection || state->crosshairs) {
-		seat_set_outputs_dirty(seat);
+	if (live->cap - live->len < 4096) {
+		size_t cap = live->cap ? live->cap * 2 : 8192;
+		char *buf = realloc(live->buffer, cap);
+		if (buf == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return;
+		}
+		live->buffer = buf;
+		live->cap = cap;
 	}
-}
 
-static void handle_selection_start(struct slurp_seat *seat,
-				   struct slurp_selection *current_selection) {
-	struct slurp_state *state = seat->state;
-
-	if (state->single_point) {
-		state->result.x = current_selection->x;
-		state->result.y = current_selection->y;
-		state->result.width = state->result.height = 1;
-		state->running = false;
-	} else if (state->restrict_selection) {
-		if (current_selection->has_selection) {
-			state->result = current_selection->selection;
-			state->running = false;
+	// Read a single chunk per wakeup, so that a flood of records can't starve
+	// input events. This doesn't block, as poll reported data or the end of
+	// the input.
+	bool eof = false;
+	ssize_t n = read(fd, live->buffer + live->len, live->cap - live->len - 1);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return;
 		}
+		fprintf(stderr, "failed to read boxes: %s\n", strerror(errno));
+		eof = true;
+	} else if (n == 0) {
+		eof = true;
 	} else {
-		current_selection->anchor_x = current_selection->x;
-		current_selection->anchor_y = current_selection->y;
+		live->len += n;
 	}
-}
 
-static void handle_selection_end(struct slurp_seat *seat,
-				 struct slurp_selection *current_selection) {
-	struct slurp_state *state = seat->state;
-	if (state->single_point || state->restrict_selection) {
-		return;
+	char *start = live->buffer;
+	char *end = live->buffer + live->len;
+	*end = '\0';
+	char *newline;
+	while ((newline = memchr(start, '\n', end - start)) != NULL) {
+		*newline = '\0';
+		handle_box_record(live->state, start);
+		start = newline + 1;
 	}
-	if (current_selection->has_selection) {
-		state->result = current_selection->selection;
-	} else {
-		state->result.x = current_selection->x;
-		state->result.y = current_selection->y;
-		state->result.width = state->result.height = 1;
+	if (eof && start < end) {
+		handle_box_record(live->state, start);
+		start = end;
 	}
-	state->resizing_selection = false;
-	state->running = false;
-}
+	live->len = end - start;
+	memmove(live->buffer, start, live->len);
 
-static void handle_selection_cancelled(struct slurp_seat *seat) {
-	struct slurp_state *state = seat->state;
-	seat->pointer_selection.has_selection = false;
-	seat->touch_selection.has_selection = false;
-	state->edit_anchor = false;
-	state->running = false;
+	if (eof) {
+		event_loop_remove_fd(live->event_loop, fd);
+	}
 }
 
-static void pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
-		uint32_t serial, uint32_t time, uint32_t button,
-		uint32_t button_state) {
-	struct slurp_seat *seat = data;
-	if (seat->touch_selection.has_selection) {
+static void save_history(const struct slurp_box *result,
+		const struct slurp_box *output) {
+	struct history history;
+	if (!history_open(&history)) {
 		return;
 	}
-
-	seat->button_state = button_state;
-	switch (button) {
-	case BTN_LEFT:
-		switch (button_state) {
-		case WL_POINTER_BUTTON_STATE_PRESSED:
-			handle_selection_start(seat, &seat->pointer_selection);
-			break;
-		case WL_POINTER_BUTTON_STATE_RELEASED:
-			handle_selection_end(seat, &seat->pointer_selection);
-			break;
+	struct history_entry entry = {
+		.x = result->x,
+		.y = result->y,
+		.width = result->width,
+		.height = result->height,
+	};
+	if (result->label) {
+		snprintf(entry.label, sizeof(entry.label), "%s", result->label);
+	}
+	if (output) {
+		entry.output_x = output->x;
+		entry.output_y = output->y;
+		entry.output_width = output->width;
+		entry.output_height = output->height;
+		if (output->label) {
+			snprintf(entry.output_name, sizeof(entry.output_name), "%s",
+				output->label);
 		}
-		break;
-	default: //other mouse buttons cancel the selection
-		handle_selection_cancelled(seat);
-		break;
 	}
+	history_push(&history, &entry);
+	history_close(&history);
 }
 
-static const struct wl_pointer_listener pointer_listener = {
-	.enter = pointer_handle_enter,
-	.leave = pointer_handle_leave,
-	.motion = pointer_handle_motion,
-	.button = pointer_handle_button,
-	.axis = noop,
-};
-
-static void keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard,
-		const uint32_t format, const int32_t fd, const uint32_t size) {
-	struct slurp_seat *seat = data;
-	switch (format) {
-	case WL_KEYBOARD_KEYMAP_FORMAT_NO_KEYMAP:
-		seat->xkb_keymap = xkb_keymap_new_from_names(seat->state->xkb_context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
-		break;
-	case WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1:;
-		void *buffer;
-		if ((buffer = mmap(NULL, size - 1, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
-			fprintf(stderr, "mmap failed\n");
-			exit(EXIT_FAILURE);
-		}
-		seat->xkb_keymap =
-			xkb_keymap_new_from_buffer(seat->state->xkb_context,
-					buffer, size - 1,
-					XKB_KEYMAP_FORMAT_TEXT_V1,
-					XKB_KEYMAP_COMPILE_NO_FLAGS);
-		munmap(buffer, size - 1);
-		close(fd);
-		break;
-	}
-	seat->xkb_state = xkb_state_new(seat->xkb_keymap);
+static void history_entry_to_boxes(struct history_entry *entry,
+		struct slurp_box *result, struct slurp_box *output) {
+	*result = (struct slurp_box){
+		.x = entry->x,
+		.y = entry->y,
+		.width = entry->width,
+		.height = entry->height,
+		.label = entry->label[0] ? entry->label : NULL,
+	};
+	*output = (struct slurp_box){
+		.x = entry->output_x,
+		.y = entry->output_y,
+		.width = entry->output_width,
+		.height = entry->output_height,
+		.label = entry->output_name[0] ? entry->output_name : NULL,
+	};
 }
 
-// Recompute the selection if the aspect ratio changed.
-static void recompute_selection(struct slurp_seat *seat) {
-	struct slurp_selection *current = slurp_seat_current_selection(seat);
-	if (current->has_selection) {
-		handle_active_selection_motion(seat, slurp_seat_current_selection(seat));
-		seat_set_outputs_dirty(seat);
+/**
+ * Write the formatted records to stdout once enough of them are buffered, or
+ * all of them if force is set.
+ */
+static bool flush_records(struct slurp_format *format, bool force) {
+	size_t len;
+	slurp_format_data(format, &len);
+	if (len < QUERY_FLUSH_SIZE && !force) {
+		return true;
 	}
+	if (!slurp_format_flush(format, STDOUT_FILENO)) {
+		fprintf(stderr, "failed to write output: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
 }
 
-static void keyboard_handle_key(void *data, struct wl_keyboard *wl_keyboard,
-		const uint32_t serial, const uint32_t time, const uint32_t key,
-		const uint32_t key_state) {
-	struct slurp_seat *seat = data;
-	struct slurp_state *state = seat->state;
-	const xkb_keysym_t keysym = xkb_state_key_get_one_sym(seat->xkb_state, key + 8);
-
-	switch (key_state) {
-	case WL_KEYBOARD_KEY_STATE_PRESSED:
-		switch (keysym) {
-		case XKB_KEY_Escape:
-			handle_selection_cancelled(seat);
-			break;
+/**
+ * Resolve the outputs of boxes read from stdin (or of all outputs if
+ * output_boxes is set) and print them, without creating any surface.
+ */
+static int run_query(struct slurp_options *options,
+		struct slurp_format *format) {
+	struct wl_display *display = wl_display_connect(NULL);
+	if (display == NULL) {
+		fprintf(stderr, "failed to create display\n");
+		return EXIT_FAILURE;
+	}
+	options->query = true;
+	struct slurp_state *state = slurp_create(display, options);
+	if (state == NULL) {
+		wl_display_disconnect(display);
+		return EXIT_FAILURE;
+	}
 
-		case XKB_KEY_space:
-			if (!seat->pointer_selection.has_selection &&
-					!seat->touch_selection.has_selection) {
+	bool needs_output = slurp_format_needs_output(format);
+	int status = EXIT_SUCCESS;
+	const struct slurp_box *output;
+	if (options->output_boxes) {
+		for (size_t i = 0; (output = slurp_get_output(state, i)) != NULL; i++) {
+			slurp_format_append(format, output, output);
+		}
+	}
+	if (!isatty(STDIN_FILENO)) {
+		char *line = NULL;
+		size_t line_size = 0;
+		while (getline(&line, &line_size, stdin) >= 0) {
+			struct slurp_box box = {0};
+			char *layer;
+			if (parse_layer(line, &layer)) {
+				free(layer);
+				continue;
+			}
+			if (!parse_box(line, &box)) {
+				fprintf(stderr, "invalid box format: %s\n", line);
+				status = EXIT_FAILURE;
 				break;
 			}
-			state->edit_anchor = true;
-			break;
-		case XKB_KEY_Shift_L:
-		case XKB_KEY_Shift_R:
-			if (!state->fixed_aspect_ratio) {
-				state->aspect_ratio = 1;
-				if (state->resizing_selection) {
-					recompute_selection(seat);
-				}
+			output = slurp_find_output(state, &box);
+			if (output == NULL && needs_output) {
+				fprintf(stderr, "box %d,%d %dx%d is outside of all outputs\n",
+					box.x, box.y, box.width, box.height);
+				free(box.label);
+				status = EXIT_FAILURE;
+				continue;
 			}
-			break;
-		}
-		break;
-
-	case WL_KEYBOARD_KEY_STATE_RELEASED:
-		if (keysym == XKB_KEY_space) {
-			state->edit_anchor = false;
-		} else if (!state->fixed_aspect_ratio && (keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R)) {
-			state->aspect_ratio = 0;
-			if (state->resizing_selection) {
-				recompute_selection(seat);
+			slurp_format_append(format, &box, output);
+			free(box.label);
+			if (!flush_records(format, false)) {
+				status = EXIT_FAILURE;
+				break;
 			}
 		}
-		break;
-	}
-
-}
-
-static void keyboard_handle_modifiers(void *data, struct wl_keyboard *wl_keyboard,
-		const uint32_t serial, const uint32_t mods_depressed,
-		const uint32_t mods_latched, const uint32_t mods_locked,
-		const uint32_t group) {
-	struct slurp_seat *seat = data;
-	xkb_state_update_mask(seat->xkb_state, mods_depressed, mods_latched,
-			mods_locked, 0, 0, group);
-}
-
-static const struct wl_keyboard_listener keyboard_listener = {
-	.keymap = keyboard_handle_keymap,
-	.enter = noop,
-	.leave = noop,
-	.key = keyboard_handle_key,
-	.modifiers = keyboard_handle_modifiers,
-};
-
-static void touch_handle_down(void *data, struct wl_touch *touch,
-		uint32_t serial, uint32_t time,
-		struct wl_surface *surface, int32_t id,
-		wl_fixed_t x, wl_fixed_t y) {
-	struct slurp_seat *seat = data;
-	if (seat->pointer_selection.has_selection) {
-		return;
-	}
-	if (seat->touch_id == TOUCH_ID_EMPTY) {
-		seat->touch_id = id;
-		seat->touch_selection.current_output =
-			output_from_surface(seat->state, surface);
-		move_seat(seat, x, y, &seat->touch_selection);
-		handle_selection_start(seat, &seat->touch_selection);
+		free(line);
 	}
-}
-
-static void touch_clear_state(struct slurp_seat *seat) {
-	seat->touch_id = TOUCH_ID_EMPTY;
-	seat->touch_selection.current_output = NULL;
-}
-
-static void touch_handle_up(void *data, struct wl_touch *touch, uint32_t serial,
-		uint32_t time, int32_t id) {
-	struct slurp_seat *seat = data;
-	handle_selection_end(seat, &seat->touch_selection);
-	touch_clear_state(seat);
-}
-
-static void touch_handle_motion(void *data, struct wl_touch *touch,
-		uint32_t time, int32_t id, wl_fixed_t x,
-		wl_fixed_t y) {
-	struct slurp_seat *seat = data;
-	if (seat->touch_id == id) {
-		move_seat(seat, x, y, &seat->touch_selection);
-		handle_active_selection_motion(seat, &seat->touch_selection);
-		seat_set_outputs_dirty(seat);
+	if (!flush_records(format, true)) {
+		status = EXIT_FAILURE;
 	}
-}
 
-static void touch_handle_cancel(void *data, struct wl_touch *touch) {
-	struct slurp_seat *seat = data;
-	touch_clear_state(seat);
+	slurp_destroy(state);
+	wl_display_disconnect(display);
+	return status;
 }
 
-static const struct wl_touch_listener touch_listener = {
-	.down = touch_handle_down,
-	.up = touch_handle_up,
-	.frame = noop,
-	.motion = touch_handle_motion,
-	.orientation = noop,
-	.shape = noop,
-	.cancel = touch_handle_cancel,
+/**
+ * Selection records streamed to stdout while the user drags. stdout is
+ * non-blocking: a record which can't be written completely is finished when
+ * stdout becomes writable again, and only the latest of the records produced
+ * in the meantime is kept.
+ */
+struct selection_stream {
+	struct slurp_state *state;
+	struct event_loop *event_loop;
+	struct slurp_format *format;
+	int flags; // of stdout, restored on finish
+	char *current; // record being written
+	size_t current_len, current_offset;
+	char *latest; // next record
+	size_t latest_len;
+	bool watching;
 };
 
-static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
-		uint32_t capabilities) {
-	struct slurp_seat *seat = data;
+static void handle_stream_writable(int fd, short revents, void *data);
 
-	if (capabilities & WL_SEAT_CAPABILITY_POINTER) {
-		seat->wl_pointer = wl_seat_get_pointer(wl_seat);
-		wl_pointer_add_listener(seat->wl_pointer, &pointer_listener, seat);
-	}
-	if (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) {
-		seat->wl_keyboard = wl_seat_get_keyboard(wl_seat);
-		wl_keyboard_add_listener(seat->wl_keyboard, &keyboard_listener, seat);
-	}
-	if (capabilities & WL_SEAT_CAPABILITY_TOUCH) {
-		seat->wl_touch = wl_seat_get_touch(wl_seat);
-		wl_touch_add_listener(seat->wl_touch, &touch_listener, seat);
-	}
-}
-
-static const struct wl_seat_listener seat_listener = {
-	.capabilities = seat_handle_capabilities,
-};
+static void selection_stream_flush(struct selection_stream *stream) {
+	while (true) {
+		if (stream->current == NULL) {
+			if (stream->latest == NULL) {
+				break;
+			}
+			stream->current = stream->latest;
+			stream->current_len = stream->latest_len;
+			stream->current_offset = 0;
+			stream->latest = NULL;
+		}
 
-static void create_seat(struct slurp_state *state, struct wl_seat *wl_seat) {
-	struct slurp_seat *seat = calloc(1, sizeof(struct slurp_seat));
-	if (seat == NULL) {
-		fprintf(stderr, "allocation failed\n");
-		return;
+		ssize_t n = write(STDOUT_FILENO,
+			stream->current + stream->current_offset,
+			stream->current_len - stream->current_offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && errno == EAGAIN) {
+			if (!stream->watching) {
+				stream->watching = event_loop_add_fd(stream->event_loop,
+					STDOUT_FILENO, POLLOUT, handle_stream_writable, stream);
+			}
+			return;
+		}
+		if (n < 0) {
+			fprintf(stderr, "failed to write selection: %s\n", strerror(errno));
+			stream->current_offset = stream->current_len;
+		} else {
+			stream->current_offset += n;
+		}
+		if (stream->current_offset == stream->current_len) {
+			free(stream->current);
+			stream->current = NULL;
+		}
 	}
-	seat->state = state;
-	seat->wl_seat = wl_seat;
-	seat->touch_id = TOUCH_ID_EMPTY;
-	wl_list_insert(&state->seats, &seat->link);
-	wl_seat_add_listener(wl_seat, &seat_listener, seat);
-}
 
-static void destroy_seat(struct slurp_seat *seat) {
-	wl_list_remove(&seat->link);
-	wl_surface_destroy(seat->cursor_surface);
-	if (seat->wl_pointer) {
-		wl_pointer_destroy(seat->wl_pointer);
-	}
-	if (seat->wl_keyboard) {
-		wl_keyboard_destroy(seat->wl_keyboard);
+	if (stream->watching) {
+		event_loop_remove_fd(stream->event_loop, STDOUT_FILENO);
+		stream->watching = false;
 	}
-	if (seat->wl_touch) {
-		wl_touch_destroy(seat->wl_touch);
-	}
-	xkb_state_unref(seat->xkb_state);
-	xkb_keymap_unref(seat->xkb_keymap);
-	wl_seat_destroy(seat->wl_seat);
-	free(seat);
 }
 
-static void output_handle_geometry(void *data, struct wl_output *wl_output,
-		int32_t x, int32_t y, int32_t physical_width, int32_t physical_height,
-		int32_t subpixel, const char *make, const char *model,
-		int32_t transform) {
-	struct slurp_output *output = data;
-
-	output->geometry.x = x;
-	output->geometry.y = y;
+static void handle_stream_writable(int fd, short revents, void *data) {
+	selection_stream_flush(data);
 }
 
-static void output_handle_mode(void *data, struct wl_output *wl_output,
-		uint32_t flags, int32_t width, int32_t height, int32_t refresh) {
-	struct slurp_output *output = data;
-	if ((flags & WL_OUTPUT_MODE_CURRENT) == 0) {
+static void handle_selection(const struct slurp_box *selection, void *data) {
+	struct selection_stream *stream = data;
+	slurp_format_append(stream->format, selection,
+		slurp_find_output(stream->state, selection));
+	size_t len;
+	const char *formatted = slurp_format_data(stream->format, &len);
+	char *record = malloc(len);
+	if (record == NULL) {
+		slurp_format_reset(stream->format);
 		return;
 	}
-	output->geometry.width = width;
-	output->geometry.height = height;
-}
-
-static void output_handle_scale(void *data, struct wl_output *wl_output,
-		int32_t scale) {
-	struct slurp_output *output = data;
+	memcpy(record, formatted, len);
+	slurp_format_reset(stream->format);
 
-	output->scale = scale;
+	free(stream->latest);
+	stream->latest = record;
+	stream->latest_len = len;
+	selection_stream_flush(stream);
 }
 
-static const struct wl_output_listener output_listener = {
-	.geometry = output_handle_geometry,
-	.mode = output_handle_mode,
-	.done = noop,
-	.scale = output_handle_scale,
-};
-
-static void xdg_output_handle_logical_position(void *data,
-		struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y) {
-	struct slurp_output *output = data;
-	output->logical_geometry.x = x;
-	output->logical_geometry.y = y;
+/**
+ * Finish the record being written and drop the others, so that the final
+ * result can follow.
+ */
+static void selection_stream_finish(struct selection_stream *stream) {
+	if (stream->watching) {
+		event_loop_remove_fd(stream->event_loop, STDOUT_FILENO);
+		stream->watching = false;
+	}
+	fcntl(STDOUT_FILENO, F_SETFL, stream->flags);
+	free(stream->latest);
+	stream->latest = NULL;
+	selection_stream_flush(stream);
 }
 
-static void xdg_output_handle_logical_size(void *data,
-		struct zxdg_output_v1 *xdg_output, int32_t width, int32_t height) {
-	struct slurp_output *output = data;
-	output->logical_geometry.width = width;
-	output->logical_geometry.height = height;
-}
-
-static void xdg_output_handle_name(void *data, struct zxdg_output_v1 *xdg_output, const char *name) {
-	struct slurp_output *output = data;
-	output->logical_geometry.label = strdup(name);
-}
-
-static const struct zxdg_output_v1_listener xdg_output_listener = {
-	.logical_position = xdg_output_handle_logical_position,
-	.logical_size = xdg_output_handle_logical_size,
-	.done = noop,
-	.name = xdg_output_handle_name,
-	.description = noop,
-};
-
-static void create_output(struct slurp_state *state,
-		struct wl_output *wl_output) {
-	struct slurp_output *output = calloc(1, sizeof(struct slurp_output));
-	if (output == NULL) {
-		fprintf(stderr, "allocation failed\n");
-		return;
+static void handle_timeout(int fd, short revents, void *data) {
+	struct slurp_state *state = data;
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+		fprintf(stderr, "failed to read timerfd\n");
 	}
-	output->wl_output = wl_output;
-	output->state = state;
-	output->scale = 1;
-	wl_list_insert(&state->outputs, &output->link);
-
-	wl_output_add_listener(wl_output, &output_listener, output);
+	fprintf(stderr, "selection timed out\n");
+	slurp_cancel(state);
 }
 
-static void destroy_output(struct slurp_output *output) {
-	if (output == NULL) {
-		return;
-	}
-	wl_list_remove(&output->link);
-	finish_buffer(&output->buffers[0]);
-	finish_buffer(&output->buffers[1]);
-	if (output->cursor_theme) {
-		wl_cursor_theme_destroy(output->cursor_theme);
-	}
-	zwlr_layer_surface_v1_destroy(output->layer_surface);
-	if (output->xdg_output) {
-		zxdg_output_v1_destroy(output->xdg_output);
-	}
-	wl_surface_destroy(output->surface);
-	if (output->frame_callback) {
-		wl_callback_destroy(output->frame_callback);
+static void handle_signal(int fd, short revents, void *data) {
+	struct slurp_state *state = data;
+	struct signalfd_siginfo info;
+	if (read(fd, &info, sizeof(info)) < 0 && errno != EAGAIN) {
+		fprintf(stderr, "failed to read signalfd\n");
 	}
-	wl_output_destroy(output->wl_output);
-	free(output->logical_geometry.label);
-	free(output);
+	slurp_cancel(state);
 }
 
-static const struct wl_callback_listener output_frame_listener;
-
-static void send_frame(struct slurp_output *output) {
-	struct slurp_state *state = output->state;
+static void handle_input(int fd, short revents, void *data) {
+	struct slurp_state *state = data;
+	slurp_dispatch_input(state);
+}
 
-	if (!output->configured) {
+/**
+ * Write the counters of the run as JSON to the file given by SLURP_STATS, or
+ * to stderr if it is "-".
+ */
+static void write_stats(struct slurp_state *state) {
+	const char *path = getenv("SLURP_STATS");
+	if (path == NULL || path[0] == '\0') {
 		return;
 	}
-
-	int32_t buffer_width = output->width * output->scale;
-	int32_t buffer_height = output->height * output->scale;
-
-	output->current_buffer = get_next_buffer(state->shm, output->buffers,
-		buffer_width, buffer_height);
-	if (output->current_buffer == NULL) {
+	FILE *f = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open stats file %s\n", path);
 		return;
 	}
-	output->current_buffer->busy = true;
-
-	cairo_identity_matrix(output->current_buffer->cairo);
-	cairo_scale(output->current_buffer->cairo, output->scale, output->scale);
-	cairo_translate(output->current_buffer->cairo, -output->logical_geometry.x, -output->logical_geometry.y);
-
-	render(output);
-
-	// Schedule a frame in case the output becomes dirty again
-	if (output->frame_callback) {
-		wl_callback_destroy(output->frame_callback);
-	}
-	output->frame_callback = wl_surface_frame(output->surface);
-	wl_callback_add_listener(output->frame_callback,
-		&output_frame_listener, output);
-
-	wl_surface_attach(output->surface, output->current_buffer->buffer, 0, 0);
-	wl_surface_damage(output->surface, 0, 0, output->width, output->height);
-	wl_surface_set_buffer_scale(output->surface, output->scale);
-	wl_surface_commit(output->surface);
-	output->dirty = false;
-}
-
-static void output_frame_handle_done(void *data, struct wl_callback *callback,
-		uint32_t time) {
-	struct slurp_output *output = data;
-
-	wl_callback_destroy(callback);
-	output->frame_callback = NULL;
 
-	if (output->dirty) {
-		send_frame(output);
+	struct slurp_stats stats;
+	slurp_get_stats(state, &stats);
+	uint64_t quality_frames[SLURP_QUALITY_LEVELS];
+	slurp_get_quality_frames(state, quality_frames);
+	struct rusage usage;
+	long max_rss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+	fprintf(f, "{\"motion_events\":%" PRIu64 ",\"coalesced_motion_events\":%"
+		PRIu64 ",\"shm_allocated\":%" PRIu64 ",\"shm_mapped\":%" PRIu64
+		",\"buffer_resizes\":%" PRIu64 ",\"peak_rss\":%ld",
+		stats.motion_events, stats.coalesced_motion_events,
+		stats.shm_allocated, stats.shm_mapped, stats.buffer_resizes,
+		max_rss * 1024);
+	fprintf(f, ",\"quality_frames\":[");
+	for (size_t i = 0; i < SLURP_QUALITY_LEVELS; i++) {
+		fprintf(f, "%s%" PRIu64, i > 0 ? "," : "", quality_frames[i]);
+	}
+	fprintf(f, "],\"outputs\":[");
+	struct slurp_output_stats output_stats;
+	for (size_t i = 0; slurp_get_output_stats(state, i, &output_stats); i++) {
+		const struct slurp_box *output = slurp_get_output(state, i);
+		fprintf(f, "%s{\"name\":", i > 0 ? "," : "");
+		json_write_string(f, output->label);
+		double avg = output_stats.frames > 0 ?
+			output_stats.render_total / output_stats.frames : 0;
+		fprintf(f, ",\"frames\":%" PRIu64 ",\"dropped_frames\":%" PRIu64
+			",\"render_min\":%.3f,\"render_avg\":%.3f,\"render_max\":%.3f}",
+			output_stats.frames, output_stats.dropped_frames,
+			output_stats.render_min, avg, output_stats.render_max);
+	}
+	fprintf(f, "]}\n");
+	if (f != stderr) {
+		fclose(f);
 	}
 }
 
-static const struct wl_callback_listener output_frame_listener = {
-	.done = output_frame_handle_done,
-};
-
-static void set_output_dirty(struct slurp_output *output) {
-	output->dirty = true;
-	if (output->frame_callback) {
-		return;
+static int create_timer(double seconds) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0) {
+		return -1;
 	}
-
-	output->frame_callback = wl_surface_frame(output->surface);
-	wl_callback_add_listener(output->frame_callback,
-		&output_frame_listener, output);
-	wl_surface_commit(output->surface);
-}
-
-static struct slurp_output *output_from_surface(struct slurp_state *state,
-		struct wl_surface *surface) {
-	struct slurp_output *output;
-	wl_list_for_each(output, &state->outputs, link) {
-		if (output->surface == surface) {
-			return output;
-		}
+	struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = (time_t)seconds,
+			.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9),
+		},
+	};
+	if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+		close(fd);
+		return -1;
 	}
-	return NULL;
-}
-
-
-static void layer_surface_handle_configure(void *data,
-		struct zwlr_layer_surface_v1 *surface,
-		uint32_t serial, uint32_t width, uint32_t height) {
-	struct slurp_output *output = data;
-
-	output->configured = true;
-	output->width = width;
-	output->height = height;
-
-	zwlr_layer_surface_v1_ack_configure(surface, serial);
-	send_frame(output);
+	return fd;
 }
 
-static void layer_surface_handle_closed(void *data,
-		struct zwlr_layer_surface_v1 *surface) {
-	struct slurp_output *output = data;
-	destroy_output(output);
+static int create_signal_fd(void) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	// Deliver these through the event loop so the overlay is torn down
+	// cleanly instead of the process being killed
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+		return -1;
+	}
+	return signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
 }
 
-static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
-	.configure = layer_surface_handle_configure,
-	.closed = layer_surface_handle_closed,
-};
-
-
-static void handle_global(void *data, struct wl_registry *registry,
-		uint32_t name, const char *interface, uint32_t version) {
+static int dispatch_slurp(void *data) {
 	struct slurp_state *state = data;
-
-	if (strcmp(interface, wl_compositor_interface.name) == 0) {
-		state->compositor = wl_registry_bind(registry, name,
-			&wl_compositor_interface, 4);
-	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
-		state->shm = wl_registry_bind(registry, name,
-			&wl_shm_interface, 1);
-	} else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
-		state->layer_shell = wl_registry_bind(registry, name,
-			&zwlr_layer_shell_v1_interface, 1);
-	} else if (strcmp(interface, wl_seat_interface.name) == 0) {
-		struct wl_seat *wl_seat =
-			wl_registry_bind(registry, name, &wl_seat_interface, 1);
-		create_seat(state, wl_seat);
-	} else if (strcmp(interface, wl_output_interface.name) == 0) {
-		struct wl_output *wl_output =
-			wl_registry_bind(registry, name, &wl_output_interface, 3);
-		create_output(state, wl_output);
-	} else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
-		state->xdg_output_manager = wl_registry_bind(registry, name,
-			&zxdg_output_manager_v1_interface, 2);
-	} else if (strcmp(interface, wp_cursor_shape_manager_v1_interface.name) == 0) {
-		state->cursor_shape_manager = wl_registry_bind(registry, name,
-			&wp_cursor_shape_manager_v1_interface, 1);
-	}
-}
-
-static const struct wl_registry_listener registry_listener = {
-	.global = handle_global,
-	.global_remove = noop,
-};
-
-static const char usage[] =
-	"Usage: slurp [options...]\n"
-	"\n"
-	"  -h           Show help message and quit.\n"
-	"  -d           Display dimensions of selection.\n"
-	"  -b #rrggbbaa Set background color.\n"
-	"  -c #rrggbbaa Set border color.\n"
-	"  -s #rrggbbaa Set selection color.\n"
-	"  -B #rrggbbaa Set option box color.\n"
-	"  -F s         Set the font family for the dimensions.\n"
-	"  -w n         Set border weight.\n"
-	"  -f s         Set output format.\n"
-	"  -o           Select a display output.\n"
-	"  -p           Select a single point.\n"
-	"  -r           Restrict selection to predefined boxes.\n"
-	"  -a w:h       Force aspect ratio.\n"
-	"  -x           Display crosshairs across active display output.\n";
-
-uint32_t parse_color(const char *color) {
-	if (color[0] == '#') {
-		++color;
-	}
-
-	int len = strlen(color);
-	if (len != 6 && len != 8) {
-		fprintf(stderr, "Invalid color %s, "
-				"defaulting to color 0xFFFFFFFF\n", color);
-		return 0xFFFFFFFF;
-	}
-	uint32_t res = (uint32_t)strtoul(color, NULL, 16);
-	if (strlen(color) == 6) {
-		res = (res << 8) | 0xFF;
-	}
-	return res;
-}
-
-static struct slurp_output *output_from_box(const struct slurp_box *box, struct wl_list *outputs) {
-	struct slurp_output *output;
-	wl_list_for_each(output, outputs, link) {
-		struct slurp_box *geometry = &output->logical_geometry;
-		// For now just use the top-left corner
-		if (in_box(geometry, box->x, box->y)) {
-			return output;
-		}
-	}
-	return NULL;
+	return slurp_dispatch_pending(state);
 }
 
-static void print_output_name(FILE *stream, const struct slurp_box *result, struct wl_list *outputs) {
-	struct slurp_output *output = output_from_box(result, outputs);
-	if (output) {
-		struct slurp_box *geometry = &output->logical_geometry;
-		if (geometry->label) {
-			fprintf(stream, "%s", geometry->label);
-			return;
-		}
-	}
-	fprintf(stream, "<unknown>");
-}
-
-static void print_formatted_result(FILE *stream, struct slurp_state *state , const char *format) {
-	struct slurp_output *output = output_from_box(&state->result, &state->outputs);
-	for (size_t i = 0; format[i] != '\0'; i++) {
-		char c = format[i];
-		if (c == '%') {
-			char next = format[i + 1];
-
-			i++; // Skip the next character (x, y, w or h)
-			switch (next) {
-			case 'x':
-				fprintf(stream, "%d", state->result.x);
-				continue;
-			case 'y':
-				fprintf(stream, "%d", state->result.y);
-				continue;
-			case 'w':
-				fprintf(stream, "%d", state->result.width);
-				continue;
-			case 'h':
-				fprintf(stream, "%d", state->result.height);
-				continue;
-			case 'X':
-				assert(output);
-				fprintf(stream, "%d", state->result.x - output->logical_geometry.x);
-				continue;
-			case 'Y':
-				assert(output);
-				fprintf(stream, "%d", state->result.y - output->logical_geometry.y);
-				continue;
-			case 'W':
-				assert(output);
-				fprintf(stream, "%d", min(state->result.width, output->logical_geometry.x + output->logical_geometry.width - state->result.x));
-				continue;
-			case 'H':
-				assert(output);
-				fprintf(stream, "%d", min(state->result.height, output->logical_geometry.y + output->logical_geometry.height - state->result.y));
-				continue;
-			case 'l':
-				if (state->result.label) {
-					fprintf(stream, "%s", state->result.label);
-				}
-				continue;
-			case 'o':
-				print_output_name(stream, &state->result, &state->outputs);
-				continue;
-			default:
-				// If no case was executed, revert i back - we don't need to
-				// skip the next character.
-				i--;
-			}
-		}
-		fprintf(stream, "%c", c);
-	}
-}
-
-static void add_choice_box(struct slurp_state *state,
-		const struct slurp_box *box) {
-	struct slurp_box *b = calloc(1, sizeof(struct slurp_box));
-	if (b == NULL) {
-		fprintf(stderr, "allocation failed\n");
+/**
+ * Answer paste requests from a child process, like wl-copy, until another
+ * client sets the clipboard. Returns in the parent, which must leave the
+ * connection alone.
+ */
+static void serve_clipboard(struct slurp_state *state,
+		struct wl_display *display) {
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
 		return;
 	}
-	*b = *box;
-	// copy label, so that this has ownership of its label
-	if (box->label) {
-		b->label = strdup(box->label);
-	}
-	wl_list_insert(state->boxes.prev, &b->link);
-}
-
-static bool create_cursors(struct slurp_state *state) {
-	const char *cursor_theme = getenv("XCURSOR_THEME");
-	const char *cursor_size_str = getenv("XCURSOR_SIZE");
-	int cursor_size = 24;
-	if (cursor_size_str != NULL) {
-		char *end;
-		errno = 0;
-		cursor_size = strtol(cursor_size_str, &end, 10);
-		if (errno != 0 || cursor_size_str[0] == '\0' || end[0] != '\0') {
-			fprintf(stderr, "invalid XCURSOR_SIZE value\n");
-			return false;
-		}
+	if (pid > 0) {
+		return;
 	}
 
-	struct slurp_output *output;
-	wl_list_for_each(output, &state->outputs, link) {
-		output->cursor_theme = wl_cursor_theme_load(cursor_theme,
-			cursor_size * output->scale, state->shm);
-		if (output->cursor_theme == NULL) {
-			fprintf(stderr, "failed to load cursor theme\n");
-			return false;
-		}
-		struct wl_cursor *cursor =
-			wl_cursor_theme_get_cursor(output->cursor_theme, "crosshair");
-		if (cursor == NULL) {
-			// Fallback
-			cursor =
-				wl_cursor_theme_get_cursor(output->cursor_theme, "left_ptr");
-		}
-		if (cursor == NULL) {
-			fprintf(stderr, "failed to load cursor\n");
-			return false;
-		}
-		output->cursor_image = cursor->images[0];
+	// Don't keep a pipeline reading our output waiting, stderr included
+	// for $(slurp -y 2>&1)
+	int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+	if (null_fd >= 0) {
+		dup2(null_fd, STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		close(null_fd);
+	}
+	setsid();
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+	// Clients may close their end before the whole result is written
+	signal(SIGPIPE, SIG_IGN);
+
+	struct event_loop event_loop;
+	if (!event_loop_init(&event_loop, display)) {
+		_exit(EXIT_FAILURE);
+	}
+	event_loop_set_queue(&event_loop, dispatch_slurp, state);
+	while (slurp_is_offering(state) &&
+			event_loop_dispatch(&event_loop, -1) != -1) {
+		// This space intentionally left blank
 	}
-
-	return true;
+	event_loop_finish(&event_loop);
+	slurp_destroy(state);
+	wl_display_disconnect(display);
+	_exit(EXIT_SUCCESS);
 }
 
 int main(int argc, char *argv[]) {
 	int status = EXIT_SUCCESS;
 
-	struct slurp_state state = {
-		.colors = {
-			.background = BG_COLOR,
-			.border = BORDER_COLOR,
-			.selection = SELECTION_COLOR,
-			.choice = BG_COLOR,
-		},
-		.border_weight = 2,
-		.display_dimensions = false,
-		.restrict_selection = false,
-		.resizing_selection = false,
-		.fixed_aspect_ratio = false,
-		.aspect_ratio = 0,
-		.font_family = FONT_FAMILY
-	};
+	struct slurp_options options;
+	slurp_options_init(&options);
 
 	int opt;
-	char *format = "%x,%y %wx%h\n";
-	bool output_boxes = false;
+	char *format = NULL;
+	enum slurp_format_style format_style = SLURP_FORMAT_TEXT;
+	bool history_boxes = false;
+	bool query = false;
+	long history_index = 0;
+	enum {
+		WINDOW_BOXES_NONE,
+		WINDOW_BOXES_BORDERS,
+		WINDOW_BOXES_CONTENT,
+	} window_boxes = WINDOW_BOXES_NONE;
+	double timeout = 0;
+	const char *capture_path = NULL;
+	bool live_boxes = false;
+	bool stream_selection = false;
+	bool clipboard = false;
 	int w, h;
-	while ((opt = getopt(argc, argv, "hdb:c:s:B:w:proa:f:F:x")) != -1) {
+	while ((opt = getopt(argc, argv, "hdb:c:s:B:w:proa:f:F:xS:t:lm:zWIH:RqC:uPG:kEMJ0y")) != -1) {
 		switch (opt) {
 		case 'h':
 			printf("%s", usage);
 			return EXIT_SUCCESS;
 		case 'd':
-			state.display_dimensions = true;
+			options.display_dimensions = true;
 			break;
 		case 'b':
-			state.colors.background = parse_color(optarg);
+			options.background_color = parse_color(optarg);
 			break;
 		case 'c':
-			state.colors.border = parse_color(optarg);
+			options.border_color = parse_color(optarg);
 			break;
 		case 's':
-			state.colors.selection = parse_color(optarg);
+			options.selection_color = parse_color(optarg);
 			break;
 		case 'B':
-			state.colors.choice = parse_color(optarg);
+			options.choice_color = parse_color(optarg);
 			break;
 		case 'f':
 			format = optarg;
 			break;
+		case 'J':
+			format_style = SLURP_FORMAT_JSON;
+			break;
+		case '0':
+			format_style = SLURP_FORMAT_NUL;
+			break;
 		case 'F':
-			state.font_family = optarg;
+			options.font_family = optarg;
 			break;
 		case 'w': {
 			errno = 0;
 			char *endptr;
-			state.border_weight = strtol(optarg, &endptr, 10);
+			options.border_weight = strtol(optarg, &endptr, 10);
 			if (*endptr || errno) {
 				fprintf(stderr, "Error: expected numeric argument for -w\n");
 				exit(EXIT_FAILURE);
@@ -947,13 +712,13 @@ int main(int argc, char *argv[]) {
 			break;
 		}
 		case 'p':
-			state.single_point = true;
+			options.single_point = true;
 			break;
 		case 'o':
-			output_boxes = true;
+			options.output_boxes = true;
 			break;
 		case 'r':
-			state.restrict_selection = true;
+			options.restrict_selection = true;
 			break;
 		case 'a':
 			if (sscanf(optarg, "%d:%d", &w, &h) != 2) {
@@ -964,187 +729,390 @@ int main(int argc, char *argv[]) {
 				fprintf(stderr, "width and height of aspect ratio must be greater than zero\n");
 				return EXIT_FAILURE;
 			}
-			state.fixed_aspect_ratio = true;
-			state.aspect_ratio = (double) h / w;
+			options.aspect_ratio = (double) h / w;
 			break;
 		case 'x':
-			state.crosshairs = true;
+			options.crosshairs = true;
+			break;
+		case 'S': {
+			errno = 0;
+			char *endptr;
+			long threshold = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || threshold < 0 || threshold > INT32_MAX) {
+				fprintf(stderr, "Error: expected non-negative numeric argument for -S\n");
+				exit(EXIT_FAILURE);
+			}
+			options.snap_threshold = threshold;
+			break;
+		}
+		case 'l':
+			live_boxes = true;
+			break;
+		case 'z':
+			options.frozen = true;
+			break;
+		case 'P':
+			options.predict = true;
+			break;
+		case 'k':
+			options.filter_labels = true;
+			break;
+		case 'E':
+			options.content_snap = true;
+			break;
+		case 'M':
+			options.low_memory = true;
+			break;
+		case 'y':
+			clipboard = true;
 			break;
+		case 'W':
+			window_boxes = WINDOW_BOXES_BORDERS;
+			break;
+		case 'I':
+			window_boxes = WINDOW_BOXES_CONTENT;
+			break;
+		case 'H': {
+			errno = 0;
+			char *endptr;
+			history_index = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || history_index < 1 ||
+					history_index > HISTORY_SIZE) {
+				fprintf(stderr, "Error: expected a number between 1 and %d for -H\n",
+					HISTORY_SIZE);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'R':
+			history_boxes = true;
+			break;
+		case 'q':
+			query = true;
+			break;
+		case 'C':
+			capture_path = optarg;
+			break;
+		case 'u':
+			stream_selection = true;
+			break;
+		case 'm': {
+			errno = 0;
+			char *endptr;
+			options.magnifier_zoom = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || options.magnifier_zoom < 2 ||
+					options.magnifier_zoom > 16) {
+				fprintf(stderr, "Error: expected a zoom factor between 2 and 16 for -m\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 't': {
+			errno = 0;
+			char *endptr;
+			timeout = strtod(optarg, &endptr);
+			// Also rejects nan, and values the timer would round to 0,
+			// which disarms it
+			if (*endptr || errno || !(timeout >= 1e-9) ||
+					timeout > INT32_MAX) {
+				fprintf(stderr, "Error: expected positive numeric argument for -t\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'G': {
+			errno = 0;
+			char *endptr;
+			options.frame_budget = strtod(optarg, &endptr);
+			if (*endptr || errno || options.frame_budget <= 0) {
+				fprintf(stderr, "Error: expected positive numeric argument for -G\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
 		default:
 			printf("%s", usage);
 			return EXIT_FAILURE;
 		}
 	}
 
-	if (state.single_point && state.restrict_selection) {
+	if (options.single_point && options.restrict_selection) {
 		fprintf(stderr, "-p and -r cannot be used together\n");
 		return EXIT_FAILURE;
 	}
+	if (stream_selection && capture_path != NULL &&
+			strcmp(capture_path, "-") == 0) {
+		fprintf(stderr, "-u and -C - cannot be used together\n");
+		return EXIT_FAILURE;
+	}
 
-	if (!acquire_lock()) {
+	if (format == NULL) {
+		// Records are terminated by the NUL byte instead of a newline
+		format = format_style == SLURP_FORMAT_NUL ?
+			"%x,%y %wx%h" : "%x,%y %wx%h\n";
+	}
+	struct slurp_format *compiled = slurp_format_compile(format, format_style);
+	if (compiled == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	if (history_index > 0) {
+		// Replay without connecting to the compositor at all
+		struct history history;
+		if (!history_open(&history)) {
+			return EXIT_FAILURE;
+		}
+		struct history_entry entry;
+		bool found = history_get(&history, history_index, &entry);
+		history_close(&history);
+		if (!found) {
+			fprintf(stderr, "no selection %ld in history\n", history_index);
+			return EXIT_FAILURE;
+		}
+		struct slurp_box result, output;
+		history_entry_to_boxes(&entry, &result, &output);
+		if (output.width <= 0 && slurp_format_needs_output(compiled)) {
+			fprintf(stderr, "selection %ld in history has no output\n",
+				history_index);
+			slurp_format_destroy(compiled);
+			return EXIT_FAILURE;
+		}
+		slurp_format_append(compiled, &result,
+			output.width > 0 ? &output : NULL);
+		status = flush_records(compiled, true) ? EXIT_SUCCESS : EXIT_FAILURE;
+		slurp_format_destroy(compiled);
+		return status;
+	}
+
+	if (query) {
+		status = run_query(&options, compiled);
+		slurp_format_destroy(compiled);
+		return status;
+	}
+
+	int lock_fd = acquire_lock();
+	if (lock_fd < 0) {
 		// acquire_lock prints an appropriate error message itself
 		return EXIT_FAILURE;
 	}
 
-	wl_list_init(&state.boxes);
-	if (!isatty(STDIN_FILENO) && !state.single_point) {
+	if (options.single_point) {
+		live_boxes = false;
+	}
+
+	struct wl_display *display = wl_display_connect(NULL);
+	if (display == NULL) {
+		fprintf(stderr, "failed to create display\n");
+		return EXIT_FAILURE;
+	}
+
+	options.capture_result = capture_path != NULL;
+	options.clipboard = clipboard;
+	// Keep reading input while frames are rendered
+	options.input_thread = true;
+	struct slurp_state *state = slurp_create(display, &options);
+	if (state == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	struct box_array boxes = {0};
+	bool ok = true;
+	if (!isatty(STDIN_FILENO) && !options.single_point && !live_boxes) {
 		char *line = NULL;
 		size_t line_size = 0;
 		while (getline(&line, &line_size, stdin) >= 0) {
+			char *layer;
+			if (parse_layer(line, &layer)) {
+				ok = box_array_flush(&boxes, state) &&
+					slurp_set_layer(state, layer) && ok;
+				free(layer);
+				continue;
+			}
 			struct slurp_box in_box = {0};
-			if (sscanf(line, "%d,%d %dx%d %m[^\n]", &in_box.x, &in_box.y,
-					&in_box.width, &in_box.height, &in_box.label) < 4) {
+			if (!parse_box(line, &in_box)) {
 				fprintf(stderr, "invalid box format: %s\n", line);
 				return EXIT_FAILURE;
 			}
-			add_choice_box(&state, &in_box);
+			box_array_add(&boxes, &in_box);
 			free(in_box.label);
 		}
 		free(line);
+		ok = box_array_flush(&boxes, state) && ok;
+	}
+	// Other boxes go to the default layer
+	if (history_boxes && !options.single_point) {
+		struct history history;
+		if (history_open(&history)) {
+			struct history_entry entry;
+			for (size_t i = 1; history_get(&history, i, &entry); i++) {
+				struct slurp_box box, output;
+				history_entry_to_boxes(&entry, &box, &output);
+				box_array_add(&boxes, &box);
+			}
+			history_close(&history);
+		}
 	}
-	wl_list_init(&state.outputs);
-	wl_list_init(&state.seats);
-
-	state.display = wl_display_connect(NULL);
-	if (state.display == NULL) {
-		fprintf(stderr, "failed to create display\n");
+	if (window_boxes != WINDOW_BOXES_NONE && !options.single_point &&
+			!sway_ipc_get_windows(window_boxes == WINDOW_BOXES_BORDERS,
+				handle_window, &boxes)) {
 		return EXIT_FAILURE;
 	}
-
-	if ((state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS)) == NULL) {
-		fprintf(stderr, "xkb_context_new failed\n");
-		return EXIT_FAILURE;
+	if (boxes.len > 0) {
+		ok = slurp_set_layer(state, NULL) &&
+			box_array_flush(&boxes, state) && ok;
 	}
-
-	state.registry = wl_display_get_registry(state.display);
-	wl_registry_add_listener(state.registry, &registry_listener, &state);
-	wl_display_roundtrip(state.display);
-
-	if (state.compositor == NULL) {
-		fprintf(stderr, "compositor doesn't support wl_compositor\n");
+	box_array_finish(&boxes);
+	if (!ok || !slurp_start(state)) {
 		return EXIT_FAILURE;
 	}
-	if (state.shm == NULL) {
-		fprintf(stderr, "compositor doesn't support wl_shm\n");
+
+	struct event_loop event_loop;
+	if (!event_loop_init(&event_loop, display)) {
+		fprintf(stderr, "allocation failed\n");
 		return EXIT_FAILURE;
 	}
-	if (state.layer_shell == NULL) {
-		fprintf(stderr, "compositor doesn't support zwlr_layer_shell_v1\n");
+	event_loop_set_queue(&event_loop, dispatch_slurp, state);
+
+	int signal_fd = create_signal_fd();
+	if (signal_fd < 0) {
+		fprintf(stderr, "failed to create signalfd\n");
 		return EXIT_FAILURE;
 	}
-	if (state.xdg_output_manager == NULL) {
-		fprintf(stderr, "compositor doesn't support xdg-output. "
-			"Guessing geometry from physical output size.\n");
-	}
-	if (wl_list_empty(&state.outputs)) {
-		fprintf(stderr, "no wl_output\n");
+	if (!event_loop_add_fd(&event_loop, signal_fd, POLLIN,
+				handle_signal, state) ||
+			!event_loop_add_fd(&event_loop, slurp_get_input_fd(state), POLLIN,
+				handle_input, state)) {
+		fprintf(stderr, "allocation failed\n");
 		return EXIT_FAILURE;
 	}
 
-	struct slurp_output *output;
-	wl_list_for_each(output, &state.outputs, link) {
-		output->surface = wl_compositor_create_surface(state.compositor);
-		// TODO: wl_surface_add_listener(output->surface, &surface_listener, output);
-
-		output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-			state.layer_shell, output->surface, output->wl_output,
-			ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "selection");
-		zwlr_layer_surface_v1_add_listener(output->layer_surface,
-		  &layer_surface_listener, output);
-
-		if (state.xdg_output_manager) {
-			output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
-				state.xdg_output_manager, output->wl_output);
-			zxdg_output_v1_add_listener(output->xdg_output,
-				&xdg_output_listener, output);
-		} else {
-			// guess
-			output->logical_geometry = output->geometry;
-			output->logical_geometry.width /= output->scale;
-			output->logical_geometry.height /= output->scale;
+	int timer_fd = -1;
+	if (timeout > 0) {
+		timer_fd = create_timer(timeout);
+		if (timer_fd < 0) {
+			fprintf(stderr, "failed to create timerfd\n");
+			return EXIT_FAILURE;
+		}
+		if (!event_loop_add_fd(&event_loop, timer_fd, POLLIN,
+				handle_timeout, state)) {
+			fprintf(stderr, "allocation failed\n");
+			return EXIT_FAILURE;
 		}
-
-		zwlr_layer_surface_v1_set_anchor(output->layer_surface,
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM);
-		zwlr_layer_surface_v1_set_keyboard_interactivity(output->layer_surface, true);
-		zwlr_layer_surface_v1_set_exclusive_zone(output->layer_surface, -1);
-		wl_surface_commit(output->surface);
 	}
-	// second roundtrip for xdg-output
-	wl_display_roundtrip(state.display);
 
-	if (!state.cursor_shape_manager && !create_cursors(&state)) {
-		return EXIT_FAILURE;
+	struct live_boxes live = {
+		.state = state,
+		.event_loop = &event_loop,
+	};
+	if (live_boxes) {
+		// Left blocking: the file description is shared with the shell, and
+		// it's only read once poll reports it readable
+		if (!event_loop_add_fd(&event_loop, STDIN_FILENO, POLLIN,
+				handle_live_boxes, &live)) {
+			fprintf(stderr, "failed to watch standard input\n");
+			return EXIT_FAILURE;
+		}
 	}
 
-	if (output_boxes) {
-		struct slurp_output *box_output;
-		wl_list_for_each(box_output, &state.outputs, link) {
-			add_choice_box(&state, &box_output->logical_geometry);
+	struct selection_stream selection_stream = {
+		.state = state,
+		.event_loop = &event_loop,
+		.format = compiled,
+	};
+	if (stream_selection) {
+		selection_stream.flags = fcntl(STDOUT_FILENO, F_GETFL);
+		if (selection_stream.flags < 0 || fcntl(STDOUT_FILENO, F_SETFL,
+				selection_stream.flags | O_NONBLOCK) < 0) {
+			fprintf(stderr, "failed to make standard output non-blocking\n");
+			return EXIT_FAILURE;
 		}
+		slurp_set_selection_handler(state, handle_selection, &selection_stream);
 	}
 
-	struct slurp_seat *seat;
-	wl_list_for_each(seat, &state.seats, link) {
-		seat->cursor_surface =
-			wl_compositor_create_surface(state.compositor);
+	while (slurp_is_running(state) &&
+			event_loop_dispatch(&event_loop, -1) != -1) {
+		// This space intentionally left blank
 	}
 
-	state.running = true;
-	while (state.running && wl_display_dispatch(state.display) != -1) {
-		// This space intentionally left blank
+	if (stream_selection) {
+		slurp_set_selection_handler(state, NULL, NULL);
+		selection_stream_finish(&selection_stream);
+	}
+	event_loop_finish(&event_loop);
+	if (timer_fd >= 0) {
+		close(timer_fd);
 	}
+	close(signal_fd);
+	free(live.buffer);
 
-	char *result_str = 0;
-	size_t length;
-	if (state.result.width == 0 && state.result.height == 0) {
-		fprintf(stderr, "selection cancelled\n");
+	// Kept in the format buffer until the overlay is gone
+	bool print_result = false;
+	const struct slurp_box *result = slurp_get_result(state);
+	if (result == NULL) {
+		if (!slurp_has_failed(state)) {
+			fprintf(stderr, "selection cancelled\n");
+		}
 		status = EXIT_FAILURE;
 	} else {
-		FILE *stream = open_memstream(&result_str, &length);
-		print_formatted_result(stream, &state, format);
-		fclose(stream);
+		const struct slurp_box *output = slurp_find_output(state, result);
+		if (stream_selection) {
+			slurp_format_append_final(compiled, result, output);
+		} else {
+			slurp_format_append(compiled, result, output);
+		}
+		print_result = true;
+		save_history(result, output);
 	}
 
-	struct slurp_output *output_tmp;
-	wl_list_for_each_safe(output, output_tmp, &state.outputs, link) {
-		destroy_output(output);
-	}
-	struct slurp_seat *seat_tmp;
-	wl_list_for_each_safe(seat, seat_tmp, &state.seats, link) {
-		destroy_seat(seat);
+	bool offering = false;
+	if (clipboard && result != NULL) {
+		// Set while the overlay still has the focus, captures come after
+		size_t len;
+		const char *data = slurp_format_data(compiled, &len);
+		if (format_style == SLURP_FORMAT_NUL && len > 0) {
+			len--;
+		}
+		offering = slurp_offer_clipboard(state, data, len);
+		if (!offering) {
+			status = EXIT_FAILURE;
+		}
 	}
 
-	// Make sure the compositor has unmapped our surfaces by the time we exit
-	wl_display_roundtrip(state.display);
-
-	zwlr_layer_shell_v1_destroy(state.layer_shell);
-	if (state.xdg_output_manager != NULL) {
-		zxdg_output_manager_v1_destroy(state.xdg_output_manager);
-	}
-	if (state.cursor_shape_manager != NULL) {
-		wp_cursor_shape_manager_v1_destroy(state.cursor_shape_manager);
+	if (capture_path != NULL && result != NULL) {
+		// Reuse this connection instead of leaving the capture to grim
+		if (!slurp_save_result_image(state, capture_path)) {
+			status = EXIT_FAILURE;
+		}
+		if (strcmp(capture_path, "-") == 0) {
+			// stdout carries the image
+			print_result = false;
+		}
 	}
-	wl_compositor_destroy(state.compositor);
-	wl_shm_destroy(state.shm);
-	wl_registry_destroy(state.registry);
-	xkb_context_unref(state.xkb_context);
-	wl_display_disconnect(state.display);
 
-	struct slurp_box *box, *box_tmp;
-	wl_list_for_each_safe(box, box_tmp, &state.boxes, link) {
-		wl_list_remove(&box->link);
-		free(box->label);
-		free(box);
+	write_stats(state);
+	if (!offering) {
+		// Unmaps the overlay before we print anything
+		slurp_destroy(state);
+		wl_display_disconnect(display);
 	}
 
-	if (result_str) {
-		printf("%s", result_str);
-		free(result_str);
+	if (print_result) {
+		// Tell the final result apart from the streamed ones, JSON records
+		// mark it themselves
+		if (stream_selection && format_style != SLURP_FORMAT_JSON &&
+				write(STDOUT_FILENO, "=", 1) != 1) {
+			status = EXIT_FAILURE;
+		}
+		if (!flush_records(compiled, true)) {
+			status = EXIT_FAILURE;
+		}
 	}
+	slurp_format_destroy(compiled);
 
+	if (offering) {
+		// Another slurp can start while the clipboard is served
+		close(lock_fd);
+		serve_clipboard(state, display);
+	}
 	return status;
 }
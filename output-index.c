@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "output-index.h"
+#include "slurp.h"
+
+struct axis_edge {
+	int32_t value;
+	size_t output;
+};
+
+static int compare_axis_edges(const void *a, const void *b) {
+	int32_t ea = ((const struct axis_edge *)a)->value;
+	int32_t eb = ((const struct axis_edge *)b)->value;
+	return (ea > eb) - (ea < eb);
+}
+
+static void axis_build(struct output_index_axis *axis,
+		struct axis_edge *starts, struct axis_edge *ends, size_t len) {
+	qsort(starts, len, sizeof(struct axis_edge), compare_axis_edges);
+	qsort(ends, len, sizeof(struct axis_edge), compare_axis_edges);
+
+	axis->starts_before[0] = 0;
+	for (size_t i = 0; i < len; i++) {
+		axis->starts[i] = starts[i].value;
+		axis->starts_before[i + 1] =
+			axis->starts_before[i] | (UINT64_C(1) << starts[i].output);
+	}
+	axis->ends_from[len] = 0;
+	for (size_t i = len; i-- > 0;) {
+		axis->ends[i] = ends[i].value;
+		axis->ends_from[i] =
+			axis->ends_from[i + 1] | (UINT64_C(1) << ends[i].output);
+	}
+}
+
+void output_index_build(struct output_index *index, struct wl_list *outputs) {
+	index->len = 0;
+	index->valid = wl_list_length(outputs) <= OUTPUT_INDEX_MAX;
+	if (!index->valid) {
+		return;
+	}
+
+	struct axis_edge x_starts[OUTPUT_INDEX_MAX], x_ends[OUTPUT_INDEX_MAX];
+	struct axis_edge y_starts[OUTPUT_INDEX_MAX], y_ends[OUTPUT_INDEX_MAX];
+	struct slurp_output *output;
+	wl_list_for_each(output, outputs, link) {
+		size_t i = index->len++;
+		const struct slurp_box *geometry = &output->logical_geometry;
+		index->outputs[i] = output;
+		x_starts[i] = (struct axis_edge){ geometry->x, i };
+		x_ends[i] = (struct axis_edge){ geometry->x + geometry->width, i };
+		y_starts[i] = (struct axis_edge){ geometry->y, i };
+		y_ends[i] = (struct axis_edge){ geometry->y + geometry->height, i };
+	}
+	axis_build(&index->x, x_starts, x_ends, index->len);
+	axis_build(&index->y, y_starts, y_ends, index->len);
+}
+
+// Number of values below bound
+static size_t count_below(const int32_t *values, size_t len, int32_t bound) {
+	size_t lo = 0, hi = len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (values[mid] < bound) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Outputs overlapping [start, start + size) on this axis, with the same
+// semantics as slurp_box_intersect
+static uint64_t axis_query(const struct output_index_axis *axis, size_t len,
+		int32_t start, int32_t size) {
+	uint64_t starts = axis->starts_before[count_below(axis->starts, len,
+		start + size)];
+	uint64_t ends = axis->ends_from[count_below(axis->ends, len, start + 1)];
+	return starts & ends;
+}
+
+uint64_t output_index_query(const struct output_index *index,
+		const struct slurp_box *box) {
+	return axis_query(&index->x, index->len, box->x, box->width) &
+		axis_query(&index->y, index->len, box->y, box->height);
+}
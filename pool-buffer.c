@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include "pool-buffer.h"
+#include "trace.h"
 
 static void randname(char *buf) {
 	struct timespec ts;
@@ -40,7 +41,7 @@ static int anonymous_shm_open(void) {
 	return -1;
 }
 
-static int create_shm_file(off_t size) {
+int create_shm_file(off_t size) {
 	int fd = anonymous_shm_open();
 	if (fd < 0) {
 		return fd;
@@ -63,10 +64,21 @@ static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_handle_release,
 };
 
+static cairo_format_t cairo_format_from_shm(uint32_t format) {
+	switch (format) {
+	case WL_SHM_FORMAT_XRGB8888:
+		return CAIRO_FORMAT_RGB24;
+	case WL_SHM_FORMAT_RGB565:
+		return CAIRO_FORMAT_RGB16_565;
+	default:
+		return CAIRO_FORMAT_ARGB32;
+	}
+}
+
 static struct pool_buffer *create_buffer(struct wl_shm *shm,
-		struct pool_buffer *buf, int32_t width, int32_t height) {
-	const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
-	const cairo_format_t cairo_fmt = CAIRO_FORMAT_ARGB32;
+		struct shm_stats *stats, struct pool_buffer *buf,
+		int32_t width, int32_t height, uint32_t wl_fmt) {
+	const cairo_format_t cairo_fmt = cairo_format_from_shm(wl_fmt);
 
 	uint32_t stride = cairo_format_stride_for_width(cairo_fmt, width);
 	size_t size = stride * height;
@@ -83,6 +95,7 @@ static struct pool_buffer *create_buffer(struct wl_shm *shm,
 			close(fd);
 			return NULL;
 		}
+		shm_stats_map(stats, size);
 
 		struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
 		buf->buffer =
@@ -93,10 +106,12 @@ static struct pool_buffer *create_buffer(struct wl_shm *shm,
 		close(fd);
 	}
 
+	buf->stats = stats;
 	buf->data = data;
 	buf->size = size;
 	buf->width = width;
 	buf->height = height;
+	buf->format = wl_fmt;
 	buf->surface = cairo_image_surface_create_for_data(data, cairo_fmt, width,
 		height, stride);
 	buf->cairo = cairo_create(buf->surface);
@@ -115,12 +130,14 @@ void finish_buffer(struct pool_buffer *buffer) {
 	}
 	if (buffer->data) {
 		munmap(buffer->data, buffer->size);
+		shm_stats_unmap(buffer->stats, buffer->size);
 	}
 	memset(buffer, 0, sizeof(struct pool_buffer));
 }
 
 struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], uint32_t width, uint32_t height) {
+		struct shm_stats *stats, struct pool_buffer pool[static 2],
+		uint32_t width, uint32_t height, uint32_t format) {
 	struct pool_buffer *buffer = NULL;
 	for (size_t i = 0; i < 2; ++i) {
 		if (pool[i].busy) {
@@ -132,12 +149,21 @@ struct pool_buffer *get_next_buffer(struct wl_shm *shm,
 		return NULL;
 	}
 
-	if (buffer->width != width || buffer->height != height) {
+	if (buffer->width != width || buffer->height != height ||
+			buffer->format != format) {
+		if (buffer->buffer && (buffer->width != width ||
+				buffer->height != height)) {
+			stats->resizes++;
+		}
 		finish_buffer(buffer);
 	}
 
 	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height)) {
+		trace_begin("create_buffer");
+		struct pool_buffer *created =
+			create_buffer(shm, stats, buffer, width, height, format);
+		trace_end("create_buffer");
+		if (!created) {
 			return NULL;
 		}
 	}
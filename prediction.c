@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "prediction.h"
+#include "trace.h"
+
+// Past this delay without motion, the pointer is considered still
+#define PREDICTION_MAX_AGE 50.0
+#define PREDICTION_MAX_HORIZON 50.0
+// Limits the overshoot when the pointer stops or turns around
+#define PREDICTION_MAX_DISTANCE 64.0
+
+double motion_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void motion_start(struct slurp_motion *motion) {
+	memset(motion, 0, sizeof(struct slurp_motion));
+	motion->active = true;
+}
+
+void motion_stop(struct slurp_motion *motion) {
+	memset(motion, 0, sizeof(struct slurp_motion));
+}
+
+void motion_record(struct slurp_motion *motion, int32_t x, int32_t y,
+		uint32_t time) {
+	if (!motion->active) {
+		return;
+	}
+
+	if (motion->drawn) {
+		trace_counter("selection_lag",
+			hypot(x - motion->drawn_x, y - motion->drawn_y));
+		trace_counter("predicted_selection_lag",
+			hypot(x - motion->predicted_x, y - motion->predicted_y));
+		motion->drawn = false;
+	}
+
+	if (motion->has_time) {
+		// Timestamps wrap around, the difference doesn't
+		uint32_t dt = time - motion->time;
+		if (dt == 0) {
+			// Keep the previous sample, the next one gets a longer interval
+			return;
+		}
+		if (dt > PREDICTION_MAX_AGE) {
+			motion->has_velocity = false;
+		} else {
+			double velocity_x = (x - motion->x) / (double)dt;
+			double velocity_y = (y - motion->y) / (double)dt;
+			if (motion->has_velocity) {
+				// Smooth out the jitter of high rate devices
+				velocity_x = (motion->velocity_x + velocity_x) / 2;
+				velocity_y = (motion->velocity_y + velocity_y) / 2;
+			}
+			motion->velocity_x = velocity_x;
+			motion->velocity_y = velocity_y;
+			motion->has_velocity = true;
+		}
+	}
+
+	motion->x = x;
+	motion->y = y;
+	motion->time = time;
+	motion->received = motion_now();
+	motion->has_time = true;
+}
+
+static double clamp(double value, double limit) {
+	return value < -limit ? -limit : (value > limit ? limit : value);
+}
+
+bool motion_predict(const struct slurp_motion *motion, double now,
+		double frame_period, int32_t *x, int32_t *y) {
+	double age = now - motion->received;
+	if (!motion->active || !motion->has_velocity || age > PREDICTION_MAX_AGE) {
+		return false;
+	}
+
+	// A frame drawn now is presented at the next refresh at the latest
+	double horizon = age + frame_period;
+	if (horizon > PREDICTION_MAX_HORIZON) {
+		horizon = PREDICTION_MAX_HORIZON;
+	}
+	*x += lround(clamp(motion->velocity_x * horizon, PREDICTION_MAX_DISTANCE));
+	*y += lround(clamp(motion->velocity_y * horizon, PREDICTION_MAX_DISTANCE));
+	return true;
+}
@@ -19,6 +19,269 @@ static void draw_rect(cairo_t *cairo, struct slurp_box *box, uint32_t color) {
 			box->width, box->height);
 }
 
+static bool is_frozen(struct slurp_output *output) {
+	return output->state->frozen && output->capture.surface != NULL;
+}
+
+/**
+ * Use surface, the capture of output or its tinted copy, as the source, in
+ * logical coordinates.
+ */
+static void set_source_capture(cairo_t *cairo, struct slurp_output *output,
+		cairo_surface_t *surface) {
+	const struct capture *capture = &output->capture;
+	const struct slurp_box *geometry = &output->logical_geometry;
+	cairo_pattern_t *pattern = cairo_pattern_create_for_surface(surface);
+	cairo_matrix_t matrix;
+	cairo_matrix_init_scale(&matrix, (double)capture->width / geometry->width,
+		(double)capture->height / geometry->height);
+	cairo_matrix_translate(&matrix, -geometry->x, -geometry->y);
+	cairo_pattern_set_matrix(pattern, &matrix);
+	cairo_pattern_set_filter(pattern, CAIRO_FILTER_FAST);
+	cairo_set_source(cairo, pattern);
+	cairo_pattern_destroy(pattern);
+}
+
+/**
+ * Fill the current path with color. The live overlay replaces the background
+ * there, so the screen shows through: a frozen capture is painted again
+ * first.
+ */
+static void fill_cut_through(cairo_t *cairo, struct slurp_output *output,
+		uint32_t color) {
+	if (is_frozen(output)) {
+		cairo_save(cairo);
+		cairo_clip_preserve(cairo);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+		set_source_capture(cairo, output, output->capture.surface);
+		cairo_paint(cairo);
+		cairo_restore(cairo);
+	}
+	set_source_u32(cairo, color);
+	cairo_fill(cairo);
+}
+
+void destroy_choice_rasters(struct slurp_box_layer *layer,
+		struct slurp_output *output) {
+	struct choice_raster *raster, *raster_tmp;
+	wl_list_for_each_safe(raster, raster_tmp, &layer->rasters, link) {
+		if (output != NULL && raster->output != output) {
+			continue;
+		}
+		if (raster->mask != NULL) {
+			cairo_surface_destroy(raster->mask);
+		}
+		wl_list_remove(&raster->link);
+		free(raster);
+	}
+}
+
+static bool raster_matches(const struct choice_raster *raster,
+		const struct slurp_output *output) {
+	const struct slurp_box *geometry = &output->logical_geometry;
+	return raster->scale == output->scale &&
+		raster->geometry.x == geometry->x &&
+		raster->geometry.y == geometry->y &&
+		raster->geometry.width == geometry->width &&
+		raster->geometry.height == geometry->height;
+}
+
+/**
+ * Draw the choice boxes of layer intersecting output into an A8 mask with the
+ * size of the output buffers.
+ */
+static bool draw_choice_raster(struct choice_raster *raster,
+		struct slurp_box_layer *layer, struct slurp_output *output) {
+	const struct slurp_box *geometry = &output->logical_geometry;
+	raster->geometry = *geometry;
+	raster->geometry.label = NULL;
+	raster->scale = output->scale;
+	raster->mask = NULL;
+
+	bool empty = true;
+	struct slurp_box *choice_box;
+	wl_list_for_each(choice_box, &layer->boxes, link) {
+		if (slurp_box_intersect(geometry, choice_box)) {
+			empty = false;
+			break;
+		}
+	}
+	if (empty) {
+		return true;
+	}
+
+	cairo_surface_t *mask = cairo_image_surface_create(CAIRO_FORMAT_A8,
+		output->width * output->scale, output->height * output->scale);
+	if (cairo_surface_status(mask) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(mask);
+		return false;
+	}
+	cairo_t *cairo = cairo_create(mask);
+	cairo_scale(cairo, output->scale, output->scale);
+	cairo_translate(cairo, -geometry->x, -geometry->y);
+	// Overlapping boxes have the same winding, their union is filled once
+	wl_list_for_each(choice_box, &layer->boxes, link) {
+		if (slurp_box_intersect(geometry, choice_box)) {
+			cairo_rectangle(cairo, choice_box->x, choice_box->y,
+				choice_box->width, choice_box->height);
+		}
+	}
+	cairo_fill(cairo);
+	cairo_destroy(cairo);
+	raster->mask = mask;
+	return true;
+}
+
+static void add_choice_rectangle(struct slurp_box *box, void *data) {
+	cairo_t *cairo = data;
+	cairo_rectangle(cairo, box->x, box->y, box->width, box->height);
+}
+
+void update_choice_rasters(struct slurp_box_layer *layer,
+		const struct slurp_box *box) {
+	struct choice_raster *raster, *raster_tmp;
+	wl_list_for_each_safe(raster, raster_tmp, &layer->rasters, link) {
+		const struct slurp_box *geometry = &raster->geometry;
+		if (!slurp_box_intersect(geometry, box)) {
+			continue;
+		}
+		if (raster->mask == NULL) {
+			// The first box on the output, drawn again on the next frame
+			wl_list_remove(&raster->link);
+			free(raster);
+			continue;
+		}
+
+		cairo_t *cairo = cairo_create(raster->mask);
+		cairo_scale(cairo, raster->scale, raster->scale);
+		cairo_translate(cairo, -geometry->x, -geometry->y);
+		cairo_rectangle(cairo, box->x, box->y, box->width, box->height);
+		cairo_clip(cairo);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cairo);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+		// Only the boxes overlapping the area, found through the hit index
+		if (layer->hit_index.valid) {
+			hit_index_for_each(&layer->hit_index, box, add_choice_rectangle,
+				cairo);
+		} else {
+			struct slurp_box *choice_box;
+			wl_list_for_each(choice_box, &layer->boxes, link) {
+				if (slurp_box_intersect(box, choice_box)) {
+					add_choice_rectangle(choice_box, cairo);
+				}
+			}
+		}
+		cairo_fill(cairo);
+		cairo_destroy(cairo);
+	}
+}
+
+static struct choice_raster *get_choice_raster(struct slurp_box_layer *layer,
+		struct slurp_output *output) {
+	struct choice_raster *raster;
+	wl_list_for_each(raster, &layer->rasters, link) {
+		if (raster->output != output) {
+			continue;
+		}
+		if (raster_matches(raster, output)) {
+			return raster;
+		}
+		// The output was reconfigured
+		if (raster->mask != NULL) {
+			cairo_surface_destroy(raster->mask);
+		}
+		if (!draw_choice_raster(raster, layer, output)) {
+			wl_list_remove(&raster->link);
+			free(raster);
+			return NULL;
+		}
+		return raster;
+	}
+
+	raster = calloc(1, sizeof(struct choice_raster));
+	if (raster == NULL) {
+		return NULL;
+	}
+	raster->output = output;
+	if (!draw_choice_raster(raster, layer, output)) {
+		free(raster);
+		return NULL;
+	}
+	wl_list_insert(&layer->rasters, &raster->link);
+	return raster;
+}
+
+/**
+ * Draw the boxes left by the label filter, and outline the one selected by
+ * Enter.
+ */
+static void draw_filtered_boxes(cairo_t *cairo, struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	const struct box_filter *filter = &state->filter;
+	const struct label_index *index = &filter->layer->label_index;
+	for (size_t i = 0; i < filter->matches_len; i++) {
+		struct slurp_box *box = index->boxes[filter->matches[i]];
+		// Removed since the filter was last updated
+		if (box != NULL &&
+				slurp_box_intersect(&output->logical_geometry, box)) {
+			draw_rect(cairo, box, state->colors.choice);
+			fill_cut_through(cairo, output, state->colors.choice);
+		}
+	}
+
+	if (filter->best != NULL &&
+			slurp_box_intersect(&output->logical_geometry, filter->best)) {
+		cairo_set_line_width(cairo, state->border_weight);
+		draw_rect(cairo, filter->best, state->colors.border);
+		cairo_stroke(cairo);
+	}
+}
+
+static void draw_choice_boxes(cairo_t *cairo, struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	if (state->filter.active) {
+		draw_filtered_boxes(cairo, output);
+		return;
+	}
+
+	// Use the raster of the active layer, unless it can't be allocated
+	struct choice_raster *raster = get_choice_raster(state->layer, output);
+	if (raster == NULL) {
+		struct slurp_box *choice_box;
+		wl_list_for_each(choice_box, &state->layer->boxes, link) {
+			if (slurp_box_intersect(&output->logical_geometry,
+						choice_box)) {
+				draw_rect(cairo, choice_box, state->colors.choice);
+				fill_cut_through(cairo, output, state->colors.choice);
+			}
+		}
+		return;
+	}
+	if (raster->mask == NULL) {
+		return;
+	}
+
+	// The raster has the full resolution of the output
+	double scale = output->render_scale / output->scale;
+	if (is_frozen(output)) {
+		// See fill_cut_through
+		cairo_save(cairo);
+		set_source_capture(cairo, output, output->capture.surface);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+		cairo_identity_matrix(cairo);
+		cairo_scale(cairo, scale, scale);
+		cairo_mask_surface(cairo, raster->mask, 0, 0);
+		cairo_restore(cairo);
+	}
+	set_source_u32(cairo, state->colors.choice);
+	cairo_save(cairo);
+	cairo_identity_matrix(cairo);
+	cairo_scale(cairo, scale, scale);
+	cairo_mask_surface(cairo, raster->mask, 0, 0);
+	cairo_restore(cairo);
+}
+
 void render(struct slurp_output *output) {
 	struct slurp_state *state = output->state;
 	struct pool_buffer *buffer = output->current_buffer;
@@ -26,17 +289,26 @@ void render(struct slurp_output *output) {
 
 	// Clear
 	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-	set_source_u32(cairo, state->colors.background);
-	cairo_paint(cairo);
-
-	// Draw option boxes from input
-	struct slurp_box *choice_box;
-	wl_list_for_each(choice_box, &state->boxes, link) {
-		if (box_intersect(&output->logical_geometry,
-					choice_box)) {
-			draw_rect(cairo, choice_box, state->colors.choice);
-			cairo_fill(cairo);
+	if (is_frozen(output) && output->capture.tinted != NULL) {
+		// Tinted once by slurp_start
+		set_source_capture(cairo, output, output->capture.tinted);
+		cairo_paint(cairo);
+	} else {
+		if (is_frozen(output)) {
+			set_source_capture(cairo, output, output->capture.surface);
+			cairo_paint(cairo);
+			// The background color tints the capture, the buffer is opaque
+			// and can't let anything through
+			cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
 		}
+		set_source_u32(cairo, state->colors.background);
+		cairo_paint(cairo);
+	}
+
+	// Draw option boxes from input, unless dropped to keep up with the
+	// pointer
+	if (output->quality < SLURP_QUALITY_NO_CHOICE_BOXES) {
+		draw_choice_boxes(cairo, output);
 	}
 
 	struct slurp_seat *seat;
@@ -46,7 +318,7 @@ void render(struct slurp_output *output) {
 
 		if (!current_selection->has_selection && state->crosshairs) {
 			struct slurp_box *output_box = &output->logical_geometry;
-			if (in_box(output_box, current_selection->x, current_selection->y)) {
+			if (slurp_box_contains(output_box, current_selection->x, current_selection->y)) {
 
 				set_source_u32(cairo, state->colors.border);
 				cairo_rectangle(cairo, output_box->x, current_selection->y, output->logical_geometry.width, 1);
@@ -60,21 +332,23 @@ void render(struct slurp_output *output) {
 			continue;
 		}
 
-		if (!box_intersect(&output->logical_geometry,
-			&current_selection->selection)) {
+		// The predicted selection is only drawn, see send_frame
+		struct slurp_box *sel_box = current_selection->has_prediction ?
+			&current_selection->predicted : &current_selection->selection;
+		if (!slurp_box_intersect(&output->logical_geometry, sel_box)) {
 			continue;
 		}
-		struct slurp_box *sel_box = &current_selection->selection;
 
 		draw_rect(cairo, sel_box, state->colors.selection);
-		cairo_fill(cairo);
+		fill_cut_through(cairo, output, state->colors.selection);
 
 		// Draw border
 		cairo_set_line_width(cairo, state->border_weight);
 		draw_rect(cairo, sel_box, state->colors.border);
 		cairo_stroke(cairo);
 
-		if (state->display_dimensions) {
+		if (state->display_dimensions &&
+				output->quality < SLURP_QUALITY_NO_DIMENSIONS) {
 			cairo_select_font_face(cairo, state->font_family,
 					       CAIRO_FONT_SLANT_NORMAL,
 					       CAIRO_FONT_WEIGHT_NORMAL);
@@ -83,7 +357,8 @@ void render(struct slurp_output *output) {
 			// buffer of 12 can hold selections up to 99999x99999
 			char dimensions[12];
 			snprintf(dimensions, sizeof(dimensions), "%ix%i",
-				 sel_box->width, sel_box->height);
+				 current_selection->selection.width,
+				 current_selection->selection.height);
 			cairo_move_to(cairo, sel_box->x + sel_box->width + 10,
 				      sel_box->y + sel_box->height + 20);
 			cairo_show_text(cairo, dimensions);
@@ -0,0 +1,3073 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-cursor.h>
+#include <xkbcommon/xkbcommon.h>
+#include <linux/input-event-codes.h>
+
+#include "libslurp.h"
+#include "slurp.h"
+#include "render.h"
+#include "image.h"
+#include "magnifier.h"
+#include "trace.h"
+
+#define BG_COLOR 0xFFFFFF40
+#define BORDER_COLOR 0x000000FF
+#define SELECTION_COLOR 0x00000000
+#define FONT_FAMILY "sans-serif"
+// Content snapping distance if -S isn't given, in logical pixels
+#define CONTENT_SNAP_THRESHOLD 8
+
+static void noop() {
+	// This space intentionally left blank
+}
+
+static void set_output_dirty(struct slurp_output *output);
+static void refresh_hovered_boxes(struct slurp_state *state);
+static void update_filter(struct slurp_state *state);
+
+static int max(int a, int b) {
+	return (a > b) ? a : b;
+}
+
+static int min(int a, int b) {
+	return (a < b) ? a : b;
+}
+
+static struct slurp_output *output_from_surface(struct slurp_state *state,
+	struct wl_surface *surface);
+
+static void move_seat(struct slurp_seat *seat, wl_fixed_t surface_x,
+		wl_fixed_t surface_y,
+		struct slurp_selection *current_selection) {
+	int x = wl_fixed_to_int(surface_x) +
+		current_selection->current_output->logical_geometry.x;
+	int y = wl_fixed_to_int(surface_y) + current_selection->current_output->logical_geometry.y;
+
+	if (seat->state->edit_anchor) {
+		current_selection->anchor_x += x - current_selection->x;
+		current_selection->anchor_y += y - current_selection->y;
+	}
+
+	current_selection->x = x;
+	current_selection->y = y;
+}
+
+/**
+ * Index the boxes of layer over the area of the outputs, which new boxes are
+ * most likely within.
+ */
+static bool layer_build_hit_index(struct slurp_state *state,
+		struct slurp_box_layer *layer) {
+	struct slurp_box bounds = {0};
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		const struct slurp_box *geometry = &output->logical_geometry;
+		if (geometry->width <= 0 || geometry->height <= 0) {
+			continue;
+		}
+		if (bounds.width == 0) {
+			bounds = *geometry;
+			continue;
+		}
+		int32_t x2 = max(bounds.x + bounds.width, geometry->x + geometry->width);
+		int32_t y2 = max(bounds.y + bounds.height,
+			geometry->y + geometry->height);
+		bounds.x = min(bounds.x, geometry->x);
+		bounds.y = min(bounds.y, geometry->y);
+		bounds.width = x2 - bounds.x;
+		bounds.height = y2 - bounds.y;
+	}
+	return hit_index_build(&layer->hit_index, &layer->boxes, &bounds);
+}
+
+/**
+ * Select the smallest box under a hovering pointer or tablet tool.
+ */
+static void seat_update_selection(struct slurp_seat *seat,
+		struct slurp_selection *selection) {
+	struct slurp_box_layer *layer = seat->state->layer;
+	int32_t x = selection->x, y = selection->y;
+	selection->has_selection = false;
+
+	// Only the boxes left by the filter can be hovered, there are few
+	struct box_filter *filter = &seat->state->filter;
+	if (filter->active) {
+		struct slurp_box *best = NULL;
+		for (size_t i = 0; i < filter->matches_len; i++) {
+			struct slurp_box *box = layer->label_index.boxes[filter->matches[i]];
+			if (box != NULL && slurp_box_contains(box, x, y) &&
+					(best == NULL ||
+						slurp_box_size(box) <= slurp_box_size(best))) {
+				best = box;
+			}
+		}
+		if (best != NULL) {
+			selection->selection = *best;
+			selection->has_selection = true;
+		}
+		return;
+	}
+
+	// The index is built by slurp_start, and again if a box fell outside of it
+	if (layer->hit_index.valid || layer_build_hit_index(seat->state, layer)) {
+		struct slurp_box *box = hit_index_query(&layer->hit_index, x, y);
+		if (box != NULL) {
+			selection->selection = *box;
+			selection->has_selection = true;
+		}
+		return;
+	}
+
+	// find smallest box intersecting the cursor
+	struct slurp_box *box;
+	wl_list_for_each(box, &layer->boxes, link) {
+		if (slurp_box_contains(box, x, y)) {
+			if (selection->has_selection &&
+				slurp_box_size(
+					&selection->selection) <
+					slurp_box_size(box)) {
+				continue;
+			}
+			selection->selection = *box;
+			selection->has_selection = true;
+		}
+	}
+}
+
+static void set_box_outputs_dirty(struct slurp_state *state,
+		const struct slurp_box *box) {
+	struct slurp_output *output;
+	if (!state->output_index.valid) {
+		wl_list_for_each(output, &state->outputs, link) {
+			if (output->configured &&
+					slurp_box_intersect(&output->logical_geometry, box)) {
+				set_output_dirty(output);
+			}
+		}
+		return;
+	}
+
+	uint64_t set = output_index_query(&state->output_index, box);
+	while (set != 0) {
+		output = state->output_index.outputs[__builtin_ctzll(set)];
+		set &= set - 1;
+		if (output->configured) {
+			set_output_dirty(output);
+		}
+	}
+}
+
+static void set_all_outputs_dirty(struct slurp_state *state) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		set_output_dirty(output);
+	}
+}
+
+static void selection_set_outputs_dirty(struct slurp_state *state,
+		struct slurp_selection *selection) {
+	set_box_outputs_dirty(state, &selection->selection);
+	if (selection->has_prediction) {
+		set_box_outputs_dirty(state, &selection->predicted);
+	}
+	if (state->crosshairs) {
+		struct slurp_box cursor = {
+			.x = selection->x,
+			.y = selection->y,
+			.width = 1,
+			.height = 1,
+		};
+		set_box_outputs_dirty(state, &cursor);
+	}
+}
+
+static void seat_set_outputs_dirty(struct slurp_seat *seat) {
+	struct slurp_state *state = seat->state;
+	selection_set_outputs_dirty(state, &seat->pointer_selection);
+	selection_set_outputs_dirty(state, &seat->touch_selection);
+	if (seat->tablet_selection != NULL) {
+		selection_set_outputs_dirty(state, seat->tablet_selection);
+	}
+}
+
+static bool is_dragging(struct slurp_state *state) {
+	return state->resizing_selection || state->edit_anchor;
+}
+
+/**
+ * Lower the quality of the next frame of output if this one took longer than
+ * the budget while the user is dragging. The full quality is restored once
+ * the drag stops or the output stays unchanged for a frame.
+ */
+static void governor_update(struct slurp_output *output, double render_time) {
+	struct slurp_state *state = output->state;
+	if (state->frame_budget <= 0 || render_time <= state->frame_budget ||
+			!is_dragging(state) ||
+			output->quality == SLURP_QUALITY_LEVELS - 1) {
+		return;
+	}
+	output->quality++;
+	if (output->quality == SLURP_QUALITY_REDUCED_SCALE &&
+			output->viewport == NULL) {
+		output->quality++;
+	}
+}
+
+static void governor_reset(struct slurp_state *state) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->quality != SLURP_QUALITY_FULL) {
+			output->quality = SLURP_QUALITY_FULL;
+			set_output_dirty(output);
+		}
+	}
+}
+
+static bool seat_snapping(struct slurp_seat *seat) {
+	if (seat->state->snap_threshold == 0 && !seat->state->content_snap) {
+		return false;
+	}
+	// Holding Ctrl temporarily disables snapping
+	return seat->xkb_state == NULL ||
+		xkb_state_mod_name_is_active(seat->xkb_state, XKB_MOD_NAME_CTRL,
+			XKB_STATE_MODS_EFFECTIVE) <= 0;
+}
+
+/**
+ * Snap x and y to the visual edges of output, if they're within it.
+ */
+static void snap_to_content(struct slurp_output *output, int32_t *x, int32_t *y) {
+	const struct slurp_box *geometry = &output->logical_geometry;
+	const struct capture *capture = &output->capture;
+	if (!slurp_box_contains(geometry, *x, *y) || capture->data == NULL) {
+		return;
+	}
+	// Captures have the orientation of the logical output, see
+	// apply_transform, only the scale differs
+	int32_t cx = (int64_t)(*x - geometry->x) * capture->width / geometry->width;
+	int32_t cy = (int64_t)(*y - geometry->y) * capture->height / geometry->height;
+	content_edges_snap(&output->content_edges, &cx, &cy);
+	*x = geometry->x + lround((double)cx * geometry->width / capture->width);
+	*y = geometry->y + lround((double)cy * geometry->height / capture->height);
+}
+
+/**
+ * Snap a point to the edges of the predefined boxes, or else to the visual
+ * edges of the output below it.
+ */
+static void seat_snap_point(struct slurp_seat *seat,
+		const struct slurp_selection *current_selection,
+		int32_t *x, int32_t *y) {
+	struct slurp_state *state = seat->state;
+	if (!seat_snapping(seat)) {
+		return;
+	}
+	int32_t content_x = *x, content_y = *y;
+	if (state->content_snap && current_selection->current_output != NULL) {
+		snap_to_content(current_selection->current_output,
+			&content_x, &content_y);
+	}
+	int32_t box_x = *x, box_y = *y;
+	if (state->snap_threshold > 0) {
+		struct edge_index *edge_index = &state->layer->edge_index;
+		box_x = edge_list_snap(&edge_index->x, *x, state->snap_threshold);
+		box_y = edge_list_snap(&edge_index->y, *y, state->snap_threshold);
+	}
+	// Box edges win over visual edges
+	*x = box_x != *x ? box_x : content_x;
+	*y = box_y != *y ? box_y : content_y;
+}
+
+/**
+ * Compute the selection spanning from the anchor to x, y.
+ */
+static void selection_box_at(struct slurp_seat *seat,
+		const struct slurp_selection *current_selection, int32_t x, int32_t y,
+		struct slurp_box *box) {
+	struct slurp_state *state = seat->state;
+	seat_snap_point(seat, current_selection, &x, &y);
+
+	int32_t anchor_x = current_selection->anchor_x;
+	int32_t anchor_y = current_selection->anchor_y;
+	int32_t dist_x = x - anchor_x;
+	int32_t dist_y = y - anchor_y;
+
+	// selection includes the seat and anchor positions
+	int32_t width = abs(dist_x) + 1;
+	int32_t height = abs(dist_y) + 1;
+	if (state->aspect_ratio) {
+		width = max(width, height / state->aspect_ratio);
+		height = max(height, width * state->aspect_ratio);
+	}
+	box->x = dist_x > 0 ? anchor_x : anchor_x - (width - 1);
+	box->y = dist_y > 0 ? anchor_y : anchor_y - (height - 1);
+	box->width = width;
+	box->height = height;
+}
+
+static void handle_active_selection_motion(struct slurp_seat *seat, struct slurp_selection *current_selection) {
+	if(seat->state->restrict_selection){
+		return;
+	}
+
+	seat->state->resizing_selection = true;
+
+	struct slurp_box previous = current_selection->selection;
+	current_selection->has_selection = true;
+	selection_box_at(seat, current_selection, current_selection->x,
+		current_selection->y, &current_selection->selection);
+
+	const struct slurp_box *selection = &current_selection->selection;
+	if (previous.x == selection->x && previous.y == selection->y &&
+			previous.width == selection->width &&
+			previous.height == selection->height) {
+		return;
+	}
+	// Reported with the next presented frame, see output_frame_handle_done
+	seat->state->selection_changed = true;
+	seat->state->changed_selection = current_selection->selection;
+}
+
+static void seat_move_magnifier(struct slurp_seat *seat,
+		struct slurp_selection *current_selection) {
+	if (seat->state->magnifier_zoom == 0 ||
+			current_selection->current_output == NULL) {
+		return;
+	}
+	magnifier_move(current_selection->current_output,
+		current_selection->x, current_selection->y);
+}
+
+/**
+ * Returns the cursor theme for scale, loaded on first use, or NULL if it
+ * can't be loaded. Failures are remembered so that they are reported once.
+ */
+static struct slurp_cursor_theme *get_cursor_theme(struct slurp_state *state,
+		int32_t scale) {
+	struct slurp_cursor_theme *cursor;
+	wl_list_for_each(cursor, &state->cursor_themes, link) {
+		if (cursor->scale == scale) {
+			return cursor->theme != NULL ? cursor : NULL;
+		}
+	}
+
+	cursor = calloc(1, sizeof(*cursor));
+	if (cursor == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	cursor->scale = scale;
+	wl_list_insert(&state->cursor_themes, &cursor->link);
+
+	trace_begin("load_cursor_theme");
+	cursor->theme = wl_cursor_theme_load(state->cursor_theme_name,
+		state->cursor_size * scale, state->shm);
+	trace_end("load_cursor_theme");
+	if (cursor->theme == NULL) {
+		fprintf(stderr, "failed to load cursor theme\n");
+		return NULL;
+	}
+	struct wl_cursor *wl_cursor =
+		wl_cursor_theme_get_cursor(cursor->theme, "crosshair");
+	if (wl_cursor == NULL) {
+		// Fallback
+		wl_cursor = wl_cursor_theme_get_cursor(cursor->theme, "left_ptr");
+	}
+	if (wl_cursor == NULL) {
+		fprintf(stderr, "failed to load cursor\n");
+		wl_cursor_theme_destroy(cursor->theme);
+		cursor->theme = NULL;
+		return NULL;
+	}
+	cursor->image = wl_cursor->images[0];
+	return cursor;
+}
+
+/**
+ * Attach the cursor image to surface, unless it is already there. Returns
+ * true if the surface needs to be committed.
+ */
+static bool attach_cursor(struct wl_surface *surface,
+		struct slurp_cursor_theme **attached, struct slurp_cursor_theme *cursor) {
+	if (*attached == cursor) {
+		return false;
+	}
+	wl_surface_set_buffer_scale(surface, cursor->scale);
+	wl_surface_attach(surface, wl_cursor_image_get_buffer(cursor->image), 0, 0);
+	*attached = cursor;
+	return true;
+}
+
+static void pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
+		uint32_t serial, struct wl_surface *surface,
+		wl_fixed_t surface_x, wl_fixed_t surface_y) {
+	struct slurp_seat *seat = data;
+	struct slurp_output *output = output_from_surface(seat->state, surface);
+	if (output == NULL) {
+		return;
+	}
+	trace_begin("pointer_enter");
+
+	// the places the cursor moved away from are also dirty
+	if (seat->pointer_selection.has_selection || seat->state->crosshairs) {
+		seat_set_outputs_dirty(seat);
+	}
+
+	// Coordinates are relative to the entered output. Other outputs
+	// overlapping it are redrawn through seat_set_outputs_dirty.
+	seat->pointer_selection.current_output = output;
+
+	move_seat(seat, surface_x, surface_y, &seat->pointer_selection);
+
+	switch (seat->button_state) {
+	case WL_POINTER_BUTTON_STATE_RELEASED:
+		seat_update_selection(seat, &seat->pointer_selection);
+		break;
+	case WL_POINTER_BUTTON_STATE_PRESSED:
+		handle_active_selection_motion(seat, &seat->pointer_selection);
+		break;
+	}
+
+	seat_set_outputs_dirty(seat);
+	seat_move_magnifier(seat, &seat->pointer_selection);
+
+	if (output->state->cursor_shape_manager) {
+		struct wp_cursor_shape_device_v1 *device =
+			wp_cursor_shape_manager_v1_get_pointer(
+				output->state->cursor_shape_manager, wl_pointer);
+		wp_cursor_shape_device_v1_set_shape(device, serial,
+			WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CROSSHAIR);
+		wp_cursor_shape_device_v1_destroy(device);
+	} else {
+		struct slurp_cursor_theme *cursor =
+			get_cursor_theme(output->state, output->scale);
+		if (cursor != NULL) {
+			bool attached =
+				attach_cursor(seat->cursor_surface, &seat->cursor, cursor);
+			wl_pointer_set_cursor(wl_pointer, serial, seat->cursor_surface,
+				cursor->image->hotspot_x / cursor->scale,
+				cursor->image->hotspot_y / cursor->scale);
+			if (attached) {
+				wl_surface_commit(seat->cursor_surface);
+			}
+		}
+	}
+	trace_end("pointer_enter");
+}
+
+static void pointer_handle_leave(void *data, struct wl_pointer *wl_pointer,
+		uint32_t serial, struct wl_surface *surface) {
+	struct slurp_seat *seat = data;
+
+	if (seat->pointer_selection.current_output != NULL) {
+		magnifier_hide(seat->pointer_selection.current_output);
+	}
+
+	seat->pointer_selection.current_output = NULL;
+}
+
+static void pointer_handle_motion(void *data, struct wl_pointer *wl_pointer,
+		uint32_t time, wl_fixed_t surface_x, wl_fixed_t surface_y) {
+	struct slurp_seat *seat = data;
+	struct slurp_state *state = seat->state;
+	trace_begin("pointer_motion");
+	state->motion_events++;
+
+	// the places the cursor moved away from are also dirty
+	if (seat->pointer_selection.has_selection || state->crosshairs) {
+		seat_set_outputs_dirty(seat);
+	}
+
+	move_seat(seat, surface_x, surface_y, &seat->pointer_selection);
+
+	switch (seat->button_state) {
+	case WL_POINTER_BUTTON_STATE_RELEASED:
+		seat_update_selection(seat, &seat->pointer_selection);
+		break;
+	case WL_POINTER_BUTTON_STATE_PRESSED:
+		handle_active_selection_motion(seat, &seat->pointer_selection);
+		motion_record(&seat->pointer_selection.motion,
+			seat->pointer_selection.x, seat->pointer_selection.y, time);
+		break;
+	}
+
+	if (seat->pointer_selection.has_selection || state->crosshairs) {
+		seat_set_outputs_dirty(seat);
+	}
+	seat_move_magnifier(seat, &seat->pointer_selection);
+	trace_end("pointer_motion");
+}
+
+static void handle_selection_start(struct slurp_seat *seat,
+				   struct slurp_selection *current_selection) {
+	struct slurp_state *state = seat->state;
+
+	if (state->single_point) {
+		state->result.x = current_selection->x;
+		state->result.y = current_selection->y;
+		state->result.width = state->result.height = 1;
+		state->running = false;
+	} else if (state->restrict_selection) {
+		if (current_selection->has_selection) {
+			state->result = current_selection->selection;
+			state->running = false;
+		}
+	} else {
+		current_selection->anchor_x = current_selection->x;
+		current_selection->anchor_y = current_selection->y;
+		seat_snap_point(seat, current_selection,
+			&current_selection->anchor_x, &current_selection->anchor_y);
+		motion_start(&current_selection->motion);
+	}
+}
+
+static void stop_prediction(struct slurp_selection *current_selection) {
+	motion_stop(&current_selection->motion);
+	current_selection->has_prediction = false;
+}
+
+static void handle_selection_end(struct slurp_seat *seat,
+				 struct slurp_selection *current_selection) {
+	struct slurp_state *state = seat->state;
+	if (state->single_point || state->restrict_selection) {
+		return;
+	}
+	// The result is never predicted
+	stop_prediction(current_selection);
+	if (current_selection->has_selection) {
+		state->result = current_selection->selection;
+	} else {
+		state->result.x = current_selection->x;
+		state->result.y = current_selection->y;
+		state->result.width = state->result.height = 1;
+	}
+	state->resizing_selection = false;
+	governor_reset(state);
+	state->running = false;
+}
+
+static void handle_selection_cancelled(struct slurp_seat *seat) {
+	struct slurp_state *state = seat->state;
+	seat->pointer_selection.has_selection = false;
+	seat->touch_selection.has_selection = false;
+	stop_prediction(&seat->pointer_selection);
+	stop_prediction(&seat->touch_selection);
+	struct slurp_tablet_tool *tool;
+	wl_list_for_each(tool, &seat->tablet_tools, link) {
+		tool->selection.has_selection = false;
+		stop_prediction(&tool->selection);
+	}
+	state->edit_anchor = false;
+	state->running = false;
+}
+
+/**
+ * Remember the serial of an input event, which the clipboard is set with.
+ */
+static void seat_set_serial(struct slurp_seat *seat, uint32_t serial) {
+	seat->serial = serial;
+	seat->state->input_seat = seat;
+}
+
+static void pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
+		uint32_t serial, uint32_t time, uint32_t button,
+		uint32_t button_state) {
+	struct slurp_seat *seat = data;
+	seat_set_serial(seat, serial);
+	// The selection of a tool in proximity is the one shown
+	if (seat->touch_selection.has_selection || seat->tablet_selection != NULL) {
+		return;
+	}
+	trace_begin("pointer_button");
+
+	seat->button_state = button_state;
+	switch (button) {
+	case BTN_LEFT:
+		switch (button_state) {
+		case WL_POINTER_BUTTON_STATE_PRESSED:
+			handle_selection_start(seat, &seat->pointer_selection);
+			break;
+		case WL_POINTER_BUTTON_STATE_RELEASED:
+			handle_selection_end(seat, &seat->pointer_selection);
+			break;
+		}
+		break;
+	default: //other mouse buttons cancel the selection
+		handle_selection_cancelled(seat);
+		break;
+	}
+	trace_end("pointer_button");
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+	.enter = pointer_handle_enter,
+	.leave = pointer_handle_leave,
+	.motion = pointer_handle_motion,
+	.button = pointer_handle_button,
+	.axis = noop,
+};
+
+/**
+ * Stop the selection because of an error, which was printed already.
+ */
+static void fail(struct slurp_state *state) {
+	state->failed = true;
+	state->running = false;
+}
+
+static void keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard,
+		const uint32_t format, const int32_t fd, const uint32_t size) {
+	struct slurp_seat *seat = data;
+	trace_begin("keyboard_keymap");
+	// The keymap may be replaced, e.g. when the layout changes
+	xkb_state_unref(seat->xkb_state);
+	xkb_keymap_unref(seat->xkb_keymap);
+	seat->xkb_state = NULL;
+	seat->xkb_keymap = NULL;
+	switch (format) {
+	case WL_KEYBOARD_KEYMAP_FORMAT_NO_KEYMAP:
+		seat->xkb_keymap = xkb_keymap_new_from_names(seat->state->xkb_context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+		break;
+	case WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1:;
+		void *buffer;
+		if ((buffer = mmap(NULL, size - 1, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+			fprintf(stderr, "mmap failed\n");
+			break;
+		}
+		seat->xkb_keymap =
+			xkb_keymap_new_from_buffer(seat->state->xkb_context,
+					buffer, size - 1,
+					XKB_KEYMAP_FORMAT_TEXT_V1,
+					XKB_KEYMAP_COMPILE_NO_FLAGS);
+		munmap(buffer, size - 1);
+		break;
+	}
+	close(fd);
+	if (seat->xkb_keymap != NULL) {
+		seat->xkb_state = xkb_state_new(seat->xkb_keymap);
+	}
+	if (seat->xkb_state == NULL) {
+		fprintf(stderr, "failed to load the keymap\n");
+		fail(seat->state);
+	}
+	trace_end("keyboard_keymap");
+}
+
+// Recompute the selection if the aspect ratio changed.
+static void recompute_selection(struct slurp_seat *seat) {
+	struct slurp_selection *current = slurp_seat_current_selection(seat);
+	if (current->has_selection) {
+		handle_active_selection_motion(seat, slurp_seat_current_selection(seat));
+		seat_set_outputs_dirty(seat);
+	}
+}
+
+/**
+ * Make the next (or previous) layer active. Each layer keeps its indices and
+ * rasters, so this only needs a redraw.
+ */
+static void cycle_layer(struct slurp_state *state, bool backwards) {
+	struct wl_list *link = backwards ? state->layer->link.prev :
+		state->layer->link.next;
+	if (link == &state->layers) {
+		link = backwards ? link->prev : link->next;
+	}
+	struct slurp_box_layer *layer = wl_container_of(link, layer, link);
+	if (layer == state->layer) {
+		return;
+	}
+	state->layer = layer;
+
+	set_all_outputs_dirty(state);
+	if (state->filter.active) {
+		update_filter(state);
+	} else {
+		refresh_hovered_boxes(state);
+	}
+}
+
+/**
+ * Edit the label filter with a key press. Returns false if the key isn't
+ * used by the filter.
+ */
+static bool filter_handle_key(struct slurp_seat *seat, xkb_keysym_t keysym,
+		uint32_t key) {
+	struct slurp_state *state = seat->state;
+	struct box_filter *filter = &state->filter;
+	switch (keysym) {
+	case XKB_KEY_BackSpace:
+		if (filter->query_len == 0) {
+			return true;
+		}
+		// Remove the last UTF-8 sequence
+		do {
+			filter->query_len--;
+		} while (filter->query_len > 0 &&
+			(filter->query[filter->query_len] & 0xC0) == 0x80);
+		update_filter(state);
+		return true;
+	case XKB_KEY_Escape:
+		if (filter->query_len == 0) {
+			return false;
+		}
+		filter->query_len = 0;
+		update_filter(state);
+		return true;
+	case XKB_KEY_Return:
+	case XKB_KEY_KP_Enter:
+		if (filter->best != NULL) {
+			state->result = *filter->best;
+			state->running = false;
+		}
+		return true;
+	}
+
+	// Space still moves a selection being dragged
+	if (state->resizing_selection) {
+		return false;
+	}
+	char text[16];
+	int len = xkb_state_key_get_utf8(seat->xkb_state, key + 8, text,
+		sizeof(text));
+	// Control characters, e.g. Tab or with Ctrl held, aren't typed
+	if (len <= 0 || (unsigned char)text[0] < 0x20 || text[0] == 0x7F ||
+			filter->query_len + len >= FILTER_QUERY_MAX) {
+		return false;
+	}
+	memcpy(&filter->query[filter->query_len], text, len);
+	filter->query_len += len;
+	update_filter(state);
+	return true;
+}
+
+static void keyboard_handle_key(void *data, struct wl_keyboard *wl_keyboard,
+		const uint32_t serial, const uint32_t time, const uint32_t key,
+		const uint32_t key_state) {
+	struct slurp_seat *seat = data;
+	struct slurp_state *state = seat->state;
+	if (seat->xkb_state == NULL) {
+		return;
+	}
+	const xkb_keysym_t keysym = xkb_state_key_get_one_sym(seat->xkb_state, key + 8);
+	seat_set_serial(seat, serial);
+	trace_begin("keyboard_key");
+
+	switch (key_state) {
+	case WL_KEYBOARD_KEY_STATE_PRESSED:
+		if (state->filter_labels && filter_handle_key(seat, keysym, key)) {
+			break;
+		}
+		switch (keysym) {
+		case XKB_KEY_Escape:
+			handle_selection_cancelled(seat);
+			break;
+
+		case XKB_KEY_space:
+			if (!slurp_seat_current_selection(seat)->has_selection) {
+				break;
+			}
+			state->edit_anchor = true;
+			break;
+		case XKB_KEY_Tab:
+		case XKB_KEY_ISO_Left_Tab:
+			cycle_layer(state, keysym == XKB_KEY_ISO_Left_Tab);
+			break;
+		case XKB_KEY_Shift_L:
+		case XKB_KEY_Shift_R:
+			if (!state->fixed_aspect_ratio) {
+				state->aspect_ratio = 1;
+				if (state->resizing_selection) {
+					recompute_selection(seat);
+				}
+			}
+			break;
+		}
+		break;
+
+	case WL_KEYBOARD_KEY_STATE_RELEASED:
+		if (keysym == XKB_KEY_space) {
+			state->edit_anchor = false;
+		} else if (!state->fixed_aspect_ratio && (keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R)) {
+			state->aspect_ratio = 0;
+			if (state->resizing_selection) {
+				recompute_selection(seat);
+			}
+		}
+		break;
+	}
+	trace_end("keyboard_key");
+}
+
+static void keyboard_handle_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+		const uint32_t serial, const uint32_t mods_depressed,
+		const uint32_t mods_latched, const uint32_t mods_locked,
+		const uint32_t group) {
+	struct slurp_seat *seat = data;
+	if (seat->xkb_state == NULL) {
+		return;
+	}
+	trace_begin("keyboard_modifiers");
+	xkb_state_update_mask(seat->xkb_state, mods_depressed, mods_latched,
+			mods_locked, 0, 0, group);
+	// Ctrl toggles snapping
+	if (seat->state->snap_threshold > 0 && seat->state->resizing_selection) {
+		recompute_selection(seat);
+	}
+	trace_end("keyboard_modifiers");
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+	.keymap = keyboard_handle_keymap,
+	.enter = noop,
+	.leave = noop,
+	.key = keyboard_handle_key,
+	.modifiers = keyboard_handle_modifiers,
+};
+
+static void touch_handle_down(void *data, struct wl_touch *touch,
+		uint32_t serial, uint32_t time,
+		struct wl_surface *surface, int32_t id,
+		wl_fixed_t x, wl_fixed_t y) {
+	struct slurp_seat *seat = data;
+	seat_set_serial(seat, serial);
+	if (seat->pointer_selection.has_selection) {
+		return;
+	}
+	struct slurp_output *output = output_from_surface(seat->state, surface);
+	if (output == NULL) {
+		return;
+	}
+	trace_begin("touch_down");
+	if (seat->touch_id == TOUCH_ID_EMPTY) {
+		seat->touch_id = id;
+		seat->touch_selection.current_output = output;
+		move_seat(seat, x, y, &seat->touch_selection);
+		handle_selection_start(seat, &seat->touch_selection);
+		seat_move_magnifier(seat, &seat->touch_selection);
+	}
+	trace_end("touch_down");
+}
+
+static void touch_clear_state(struct slurp_seat *seat) {
+	if (seat->touch_selection.current_output != NULL) {
+		magnifier_hide(seat->touch_selection.current_output);
+	}
+	seat->touch_id = TOUCH_ID_EMPTY;
+	seat->touch_selection.current_output = NULL;
+}
+
+static void touch_handle_up(void *data, struct wl_touch *touch, uint32_t serial,
+		uint32_t time, int32_t id) {
+	struct slurp_seat *seat = data;
+	seat_set_serial(seat, serial);
+	trace_begin("touch_up");
+	handle_selection_end(seat, &seat->touch_selection);
+	touch_clear_state(seat);
+	trace_end("touch_up");
+}
+
+static void touch_handle_motion(void *data, struct wl_touch *touch,
+		uint32_t time, int32_t id, wl_fixed_t x,
+		wl_fixed_t y) {
+	struct slurp_seat *seat = data;
+	trace_begin("touch_motion");
+	seat->state->motion_events++;
+	if (seat->touch_id == id) {
+		move_seat(seat, x, y, &seat->touch_selection);
+		handle_active_selection_motion(seat, &seat->touch_selection);
+		motion_record(&seat->touch_selection.motion,
+			seat->touch_selection.x, seat->touch_selection.y, time);
+		seat_set_outputs_dirty(seat);
+		seat_move_magnifier(seat, &seat->touch_selection);
+	}
+	trace_end("touch_motion");
+}
+
+static void touch_handle_cancel(void *data, struct wl_touch *touch) {
+	struct slurp_seat *seat = data;
+	touch_clear_state(seat);
+}
+
+static const struct wl_touch_listener touch_listener = {
+	.down = touch_handle_down,
+	.up = touch_handle_up,
+	.frame = noop,
+	.motion = touch_handle_motion,
+	.orientation = noop,
+	.shape = noop,
+	.cancel = touch_handle_cancel,
+};
+
+static void tablet_tool_set_cursor(struct slurp_tablet_tool *tool,
+		uint32_t serial, struct slurp_output *output) {
+	struct slurp_state *state = tool->seat->state;
+	if (state->cursor_shape_manager) {
+		struct wp_cursor_shape_device_v1 *device =
+			wp_cursor_shape_manager_v1_get_tablet_tool_v2(
+				state->cursor_shape_manager, tool->tool);
+		wp_cursor_shape_device_v1_set_shape(device, serial,
+			WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CROSSHAIR);
+		wp_cursor_shape_device_v1_destroy(device);
+		return;
+	}
+
+	struct slurp_cursor_theme *cursor = get_cursor_theme(state, output->scale);
+	if (cursor == NULL) {
+		return;
+	}
+	if (tool->cursor_surface == NULL) {
+		tool->cursor_surface = wl_compositor_create_surface(state->compositor);
+	}
+	bool attached = attach_cursor(tool->cursor_surface, &tool->cursor, cursor);
+	zwp_tablet_tool_v2_set_cursor(tool->tool, serial, tool->cursor_surface,
+		cursor->image->hotspot_x / cursor->scale,
+		cursor->image->hotspot_y / cursor->scale);
+	if (attached) {
+		wl_surface_commit(tool->cursor_surface);
+	}
+}
+
+static void tablet_tool_handle_proximity_in(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2, uint32_t serial,
+		struct zwp_tablet_v2 *tablet, struct wl_surface *surface) {
+	struct slurp_tablet_tool *tool = data;
+	struct slurp_output *output =
+		output_from_surface(tool->seat->state, surface);
+	if (output == NULL) {
+		return;
+	}
+	tool->pending.proximity_in = true;
+	tool->pending.proximity_out = false;
+	tool->pending.proximity_serial = serial;
+	tool->pending.output = output;
+}
+
+static void tablet_tool_handle_proximity_out(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2) {
+	struct slurp_tablet_tool *tool = data;
+	tool->pending.proximity_out = true;
+}
+
+static void tablet_tool_handle_down(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2, uint32_t serial) {
+	struct slurp_tablet_tool *tool = data;
+	seat_set_serial(tool->seat, serial);
+	tool->pending.down = true;
+}
+
+static void tablet_tool_handle_up(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2) {
+	struct slurp_tablet_tool *tool = data;
+	tool->pending.up = true;
+}
+
+static void tablet_tool_handle_motion(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2,
+		wl_fixed_t x, wl_fixed_t y) {
+	struct slurp_tablet_tool *tool = data;
+	// Only the last position of a frame matters
+	if (tool->pending.motion) {
+		tool->seat->state->coalesced_motion_events++;
+	}
+	tool->seat->state->motion_events++;
+	tool->pending.motion = true;
+	tool->pending.x = x;
+	tool->pending.y = y;
+}
+
+static void tablet_tool_handle_button(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2, uint32_t serial,
+		uint32_t button, uint32_t state) {
+	struct slurp_tablet_tool *tool = data;
+	// Stylus buttons cancel the selection, like extra pointer buttons
+	if (state == ZWP_TABLET_TOOL_V2_BUTTON_STATE_PRESSED) {
+		tool->pending.cancel = true;
+	}
+}
+
+/**
+ * Apply the events of a tablet frame at once, through the same selection
+ * state machine as the pointer. Tablets report at several hundred Hz, so
+ * this runs the selection logic once per frame instead of once per axis
+ * event. Each tool has its own selection, the seat shows the one of the last
+ * tool which came in proximity.
+ */
+static void tablet_tool_handle_frame(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2, uint32_t time) {
+	struct slurp_tablet_tool *tool = data;
+	struct slurp_seat *seat = tool->seat;
+	struct slurp_state *state = seat->state;
+	struct slurp_selection *selection = &tool->selection;
+
+	trace_begin("tablet_frame");
+	if (tool->pending.cancel) {
+		handle_selection_cancelled(seat);
+	}
+
+	if (tool->pending.proximity_in) {
+		// The selection shown until now goes away
+		seat_set_outputs_dirty(seat);
+		seat->tablet_selection = selection;
+		selection->current_output = tool->pending.output;
+		tablet_tool_set_cursor(tool, tool->pending.proximity_serial,
+			tool->pending.output);
+	}
+
+	if (selection->current_output != NULL && !seat->touch_selection.has_selection) {
+		if (tool->pending.motion) {
+			// the places the tool moved away from are also dirty
+			if (selection->has_selection || state->crosshairs) {
+				seat_set_outputs_dirty(seat);
+			}
+			move_seat(seat, tool->pending.x, tool->pending.y, selection);
+			if (tool->down) {
+				handle_active_selection_motion(seat, selection);
+				motion_record(&selection->motion, selection->x, selection->y,
+					time);
+			} else {
+				seat_update_selection(seat, selection);
+			}
+			seat_set_outputs_dirty(seat);
+			seat_move_magnifier(seat, selection);
+		}
+
+		if (tool->pending.down && !tool->down) {
+			tool->down = true;
+			handle_selection_start(seat, selection);
+		}
+		if (tool->pending.up && tool->down) {
+			tool->down = false;
+			handle_selection_end(seat, selection);
+		}
+	}
+
+	if (tool->pending.proximity_out) {
+		if (selection->current_output != NULL) {
+			magnifier_hide(selection->current_output);
+		}
+		selection->current_output = NULL;
+		if (seat->tablet_selection == selection) {
+			// The pointer selection is shown again
+			seat_set_outputs_dirty(seat);
+			seat->tablet_selection = NULL;
+			seat_set_outputs_dirty(seat);
+		}
+	}
+
+	memset(&tool->pending, 0, sizeof(tool->pending));
+	trace_end("tablet_frame");
+}
+
+static void destroy_tablet_tool(struct slurp_tablet_tool *tool) {
+	if (tool->seat->tablet_selection == &tool->selection) {
+		tool->seat->tablet_selection = NULL;
+	}
+	wl_list_remove(&tool->link);
+	if (tool->cursor_surface) {
+		wl_surface_destroy(tool->cursor_surface);
+	}
+	zwp_tablet_tool_v2_destroy(tool->tool);
+	free(tool);
+}
+
+static void tablet_tool_handle_removed(void *data,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2) {
+	struct slurp_tablet_tool *tool = data;
+	if (tool->seat->tablet_selection == &tool->selection) {
+		seat_set_outputs_dirty(tool->seat);
+	}
+	destroy_tablet_tool(tool);
+}
+
+static const struct zwp_tablet_tool_v2_listener tablet_tool_listener = {
+	.type = noop,
+	.hardware_serial = noop,
+	.hardware_id_wacom = noop,
+	.capability = noop,
+	.done = noop,
+	.removed = tablet_tool_handle_removed,
+	.proximity_in = tablet_tool_handle_proximity_in,
+	.proximity_out = tablet_tool_handle_proximity_out,
+	.down = tablet_tool_handle_down,
+	.up = tablet_tool_handle_up,
+	.motion = tablet_tool_handle_motion,
+	.pressure = noop,
+	.distance = noop,
+	.tilt = noop,
+	.rotation = noop,
+	.slider = noop,
+	.wheel = noop,
+	.button = tablet_tool_handle_button,
+	.frame = tablet_tool_handle_frame,
+};
+
+static void tablet_seat_handle_tablet_added(void *data,
+		struct zwp_tablet_seat_v2 *tablet_seat, struct zwp_tablet_v2 *tablet) {
+	// Tablet devices carry no information we need, tools do
+	zwp_tablet_v2_destroy(tablet);
+}
+
+static void tablet_seat_handle_tool_added(void *data,
+		struct zwp_tablet_seat_v2 *tablet_seat,
+		struct zwp_tablet_tool_v2 *zwp_tablet_tool_v2) {
+	struct slurp_seat *seat = data;
+	struct slurp_tablet_tool *tool = calloc(1, sizeof(struct slurp_tablet_tool));
+	if (tool == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		zwp_tablet_tool_v2_destroy(zwp_tablet_tool_v2);
+		return;
+	}
+	tool->seat = seat;
+	tool->tool = zwp_tablet_tool_v2;
+	wl_list_insert(&seat->tablet_tools, &tool->link);
+	zwp_tablet_tool_v2_add_listener(zwp_tablet_tool_v2,
+		&tablet_tool_listener, tool);
+}
+
+static void tablet_seat_handle_pad_added(void *data,
+		struct zwp_tablet_seat_v2 *tablet_seat, struct zwp_tablet_pad_v2 *pad) {
+	zwp_tablet_pad_v2_destroy(pad);
+}
+
+static const struct zwp_tablet_seat_v2_listener tablet_seat_listener = {
+	.tablet_added = tablet_seat_handle_tablet_added,
+	.tool_added = tablet_seat_handle_tool_added,
+	.pad_added = tablet_seat_handle_pad_added,
+};
+
+/*
+ * With the input thread, the listeners below run on it and only push the
+ * events to the main thread, which applies them with the listeners above.
+ */
+
+static void push_input_event(void *data, struct input_event event) {
+	struct slurp_seat *seat = data;
+	event.data = seat;
+	input_thread_push(&seat->state->input, &event);
+}
+
+static void pointer_push_enter(void *data, struct wl_pointer *wl_pointer,
+		uint32_t serial, struct wl_surface *surface,
+		wl_fixed_t surface_x, wl_fixed_t surface_y) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_POINTER_ENTER, .serial = serial, .surface = surface,
+		.x = surface_x, .y = surface_y });
+}
+
+static void pointer_push_leave(void *data, struct wl_pointer *wl_pointer,
+		uint32_t serial, struct wl_surface *surface) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_POINTER_LEAVE, .serial = serial, .surface = surface });
+}
+
+static void pointer_push_motion(void *data, struct wl_pointer *wl_pointer,
+		uint32_t time, wl_fixed_t surface_x, wl_fixed_t surface_y) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_POINTER_MOTION, .time = time,
+		.x = surface_x, .y = surface_y });
+}
+
+static void pointer_push_button(void *data, struct wl_pointer *wl_pointer,
+		uint32_t serial, uint32_t time, uint32_t button,
+		uint32_t button_state) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_POINTER_BUTTON, .serial = serial, .time = time,
+		.args = { button, button_state } });
+}
+
+static const struct wl_pointer_listener pointer_push_listener = {
+	.enter = pointer_push_enter,
+	.leave = pointer_push_leave,
+	.motion = pointer_push_motion,
+	.button = pointer_push_button,
+	.axis = noop,
+};
+
+static void keyboard_push_keymap(void *data, struct wl_keyboard *wl_keyboard,
+		uint32_t format, int32_t fd, uint32_t size) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_KEYBOARD_KEYMAP, .args = { format, fd, size } });
+}
+
+static void keyboard_push_key(void *data, struct wl_keyboard *wl_keyboard,
+		uint32_t serial, uint32_t time, uint32_t key, uint32_t key_state) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_KEYBOARD_KEY, .serial = serial, .time = time,
+		.args = { key, key_state } });
+}
+
+static void keyboard_push_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+		uint32_t serial, uint32_t mods_depressed, uint32_t mods_latched,
+		uint32_t mods_locked, uint32_t group) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_KEYBOARD_MODIFIERS, .serial = serial,
+		.args = { mods_depressed, mods_latched, mods_locked, group } });
+}
+
+static const struct wl_keyboard_listener keyboard_push_listener = {
+	.keymap = keyboard_push_keymap,
+	.enter = noop,
+	.leave = noop,
+	.key = keyboard_push_key,
+	.modifiers = keyboard_push_modifiers,
+};
+
+static void touch_push_down(void *data, struct wl_touch *touch,
+		uint32_t serial, uint32_t time, struct wl_surface *surface,
+		int32_t id, wl_fixed_t x, wl_fixed_t y) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_TOUCH_DOWN, .serial = serial, .time = time,
+		.surface = surface, .id = id, .x = x, .y = y });
+}
+
+static void touch_push_up(void *data, struct wl_touch *touch, uint32_t serial,
+		uint32_t time, int32_t id) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_TOUCH_UP, .serial = serial, .time = time, .id = id });
+}
+
+static void touch_push_motion(void *data, struct wl_touch *touch,
+		uint32_t time, int32_t id, wl_fixed_t x, wl_fixed_t y) {
+	push_input_event(data, (struct input_event){
+		.type = INPUT_TOUCH_MOTION, .time = time, .id = id, .x = x, .y = y });
+}
+
+static void touch_push_cancel(void *data, struct wl_touch *touch) {
+	push_input_event(data, (struct input_event){ .type = INPUT_TOUCH_CANCEL });
+}
+
+static const struct wl_touch_listener touch_push_listener = {
+	.down = touch_push_down,
+	.up = touch_push_up,
+	.frame = noop,
+	.motion = touch_push_motion,
+	.orientation = noop,
+	.shape = noop,
+	.cancel = touch_push_cancel,
+};
+
+static void apply_input_event(const struct input_event *event) {
+	struct slurp_seat *seat = event->data;
+	const uint32_t *args = event->args;
+	switch (event->type) {
+	case INPUT_POINTER_ENTER:
+		pointer_handle_enter(seat, seat->wl_pointer, event->serial,
+			event->surface, event->x, event->y);
+		break;
+	case INPUT_POINTER_LEAVE:
+		pointer_handle_leave(seat, seat->wl_pointer, event->serial,
+			event->surface);
+		break;
+	case INPUT_POINTER_MOTION:
+		pointer_handle_motion(seat, seat->wl_pointer, event->time,
+			event->x, event->y);
+		break;
+	case INPUT_POINTER_BUTTON:
+		pointer_handle_button(seat, seat->wl_pointer, event->serial,
+			event->time, args[0], args[1]);
+		break;
+	case INPUT_KEYBOARD_KEYMAP:
+		keyboard_handle_keymap(seat, seat->wl_keyboard, args[0],
+			(int32_t)args[1], args[2]);
+		break;
+	case INPUT_KEYBOARD_KEY:
+		keyboard_handle_key(seat, seat->wl_keyboard, event->serial,
+			event->time, args[0], args[1]);
+		break;
+	case INPUT_KEYBOARD_MODIFIERS:
+		keyboard_handle_modifiers(seat, seat->wl_keyboard, event->serial,
+			args[0], args[1], args[2], args[3]);
+		break;
+	case INPUT_TOUCH_DOWN:
+		touch_handle_down(seat, seat->wl_touch, event->serial, event->time,
+			event->surface, event->id, event->x, event->y);
+		break;
+	case INPUT_TOUCH_UP:
+		touch_handle_up(seat, seat->wl_touch, event->serial, event->time,
+			event->id);
+		break;
+	case INPUT_TOUCH_MOTION:
+		touch_handle_motion(seat, seat->wl_touch, event->time, event->id,
+			event->x, event->y);
+		break;
+	case INPUT_TOUCH_CANCEL:
+		touch_handle_cancel(seat, seat->wl_touch);
+		break;
+	}
+}
+
+/**
+ * Returns true if event only moves a point that next moves again.
+ */
+static bool input_event_superseded(const struct input_event *event,
+		const struct input_event *next) {
+	if (event->type != next->type || event->data != next->data) {
+		return false;
+	}
+	return event->type == INPUT_POINTER_MOTION ||
+		(event->type == INPUT_TOUCH_MOTION && event->id == next->id);
+}
+
+/**
+ * Apply all the events read by the input thread so far.
+ */
+static void apply_input(struct slurp_state *state) {
+	if (!state->input_threaded) {
+		return;
+	}
+	trace_begin("apply_input");
+	const struct input_event *next = input_thread_peek(&state->input);
+	while (next != NULL) {
+		struct input_event event = *next;
+		input_thread_pop(&state->input);
+		next = input_thread_peek(&state->input);
+		// Only the latest position is rendered
+		if (next != NULL && input_event_superseded(&event, next)) {
+			state->motion_events++;
+			state->coalesced_motion_events++;
+			continue;
+		}
+		apply_input_event(&event);
+	}
+	trace_end("apply_input");
+}
+
+static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
+		uint32_t capabilities) {
+	struct slurp_seat *seat = data;
+	bool threaded = seat->state->input_threaded;
+
+	if (capabilities & WL_SEAT_CAPABILITY_POINTER) {
+		seat->wl_pointer = wl_seat_get_pointer(wl_seat);
+		wl_pointer_add_listener(seat->wl_pointer,
+			threaded ? &pointer_push_listener : &pointer_listener, seat);
+	}
+	if (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) {
+		seat->wl_keyboard = wl_seat_get_keyboard(wl_seat);
+		wl_keyboard_add_listener(seat->wl_keyboard,
+			threaded ? &keyboard_push_listener : &keyboard_listener, seat);
+	}
+	if (capabilities & WL_SEAT_CAPABILITY_TOUCH) {
+		seat->wl_touch = wl_seat_get_touch(wl_seat);
+		wl_touch_add_listener(seat->wl_touch,
+			threaded ? &touch_push_listener : &touch_listener, seat);
+	}
+
+	// The devices are moved to the input queue once they have a listener.
+	// Until this function returns, the requests creating them haven't been
+	// flushed, so none of their events can be on the main queue yet.
+	if (threaded) {
+		struct wl_event_queue *queue = seat->state->input.queue;
+		if (seat->wl_pointer != NULL) {
+			wl_proxy_set_queue((struct wl_proxy *)seat->wl_pointer, queue);
+		}
+		if (seat->wl_keyboard != NULL) {
+			wl_proxy_set_queue((struct wl_proxy *)seat->wl_keyboard, queue);
+		}
+		if (seat->wl_touch != NULL) {
+			wl_proxy_set_queue((struct wl_proxy *)seat->wl_touch, queue);
+		}
+	}
+}
+
+static const struct wl_seat_listener seat_listener = {
+	.capabilities = seat_handle_capabilities,
+};
+
+/**
+ * Create what a seat needs to drive the overlay, once it is started.
+ */
+static void start_seat(struct slurp_seat *seat) {
+	struct slurp_state *state = seat->state;
+	seat->cursor_surface = wl_compositor_create_surface(state->compositor);
+	if (state->tablet_manager) {
+		seat->tablet_seat = zwp_tablet_manager_v2_get_tablet_seat(
+			state->tablet_manager, seat->wl_seat);
+		zwp_tablet_seat_v2_add_listener(seat->tablet_seat,
+			&tablet_seat_listener, seat);
+	}
+}
+
+static void create_seat(struct slurp_state *state, struct wl_seat *wl_seat) {
+	struct slurp_seat *seat = calloc(1, sizeof(struct slurp_seat));
+	if (seat == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return;
+	}
+	seat->state = state;
+	seat->wl_seat = wl_seat;
+	seat->touch_id = TOUCH_ID_EMPTY;
+	wl_list_init(&seat->tablet_tools);
+	wl_list_insert(&state->seats, &seat->link);
+	wl_seat_add_listener(wl_seat, &seat_listener, seat);
+	// Plugged in during the selection
+	if (state->running) {
+		start_seat(seat);
+	}
+}
+
+static void destroy_seat(struct slurp_seat *seat) {
+	wl_list_remove(&seat->link);
+	if (seat->state->input_seat == seat) {
+		seat->state->input_seat = NULL;
+	}
+	if (seat->cursor_surface) {
+		wl_surface_destroy(seat->cursor_surface);
+	}
+	if (seat->wl_pointer) {
+		wl_pointer_destroy(seat->wl_pointer);
+	}
+	if (seat->wl_keyboard) {
+		wl_keyboard_destroy(seat->wl_keyboard);
+	}
+	if (seat->wl_touch) {
+		wl_touch_destroy(seat->wl_touch);
+	}
+	struct slurp_tablet_tool *tool, *tool_tmp;
+	wl_list_for_each_safe(tool, tool_tmp, &seat->tablet_tools, link) {
+		destroy_tablet_tool(tool);
+	}
+	if (seat->tablet_seat) {
+		zwp_tablet_seat_v2_destroy(seat->tablet_seat);
+	}
+	xkb_state_unref(seat->xkb_state);
+	xkb_keymap_unref(seat->xkb_keymap);
+	wl_seat_destroy(seat->wl_seat);
+	free(seat);
+}
+
+static void output_handle_geometry(void *data, struct wl_output *wl_output,
+		int32_t x, int32_t y, int32_t physical_width, int32_t physical_height,
+		int32_t subpixel, const char *make, const char *model,
+		int32_t transform) {
+	struct slurp_output *output = data;
+
+	output->geometry.x = x;
+	output->geometry.y = y;
+	output->transform = transform;
+}
+
+static void output_handle_mode(void *data, struct wl_output *wl_output,
+		uint32_t flags, int32_t width, int32_t height, int32_t refresh) {
+	struct slurp_output *output = data;
+	if ((flags & WL_OUTPUT_MODE_CURRENT) == 0) {
+		return;
+	}
+	output->geometry.width = width;
+	output->geometry.height = height;
+	output->refresh = refresh;
+}
+
+static void output_handle_scale(void *data, struct wl_output *wl_output,
+		int32_t scale) {
+	struct slurp_output *output = data;
+
+	output->scale = scale;
+}
+
+static const struct wl_output_listener output_listener = {
+	.geometry = output_handle_geometry,
+	.mode = output_handle_mode,
+	.done = noop,
+	.scale = output_handle_scale,
+};
+
+static void xdg_output_handle_logical_position(void *data,
+		struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y) {
+	struct slurp_output *output = data;
+	output->logical_geometry.x = x;
+	output->logical_geometry.y = y;
+}
+
+static void xdg_output_handle_logical_size(void *data,
+		struct zxdg_output_v1 *xdg_output, int32_t width, int32_t height) {
+	struct slurp_output *output = data;
+	output->logical_geometry.width = width;
+	output->logical_geometry.height = height;
+}
+
+static void xdg_output_handle_name(void *data, struct zxdg_output_v1 *xdg_output, const char *name) {
+	struct slurp_output *output = data;
+	output->logical_geometry.label = strdup(name);
+}
+
+static void xdg_output_handle_done(void *data,
+		struct zxdg_output_v1 *xdg_output) {
+	struct slurp_output *output = data;
+	output_index_build(&output->state->output_index, &output->state->outputs);
+}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+	.logical_position = xdg_output_handle_logical_position,
+	.logical_size = xdg_output_handle_logical_size,
+	.done = xdg_output_handle_done,
+	.name = xdg_output_handle_name,
+	.description = noop,
+};
+
+static void create_output(struct slurp_state *state,
+		struct wl_output *wl_output) {
+	struct slurp_output *output = calloc(1, sizeof(struct slurp_output));
+	if (output == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return;
+	}
+	output->wl_output = wl_output;
+	output->state = state;
+	output->scale = 1;
+	wl_list_insert(&state->outputs, &output->link);
+
+	wl_output_add_listener(wl_output, &output_listener, output);
+}
+
+/**
+ * Destroy the overlay of an output, keeping the output itself around.
+ */
+static void unmap_output(struct slurp_output *output) {
+	magnifier_finish_output(output);
+	content_edges_finish(&output->content_edges);
+	if (output->viewport) {
+		wp_viewport_destroy(output->viewport);
+		output->viewport = NULL;
+	}
+	if (output->frame_callback) {
+		wl_callback_destroy(output->frame_callback);
+		output->frame_callback = NULL;
+	}
+	if (output->layer_surface) {
+		zwlr_layer_surface_v1_destroy(output->layer_surface);
+		output->layer_surface = NULL;
+	}
+	if (output->surface) {
+		wl_surface_destroy(output->surface);
+		output->surface = NULL;
+	}
+	// The opaque region went with the surface
+	output->opaque = false;
+}
+
+static void destroy_output(struct slurp_output *output) {
+	if (output == NULL) {
+		return;
+	}
+	struct slurp_state *state = output->state;
+	wl_list_remove(&output->link);
+	output_index_build(&state->output_index, &state->outputs);
+	if (state->input_threaded && output->surface != NULL) {
+		input_thread_forget_surface(&state->input, output->surface);
+	}
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		if (seat->pointer_selection.current_output == output) {
+			seat->pointer_selection.current_output = NULL;
+		}
+		if (seat->touch_selection.current_output == output) {
+			touch_clear_state(seat);
+		}
+		struct slurp_tablet_tool *tool;
+		wl_list_for_each(tool, &seat->tablet_tools, link) {
+			if (tool->pending.output == output) {
+				tool->pending.output = NULL;
+			}
+			if (tool->selection.current_output == output) {
+				tool->selection.current_output = NULL;
+			}
+		}
+	}
+	struct slurp_box_layer *layer;
+	wl_list_for_each(layer, &state->layers, link) {
+		destroy_choice_rasters(layer, output);
+	}
+	finish_buffer(&output->buffers[0]);
+	finish_buffer(&output->buffers[1]);
+	capture_finish(&output->capture);
+	unmap_output(output);
+	if (output->xdg_output) {
+		zxdg_output_v1_destroy(output->xdg_output);
+	}
+	wl_output_destroy(output->wl_output);
+	free(output->logical_geometry.label);
+	free(output);
+}
+
+static const struct wl_callback_listener output_frame_listener;
+
+/**
+ * Update the selection drawn by the next frame. Returns true while the
+ * selection is predicted, which needs to be drawn again as time passes.
+ *
+ * Outputs draw their frames one after the other: the prediction is kept for a
+ * frame period, or until the selection moves, so that they all show the same
+ * one. Outputs showing the previous prediction or covered by the new one are
+ * dirtied.
+ */
+static bool seat_predict_selection(struct slurp_seat *seat,
+		struct slurp_selection *current_selection, double frame_period) {
+	struct slurp_state *state = seat->state;
+	struct slurp_motion *motion = &current_selection->motion;
+	double now = motion_now();
+	if (motion->active && current_selection->has_selection &&
+			motion->drawn && motion->drawn_x == current_selection->x &&
+			motion->drawn_y == current_selection->y &&
+			now - current_selection->predicted_at < frame_period) {
+		return current_selection->has_prediction;
+	}
+
+	bool had_prediction = current_selection->has_prediction;
+	struct slurp_box old = current_selection->predicted;
+	current_selection->has_prediction = false;
+	if (motion->active && current_selection->has_selection) {
+		int32_t x = current_selection->x;
+		int32_t y = current_selection->y;
+		motion->drawn = true;
+		motion->drawn_x = x;
+		motion->drawn_y = y;
+		current_selection->predicted_at = now;
+		if (state->predict &&
+				motion_predict(motion, now, frame_period, &x, &y)) {
+			selection_box_at(seat, current_selection, x, y,
+				&current_selection->predicted);
+			current_selection->predicted.label =
+				current_selection->selection.label;
+			current_selection->has_prediction = true;
+		}
+		motion->predicted_x = x;
+		motion->predicted_y = y;
+	}
+
+	if (had_prediction || current_selection->has_prediction) {
+		struct slurp_box damage = had_prediction ?
+			old : current_selection->predicted;
+		if (had_prediction && current_selection->has_prediction) {
+			const struct slurp_box *new = &current_selection->predicted;
+			int32_t x2 = max(old.x + old.width, new->x + new->width);
+			int32_t y2 = max(old.y + old.height, new->y + new->height);
+			damage.x = min(old.x, new->x);
+			damage.y = min(old.y, new->y);
+			damage.width = x2 - damage.x;
+			damage.height = y2 - damage.y;
+		}
+		set_box_outputs_dirty(state, &damage);
+	}
+	return current_selection->has_prediction;
+}
+
+/**
+ * Returns true if every pixel rendered for output is opaque. Everything is
+ * drawn over a frozen capture, but otherwise each color may punch a hole
+ * through the background.
+ */
+static bool output_is_opaque(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	if (state->frozen && output->capture.surface != NULL) {
+		return true;
+	}
+	uint32_t colors = state->colors.background & state->colors.border &
+		state->colors.selection & state->colors.choice;
+	return (colors & 0xFF) == 0xFF;
+}
+
+/**
+ * Returns the buffer format for output. Without alpha, the compositor
+ * doesn't need to blend the overlay.
+ */
+static uint32_t output_buffer_format(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	if (!output_is_opaque(output)) {
+		return WL_SHM_FORMAT_ARGB8888;
+	}
+	if (state->low_memory && state->shm_rgb565) {
+		return WL_SHM_FORMAT_RGB565;
+	}
+	return WL_SHM_FORMAT_XRGB8888;
+}
+
+static void send_frame(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+
+	if (!output->configured) {
+		return;
+	}
+	trace_begin("send_frame");
+
+	// At reduced scale, half resolution buffers are stretched by the viewport
+	bool reduced = output->quality >= SLURP_QUALITY_REDUCED_SCALE &&
+		output->viewport != NULL;
+	int32_t buffer_width = output->width * output->scale;
+	int32_t buffer_height = output->height * output->scale;
+	output->render_scale = output->scale;
+	if (reduced) {
+		buffer_width = (buffer_width + 1) / 2;
+		buffer_height = (buffer_height + 1) / 2;
+		output->render_scale = output->scale / 2.0;
+	}
+
+	uint32_t format = output_buffer_format(output);
+	trace_begin("get_next_buffer");
+	output->current_buffer = get_next_buffer(state->shm, &state->shm_stats,
+		output->buffers, buffer_width, buffer_height, format);
+	trace_end("get_next_buffer");
+	if (output->current_buffer == NULL) {
+		output->stats.dropped_frames++;
+		trace_end("send_frame");
+		return;
+	}
+	output->current_buffer->busy = true;
+
+	cairo_identity_matrix(output->current_buffer->cairo);
+	cairo_scale(output->current_buffer->cairo, output->render_scale,
+		output->render_scale);
+	cairo_translate(output->current_buffer->cairo, -output->logical_geometry.x, -output->logical_geometry.y);
+
+	// Schedule a frame in case the output becomes dirty again, which also
+	// keeps the prediction below from committing the surface early
+	if (output->frame_callback) {
+		wl_callback_destroy(output->frame_callback);
+	}
+	output->frame_callback = wl_surface_frame(output->surface);
+	wl_callback_add_listener(output->frame_callback,
+		&output_frame_listener, output);
+
+	// Extrapolate to the next refresh, assuming 60Hz if it's unknown
+	double frame_period = output->refresh > 0 ?
+		1e6 / output->refresh : 1000.0 / 60;
+	bool predicted = false;
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		predicted |= seat_predict_selection(seat,
+			slurp_seat_current_selection(seat), frame_period);
+	}
+
+	trace_begin("render");
+	double render_start = motion_now();
+	render(output);
+	double render_time = motion_now() - render_start;
+	trace_end("render");
+	state->quality_frames[output->quality]++;
+	struct slurp_output_stats *stats = &output->stats;
+	if (stats->frames == 0 || render_time < stats->render_min) {
+		stats->render_min = render_time;
+	}
+	if (render_time > stats->render_max) {
+		stats->render_max = render_time;
+	}
+	stats->render_total += render_time;
+	stats->frames++;
+	trace_counter("quality", output->quality);
+	governor_update(output, render_time);
+
+	// The opaque region is clipped to the surface, so it doesn't depend on
+	// its size
+	bool opaque = format != WL_SHM_FORMAT_ARGB8888;
+	if (opaque != output->opaque) {
+		struct wl_region *region = NULL;
+		if (opaque) {
+			region = wl_compositor_create_region(state->compositor);
+			wl_region_add(region, 0, 0, INT32_MAX, INT32_MAX);
+		}
+		wl_surface_set_opaque_region(output->surface, region);
+		if (region != NULL) {
+			wl_region_destroy(region);
+		}
+		output->opaque = opaque;
+	}
+
+	wl_surface_attach(output->surface, output->current_buffer->buffer, 0, 0);
+	wl_surface_damage(output->surface, 0, 0, output->width, output->height);
+	if (reduced) {
+		wp_viewport_set_destination(output->viewport,
+			output->width, output->height);
+		wl_surface_set_buffer_scale(output->surface, 1);
+	} else {
+		if (output->viewport != NULL) {
+			wp_viewport_set_destination(output->viewport, -1, -1);
+		}
+		wl_surface_set_buffer_scale(output->surface, output->scale);
+	}
+	wl_surface_commit(output->surface);
+	// Keep drawing until the prediction expires
+	output->dirty = predicted;
+	trace_end("send_frame");
+}
+
+static void output_frame_handle_done(void *data, struct wl_callback *callback,
+		uint32_t time) {
+	struct slurp_output *output = data;
+
+	wl_callback_destroy(callback);
+	output->frame_callback = NULL;
+
+	// Render the latest input, even if the main loop hasn't been woken up
+	// for it yet
+	struct slurp_state *state = output->state;
+	apply_input(state);
+
+	// The last frame with the selection has been presented
+	if (state->selection_changed && state->running) {
+		state->selection_changed = false;
+		if (state->selection_func != NULL) {
+			state->selection_func(&state->changed_selection,
+				state->selection_data);
+		}
+	}
+
+	if (!output->dirty && output->quality != SLURP_QUALITY_FULL) {
+		// Idle, draw the last frame again at full quality
+		output->quality = SLURP_QUALITY_FULL;
+		output->dirty = true;
+	}
+	if (output->dirty) {
+		send_frame(output);
+	}
+}
+
+static const struct wl_callback_listener output_frame_listener = {
+	.done = output_frame_handle_done,
+};
+
+static void set_output_dirty(struct slurp_output *output) {
+	output->dirty = true;
+	if (output->frame_callback) {
+		return;
+	}
+
+	output->frame_callback = wl_surface_frame(output->surface);
+	wl_callback_add_listener(output->frame_callback,
+		&output_frame_listener, output);
+	wl_surface_commit(output->surface);
+}
+
+// Tags the overlay surfaces, the connection may be shared with an embedder
+static const char *const surface_tag = "slurp";
+
+static struct slurp_output *output_from_surface(struct slurp_state *state,
+		struct wl_surface *surface) {
+	// Events queued by the input thread for surfaces destroyed since were
+	// cleared by input_thread_forget_surface
+	if (surface == NULL ||
+			wl_proxy_get_tag((struct wl_proxy *)surface) != &surface_tag) {
+		return NULL;
+	}
+	return wl_surface_get_user_data(surface);
+}
+
+
+static void layer_surface_handle_configure(void *data,
+		struct zwlr_layer_surface_v1 *surface,
+		uint32_t serial, uint32_t width, uint32_t height) {
+	struct slurp_output *output = data;
+
+	output->configured = true;
+	output->width = width;
+	output->height = height;
+
+	zwlr_layer_surface_v1_ack_configure(surface, serial);
+	send_frame(output);
+}
+
+static void layer_surface_handle_closed(void *data,
+		struct zwlr_layer_surface_v1 *surface) {
+	struct slurp_output *output = data;
+	destroy_output(output);
+}
+
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+	.configure = layer_surface_handle_configure,
+	.closed = layer_surface_handle_closed,
+};
+
+
+static void shm_handle_format(void *data, struct wl_shm *shm,
+		uint32_t format) {
+	struct slurp_state *state = data;
+	// ARGB8888 and XRGB8888 are always supported
+	if (format == WL_SHM_FORMAT_RGB565) {
+		state->shm_rgb565 = true;
+	}
+}
+
+static const struct wl_shm_listener shm_listener = {
+	.format = shm_handle_format,
+};
+
+static void handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version) {
+	struct slurp_state *state = data;
+
+	if (state->query && strcmp(interface, wl_output_interface.name) != 0 &&
+			strcmp(interface, zxdg_output_manager_v1_interface.name) != 0) {
+		return;
+	}
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		state->compositor = wl_registry_bind(registry, name,
+			&wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		state->shm = wl_registry_bind(registry, name,
+			&wl_shm_interface, 1);
+		wl_shm_add_listener(state->shm, &shm_listener, state);
+	} else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
+		state->layer_shell = wl_registry_bind(registry, name,
+			&zwlr_layer_shell_v1_interface, 1);
+	} else if (strcmp(interface, wl_seat_interface.name) == 0) {
+		struct wl_seat *wl_seat =
+			wl_registry_bind(registry, name, &wl_seat_interface, 1);
+		create_seat(state, wl_seat);
+	} else if (strcmp(interface, wl_output_interface.name) == 0) {
+		struct wl_output *wl_output =
+			wl_registry_bind(registry, name, &wl_output_interface, 3);
+		create_output(state, wl_output);
+	} else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
+		state->xdg_output_manager = wl_registry_bind(registry, name,
+			&zxdg_output_manager_v1_interface, 2);
+	} else if (strcmp(interface, wp_cursor_shape_manager_v1_interface.name) == 0) {
+		state->cursor_shape_manager = wl_registry_bind(registry, name,
+			&wp_cursor_shape_manager_v1_interface, 1);
+	} else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) == 0) {
+		state->screencopy_manager = wl_registry_bind(registry, name,
+			&zwlr_screencopy_manager_v1_interface, 1);
+	} else if (strcmp(interface, zwp_tablet_manager_v2_interface.name) == 0) {
+		state->tablet_manager = wl_registry_bind(registry, name,
+			&zwp_tablet_manager_v2_interface, 1);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		state->subcompositor = wl_registry_bind(registry, name,
+			&wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+		state->viewporter = wl_registry_bind(registry, name,
+			&wp_viewporter_interface, 1);
+	} else if (strcmp(interface, wl_data_device_manager_interface.name) == 0) {
+		state->data_device_manager = wl_registry_bind(registry, name,
+			&wl_data_device_manager_interface, 1);
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = noop,
+};
+
+static struct slurp_output *output_from_box(struct slurp_state *state,
+		const struct slurp_box *box) {
+	if (state->output_index.valid) {
+		// For now just use the top-left corner
+		struct slurp_box corner = { .x = box->x, .y = box->y,
+			.width = 1, .height = 1 };
+		uint64_t set = output_index_query(&state->output_index, &corner);
+		// The first output in the list wins, like a linear scan
+		return set ? state->output_index.outputs[__builtin_ctzll(set)] : NULL;
+	}
+
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		struct slurp_box *geometry = &output->logical_geometry;
+		// For now just use the top-left corner
+		if (slurp_box_contains(geometry, box->x, box->y)) {
+			return output;
+		}
+	}
+	return NULL;
+}
+
+void slurp_print_box(FILE *stream, const struct slurp_box *result,
+		const struct slurp_box *output, const char *format) {
+	struct slurp_format *compiled =
+		slurp_format_compile(format, SLURP_FORMAT_TEXT);
+	if (compiled == NULL) {
+		return;
+	}
+	slurp_format_append(compiled, result, output);
+	size_t len;
+	const char *data = slurp_format_data(compiled, &len);
+	if (len > 0) {
+		fwrite(data, 1, len, stream);
+	}
+	slurp_format_destroy(compiled);
+}
+
+/**
+ * Update the indices and rasters of layer for box, added after the others.
+ * Until slurp_start builds the indices, there is nothing to update.
+ */
+static void layer_box_added(struct slurp_box_layer *layer,
+		struct slurp_box *box) {
+	if (!hit_index_add(&layer->hit_index, box) ||
+			!label_index_add(&layer->label_index, box)) {
+		fprintf(stderr, "allocation failed\n");
+	}
+	update_choice_rasters(layer, box);
+}
+
+static struct slurp_box *add_choice_box(struct slurp_box_layer *layer,
+		const struct slurp_box *box) {
+	struct slurp_box *b = calloc(1, sizeof(struct slurp_box));
+	if (b == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	*b = *box;
+	// copy label, so that this has ownership of its label
+	if (box->label) {
+		b->label = strdup(box->label);
+	}
+	wl_list_insert(layer->boxes.prev, &b->link);
+	layer_box_added(layer, b);
+	return b;
+}
+
+static void destroy_choice_box(struct slurp_state *state,
+		struct slurp_box_layer *layer, struct slurp_box *box) {
+	// Selections hold a copy of the box, don't leave them with a dangling
+	// label
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		if (seat->pointer_selection.selection.label == box->label) {
+			seat->pointer_selection.selection.label = NULL;
+		}
+		if (seat->touch_selection.selection.label == box->label) {
+			seat->touch_selection.selection.label = NULL;
+		}
+		struct slurp_tablet_tool *tool;
+		wl_list_for_each(tool, &seat->tablet_tools, link) {
+			if (tool->selection.selection.label == box->label) {
+				tool->selection.selection.label = NULL;
+			}
+		}
+	}
+	if (state->result.label == box->label) {
+		state->result.label = NULL;
+	}
+	// Its area was dirtied by the caller
+	if (state->filter.best == box) {
+		state->filter.best = NULL;
+	}
+
+	hit_index_remove(&layer->hit_index, box);
+	label_index_remove(&layer->label_index, box);
+	wl_list_remove(&box->link);
+	struct slurp_box area = *box;
+	area.label = NULL;
+	update_choice_rasters(layer, &area);
+	free(box->label);
+	free(box);
+}
+
+static struct slurp_box_layer *get_layer(struct slurp_state *state,
+		const char *name) {
+	struct slurp_box_layer *layer;
+	wl_list_for_each(layer, &state->layers, link) {
+		if (name == NULL ? layer->name == NULL :
+				layer->name != NULL && strcmp(layer->name, name) == 0) {
+			return layer;
+		}
+	}
+
+	layer = calloc(1, sizeof(struct slurp_box_layer));
+	if (layer == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	if (name != NULL && (layer->name = strdup(name)) == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		free(layer);
+		return NULL;
+	}
+	wl_list_init(&layer->boxes);
+	wl_list_init(&layer->rasters);
+	// Layers are cycled through in order, starting with the default one
+	if (name == NULL) {
+		wl_list_insert(&state->layers, &layer->link);
+	} else {
+		wl_list_insert(state->layers.prev, &layer->link);
+	}
+	return layer;
+}
+
+static void destroy_layer(struct slurp_box_layer *layer) {
+	struct slurp_box *box, *box_tmp;
+	wl_list_for_each_safe(box, box_tmp, &layer->boxes, link) {
+		wl_list_remove(&box->link);
+		free(box->label);
+		free(box);
+	}
+	destroy_choice_rasters(layer, NULL);
+	edge_index_finish(&layer->edge_index);
+	hit_index_finish(&layer->hit_index);
+	label_index_finish(&layer->label_index);
+	wl_list_remove(&layer->link);
+	free(layer->name);
+	free(layer);
+}
+
+static struct slurp_box_layer *get_edit_layer(struct slurp_state *state) {
+	if (state->edit_layer == NULL) {
+		state->edit_layer = get_layer(state, NULL);
+	}
+	return state->edit_layer;
+}
+
+static bool box_matches(const struct slurp_box *a, const struct slurp_box *b) {
+	if (a->x != b->x || a->y != b->y ||
+			a->width != b->width || a->height != b->height) {
+		return false;
+	}
+	// A record without a label matches any label
+	return b->label == NULL ||
+		(a->label != NULL && strcmp(a->label, b->label) == 0);
+}
+
+static bool parse_cursor_size(struct slurp_state *state) {
+	state->cursor_theme_name = getenv("XCURSOR_THEME");
+	const char *cursor_size_str = getenv("XCURSOR_SIZE");
+	state->cursor_size = 24;
+	if (cursor_size_str != NULL) {
+		char *end;
+		errno = 0;
+		state->cursor_size = strtol(cursor_size_str, &end, 10);
+		if (errno != 0 || cursor_size_str[0] == '\0' || end[0] != '\0') {
+			fprintf(stderr, "invalid XCURSOR_SIZE value\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+static void destroy_cursor_themes(struct slurp_state *state) {
+	struct slurp_cursor_theme *cursor, *cursor_tmp;
+	wl_list_for_each_safe(cursor, cursor_tmp, &state->cursor_themes, link) {
+		if (cursor->theme != NULL) {
+			wl_cursor_theme_destroy(cursor->theme);
+		}
+		wl_list_remove(&cursor->link);
+		free(cursor);
+	}
+}
+
+static int roundtrip(struct slurp_state *state) {
+	trace_begin("roundtrip");
+	int ret = wl_display_roundtrip_queue(state->display, state->queue);
+	trace_end("roundtrip");
+	return ret;
+}
+
+/**
+ * The set of boxes changed under the seats, update their hovered box.
+ */
+static void refresh_hovered_boxes(struct slurp_state *state) {
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		if (seat->button_state == WL_POINTER_BUTTON_STATE_RELEASED &&
+				seat->pointer_selection.current_output != NULL) {
+			seat_set_outputs_dirty(seat);
+			seat_update_selection(seat, &seat->pointer_selection);
+			seat_set_outputs_dirty(seat);
+		}
+		struct slurp_tablet_tool *tool;
+		wl_list_for_each(tool, &seat->tablet_tools, link) {
+			if (!tool->down && tool->selection.current_output != NULL) {
+				seat_set_outputs_dirty(seat);
+				seat_update_selection(seat, &tool->selection);
+				seat_set_outputs_dirty(seat);
+			}
+		}
+	}
+}
+
+/**
+ * Pick the match whose label starts with the query, or the first one.
+ */
+static struct slurp_box *filter_best_match(const struct box_filter *filter,
+		const struct label_index *index) {
+	if (filter->matches_len == 0) {
+		return NULL;
+	}
+	for (size_t i = 0; i < filter->matches_len; i++) {
+		if (label_index_has_prefix(index, filter->matches[i], filter->query,
+				filter->query_len)) {
+			return index->boxes[filter->matches[i]];
+		}
+	}
+	return index->boxes[filter->matches[0]];
+}
+
+static bool filter_was_matched(const struct box_filter *filter, uint32_t id) {
+	return id < filter->matched_len && filter->matched[id];
+}
+
+/**
+ * Match the labels of the active layer against the query, and redraw the
+ * boxes which appeared or disappeared.
+ */
+static void update_filter(struct slurp_state *state) {
+	struct slurp_box_layer *layer = state->layer;
+	struct label_index *index = &layer->label_index;
+	struct box_filter *filter = &state->filter;
+
+	// The ids were assigned again or another layer is active, the old ones
+	// are meaningless
+	bool redraw_all = filter->layer != layer || !index->valid;
+	if (!index->valid && !label_index_build(index, &layer->boxes)) {
+		fprintf(stderr, "allocation failed\n");
+		return;
+	}
+
+	uint32_t *matches = NULL;
+	uint8_t *matched = NULL;
+	size_t matches_len = 0;
+	bool active = filter->query_len > 0;
+	if (active) {
+		size_t len = index->len ? index->len : 1;
+		matches = malloc(len * sizeof(uint32_t));
+		matched = calloc(len, sizeof(uint8_t));
+		if (matches == NULL || matched == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			free(matches);
+			free(matched);
+			return;
+		}
+		filter->query[filter->query_len] = '\0';
+		matches_len = label_index_search(index, filter->query, matches);
+		for (size_t i = 0; i < matches_len; i++) {
+			matched[matches[i]] = 1;
+		}
+	}
+
+	struct slurp_box *previous_best = filter->best;
+	if (redraw_all) {
+		set_all_outputs_dirty(state);
+	} else if (filter->active && active) {
+		// Removed boxes were dirtied along with their removal
+		for (size_t i = 0; i < filter->matches_len; i++) {
+			struct slurp_box *box = index->boxes[filter->matches[i]];
+			if (!matched[filter->matches[i]] && box != NULL) {
+				set_box_outputs_dirty(state, box);
+			}
+		}
+		for (size_t i = 0; i < matches_len; i++) {
+			if (!filter_was_matched(filter, matches[i])) {
+				set_box_outputs_dirty(state, index->boxes[matches[i]]);
+			}
+		}
+	} else if (filter->active || active) {
+		// All boxes are displayed without a query, and those without a label
+		// never match
+		for (size_t id = 0; id < index->len; id++) {
+			bool shown = active ? matched[id] : filter_was_matched(filter, id);
+			if (!shown && index->boxes[id] != NULL) {
+				set_box_outputs_dirty(state, index->boxes[id]);
+			}
+		}
+		struct slurp_box *box;
+		wl_list_for_each(box, &layer->boxes, link) {
+			if (box->label == NULL) {
+				set_box_outputs_dirty(state, box);
+			}
+		}
+	}
+
+	free(filter->matches);
+	free(filter->matched);
+	filter->matches = matches;
+	filter->matched = matched;
+	filter->matched_len = active ? index->len : 0;
+	filter->matches_len = matches_len;
+	filter->active = active;
+	filter->layer = layer;
+	filter->best = active ? filter_best_match(filter, index) : NULL;
+	if (!redraw_all && filter->best != previous_best) {
+		if (previous_best != NULL) {
+			set_box_outputs_dirty(state, previous_best);
+		}
+		if (filter->best != NULL) {
+			set_box_outputs_dirty(state, filter->best);
+		}
+	}
+	refresh_hovered_boxes(state);
+}
+
+void slurp_options_init(struct slurp_options *options) {
+	*options = (struct slurp_options){
+		.background_color = BG_COLOR,
+		.border_color = BORDER_COLOR,
+		.selection_color = SELECTION_COLOR,
+		.choice_color = BG_COLOR,
+		.font_family = FONT_FAMILY,
+		.border_weight = 2,
+	};
+}
+
+struct slurp_state *slurp_create(struct wl_display *display,
+		const struct slurp_options *options) {
+	struct slurp_state *state = calloc(1, sizeof(struct slurp_state));
+	if (state == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	state->display = display;
+	state->query = options->query;
+	state->colors.background = options->background_color;
+	state->colors.border = options->border_color;
+	state->colors.selection = options->selection_color;
+	state->colors.choice = options->choice_color;
+	state->font_family = options->font_family;
+	state->border_weight = options->border_weight;
+	state->display_dimensions = options->display_dimensions;
+	state->single_point = options->single_point;
+	state->restrict_selection = options->restrict_selection;
+	state->crosshairs = options->crosshairs;
+	state->output_boxes = options->output_boxes;
+	state->filter_labels = options->filter_labels;
+	state->fixed_aspect_ratio = options->aspect_ratio > 0;
+	state->aspect_ratio = options->aspect_ratio;
+	state->snap_threshold = options->snap_threshold;
+	state->content_snap = options->content_snap;
+	state->magnifier_zoom = options->magnifier_zoom;
+	state->predict = options->predict;
+	state->frame_budget = options->frame_budget;
+	state->frozen = options->frozen;
+	state->low_memory = options->low_memory;
+	wl_list_init(&state->layers);
+	wl_list_init(&state->cursor_themes);
+	wl_list_init(&state->outputs);
+	wl_list_init(&state->seats);
+	// Nothing is mapped until slurp_start
+	state->unmapped = true;
+
+	if (!state->query &&
+			(state->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS)) == NULL) {
+		fprintf(stderr, "xkb_context_new failed\n");
+		slurp_destroy(state);
+		return NULL;
+	}
+
+	// Started before the seats are bound, so that it reads all their events
+	if (!state->query && options->input_thread) {
+		state->input_threaded = true;
+		if (!input_thread_init(&state->input, display) ||
+				!input_thread_start(&state->input)) {
+			slurp_destroy(state);
+			return NULL;
+		}
+	}
+
+	state->queue = wl_display_create_queue(display);
+	state->display_wrapper = state->queue != NULL ?
+		wl_proxy_create_wrapper(display) : NULL;
+	if (state->display_wrapper == NULL) {
+		fprintf(stderr, "failed to create event queue\n");
+		slurp_destroy(state);
+		return NULL;
+	}
+	// Objects inherit the queue of the proxy they are created from
+	wl_proxy_set_queue((struct wl_proxy *)state->display_wrapper,
+		state->queue);
+
+	trace_begin("registry");
+	state->registry = wl_display_get_registry(state->display_wrapper);
+	wl_registry_add_listener(state->registry, &registry_listener, state);
+	roundtrip(state);
+	trace_end("registry");
+
+	struct slurp_output *output;
+	if (state->query) {
+		wl_list_for_each(output, &state->outputs, link) {
+			if (state->xdg_output_manager) {
+				output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+					state->xdg_output_manager, output->wl_output);
+				zxdg_output_v1_add_listener(output->xdg_output,
+					&xdg_output_listener, output);
+			}
+		}
+		// wl_output and xdg-output events
+		roundtrip(state);
+
+		if (!state->xdg_output_manager) {
+			wl_list_for_each(output, &state->outputs, link) {
+				// guess
+				output->logical_geometry = output->geometry;
+				output->logical_geometry.width /= output->scale;
+				output->logical_geometry.height /= output->scale;
+			}
+		}
+		output_index_build(&state->output_index, &state->outputs);
+		return state;
+	}
+
+	const char *missing = NULL;
+	if (state->compositor == NULL) {
+		missing = "wl_compositor";
+	} else if (state->shm == NULL) {
+		missing = "wl_shm";
+	} else if (state->layer_shell == NULL) {
+		missing = "zwlr_layer_shell_v1";
+	} else if ((state->magnifier_zoom > 0 || state->frozen ||
+			state->content_snap || options->capture_result) &&
+			state->screencopy_manager == NULL) {
+		missing = "wlr-screencopy";
+	} else if (options->clipboard && state->data_device_manager == NULL) {
+		missing = "wl_data_device_manager";
+	}
+	if (missing != NULL) {
+		fprintf(stderr, "compositor doesn't support %s\n", missing);
+		slurp_destroy(state);
+		return NULL;
+	}
+	if (state->xdg_output_manager == NULL) {
+		fprintf(stderr, "compositor doesn't support xdg-output. "
+			"Guessing geometry from physical output size.\n");
+	}
+	if (wl_list_empty(&state->outputs)) {
+		fprintf(stderr, "no wl_output\n");
+		slurp_destroy(state);
+		return NULL;
+	}
+	if (state->magnifier_zoom > 0 && state->subcompositor == NULL) {
+		fprintf(stderr, "compositor doesn't support wl_subcompositor, "
+			"can't display the magnifier\n");
+		slurp_destroy(state);
+		return NULL;
+	}
+	return state;
+}
+
+bool slurp_start(struct slurp_state *state) {
+	if (state->query) {
+		fprintf(stderr, "can't start a selection in query mode\n");
+		return false;
+	}
+
+	struct slurp_output *output;
+	if (state->magnifier_zoom > 0 || state->frozen || state->content_snap) {
+		// Capture before the overlay is mapped, so that it isn't captured
+		if (!capture_outputs(state)) {
+			fprintf(stderr, "failed to capture outputs\n");
+			return false;
+		}
+	}
+	if (state->frozen) {
+		// The background color is blended once, not on every frame. The
+		// captures stay untinted for the selection, the lens and -E.
+		wl_list_for_each(output, &state->outputs, link) {
+			if (!capture_tint(&output->capture, state->colors.background)) {
+				fprintf(stderr, "failed to tint capture, "
+					"tinting every frame instead\n");
+			}
+		}
+	}
+	if (state->content_snap) {
+		uint32_t threshold = state->snap_threshold > 0 ?
+			state->snap_threshold : CONTENT_SNAP_THRESHOLD;
+		wl_list_for_each(output, &state->outputs, link) {
+			// Analyzed in the background, snapping starts once it's done.
+			// The logical geometry isn't known yet, use the integer scale.
+			content_edges_start(&output->content_edges, &output->capture,
+				threshold * output->scale);
+		}
+	}
+
+	// Input events and frames may already come during the roundtrip below
+	struct slurp_box_layer *default_layer = NULL;
+	if (state->output_boxes || wl_list_empty(&state->layers)) {
+		default_layer = get_layer(state, NULL);
+		if (default_layer == NULL) {
+			return false;
+		}
+	}
+	state->layer = wl_container_of(state->layers.next, state->layer, link);
+
+	state->unmapped = false;
+	wl_list_for_each(output, &state->outputs, link) {
+		output->surface = wl_compositor_create_surface(state->compositor);
+		wl_surface_set_user_data(output->surface, output);
+		wl_proxy_set_tag((struct wl_proxy *)output->surface, &surface_tag);
+		// TODO: wl_surface_add_listener(output->surface, &surface_listener, output);
+
+		output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+			state->layer_shell, output->surface, output->wl_output,
+			ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "selection");
+		zwlr_layer_surface_v1_add_listener(output->layer_surface,
+		  &layer_surface_listener, output);
+
+		if (state->magnifier_zoom > 0) {
+			magnifier_init_output(output);
+		}
+		if (state->frame_budget > 0 && state->viewporter) {
+			output->viewport = wp_viewporter_get_viewport(state->viewporter,
+				output->surface);
+		}
+
+		if (state->xdg_output_manager) {
+			output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+				state->xdg_output_manager, output->wl_output);
+			zxdg_output_v1_add_listener(output->xdg_output,
+				&xdg_output_listener, output);
+		} else {
+			// guess
+			output->logical_geometry = output->geometry;
+			output->logical_geometry.width /= output->scale;
+			output->logical_geometry.height /= output->scale;
+		}
+
+		zwlr_layer_surface_v1_set_anchor(output->layer_surface,
+			ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+			ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+			ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
+			ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM);
+		zwlr_layer_surface_v1_set_keyboard_interactivity(output->layer_surface, true);
+		zwlr_layer_surface_v1_set_exclusive_zone(output->layer_surface, -1);
+		wl_surface_commit(output->surface);
+	}
+	// second roundtrip for xdg-output
+	roundtrip(state);
+	output_index_build(&state->output_index, &state->outputs);
+
+	// Cursor themes are loaded when the pointer first enters each scale
+	if (!state->cursor_shape_manager && !parse_cursor_size(state)) {
+		return false;
+	}
+
+	// Outputs are selectable along with the boxes of the default layer
+	if (state->output_boxes) {
+		wl_list_for_each(output, &state->outputs, link) {
+			add_choice_box(default_layer, &output->logical_geometry);
+		}
+	}
+
+	struct slurp_box_layer *layer;
+	wl_list_for_each(layer, &state->layers, link) {
+		if (state->snap_threshold > 0 &&
+				!edge_index_build(&layer->edge_index, &layer->boxes)) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+		if (!layer_build_hit_index(state, layer)) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+		// Typing must not wait for the labels to be indexed
+		if (state->filter_labels &&
+				!label_index_build(&layer->label_index, &layer->boxes)) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+	}
+
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		start_seat(seat);
+	}
+
+	// A keymap may have failed to load in the meantime
+	if (state->failed) {
+		return false;
+	}
+	state->running = true;
+	return true;
+}
+
+bool slurp_is_running(struct slurp_state *state) {
+	return state->running;
+}
+
+void slurp_cancel(struct slurp_state *state) {
+	state->running = false;
+}
+
+void slurp_unmap(struct slurp_state *state) {
+	if (state->unmapped) {
+		return;
+	}
+	state->running = false;
+	// Input devices go first, nothing must touch the overlay once it's gone.
+	// The input thread dispatches events with the seats as listener data.
+	if (state->input_threaded) {
+		input_thread_stop(&state->input);
+		input_thread_drop(&state->input);
+	}
+	struct slurp_seat *seat, *seat_tmp;
+	wl_list_for_each_safe(seat, seat_tmp, &state->seats, link) {
+		destroy_seat(seat);
+	}
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		unmap_output(output);
+	}
+	// Make sure the compositor has unmapped our surfaces
+	roundtrip(state);
+	state->unmapped = true;
+}
+
+void slurp_destroy(struct slurp_state *state) {
+	if (state == NULL) {
+		return;
+	}
+	slurp_unmap(state);
+
+	if (state->data_source != NULL) {
+		wl_data_source_destroy(state->data_source);
+	}
+	if (state->data_device != NULL) {
+		wl_data_device_destroy(state->data_device);
+	}
+	free(state->clipboard);
+
+	// Also running when the overlay was never mapped
+	if (state->input_threaded) {
+		input_thread_stop(&state->input);
+	}
+	struct slurp_output *output, *output_tmp;
+	wl_list_for_each_safe(output, output_tmp, &state->outputs, link) {
+		destroy_output(output);
+	}
+	struct slurp_seat *seat, *seat_tmp;
+	wl_list_for_each_safe(seat, seat_tmp, &state->seats, link) {
+		destroy_seat(seat);
+	}
+	if (state->input_threaded) {
+		input_thread_finish(&state->input);
+	}
+
+	if (state->layer_shell != NULL) {
+		zwlr_layer_shell_v1_destroy(state->layer_shell);
+	}
+	if (state->xdg_output_manager != NULL) {
+		zxdg_output_manager_v1_destroy(state->xdg_output_manager);
+	}
+	if (state->cursor_shape_manager != NULL) {
+		wp_cursor_shape_manager_v1_destroy(state->cursor_shape_manager);
+	}
+	if (state->screencopy_manager != NULL) {
+		zwlr_screencopy_manager_v1_destroy(state->screencopy_manager);
+	}
+	if (state->subcompositor != NULL) {
+		wl_subcompositor_destroy(state->subcompositor);
+	}
+	if (state->viewporter != NULL) {
+		wp_viewporter_destroy(state->viewporter);
+	}
+	if (state->data_device_manager != NULL) {
+		wl_data_device_manager_destroy(state->data_device_manager);
+	}
+	if (state->tablet_manager != NULL) {
+		zwp_tablet_manager_v2_destroy(state->tablet_manager);
+	}
+	if (state->compositor != NULL) {
+		wl_compositor_destroy(state->compositor);
+	}
+	if (state->shm != NULL) {
+		wl_shm_destroy(state->shm);
+	}
+	if (state->registry != NULL) {
+		wl_registry_destroy(state->registry);
+	}
+	if (state->display_wrapper != NULL) {
+		wl_proxy_wrapper_destroy(state->display_wrapper);
+	}
+	if (state->queue != NULL) {
+		wl_event_queue_destroy(state->queue);
+	}
+	xkb_context_unref(state->xkb_context);
+
+	// After the seats, whose cursor surfaces may still use the buffers
+	destroy_cursor_themes(state);
+
+	struct slurp_box_layer *layer, *layer_tmp;
+	wl_list_for_each_safe(layer, layer_tmp, &state->layers, link) {
+		destroy_layer(layer);
+	}
+	free(state->filter.matches);
+	free(state->filter.matched);
+
+	free(state);
+}
+
+/**
+ * The boxes of the active layer changed.
+ */
+static void refresh_visible_boxes(struct slurp_state *state) {
+	if (state->filter.active) {
+		update_filter(state);
+	} else {
+		refresh_hovered_boxes(state);
+	}
+}
+
+bool slurp_set_layer(struct slurp_state *state, const char *name) {
+	struct slurp_box_layer *layer = get_layer(state, name);
+	if (layer == NULL) {
+		return false;
+	}
+	state->edit_layer = layer;
+	return true;
+}
+
+bool slurp_add_boxes(struct slurp_state *state,
+		const struct slurp_box *boxes, size_t len) {
+	struct slurp_box_layer *layer = get_edit_layer(state);
+	if (layer == NULL) {
+		return false;
+	}
+	// Only the active layer is displayed
+	bool visible = state->running && layer == state->layer;
+	bool ok = true;
+	for (size_t i = 0; i < len; i++) {
+		struct slurp_box *box = add_choice_box(layer, &boxes[i]);
+		if (box == NULL) {
+			ok = false;
+			break;
+		}
+		// Before slurp_start, the edge index is built from all boxes at once
+		if (!state->running) {
+			continue;
+		}
+		if (state->snap_threshold > 0 &&
+				!edge_index_add(&layer->edge_index, box)) {
+			fprintf(stderr, "allocation failed\n");
+		}
+		if (visible) {
+			set_box_outputs_dirty(state, box);
+		}
+	}
+	if (visible) {
+		refresh_visible_boxes(state);
+	}
+	return ok;
+}
+
+bool slurp_remove_box(struct slurp_state *state,
+		const struct slurp_box *box) {
+	struct slurp_box_layer *layer = get_edit_layer(state);
+	if (layer == NULL) {
+		return false;
+	}
+	bool visible = state->running && layer == state->layer;
+	struct slurp_box *b;
+	wl_list_for_each(b, &layer->boxes, link) {
+		if (!box_matches(b, box)) {
+			continue;
+		}
+		if (state->running && state->snap_threshold > 0) {
+			edge_index_remove(&layer->edge_index, b);
+		}
+		if (visible) {
+			set_box_outputs_dirty(state, b);
+		}
+		destroy_choice_box(state, layer, b);
+		if (visible) {
+			refresh_visible_boxes(state);
+		}
+		return true;
+	}
+	return false;
+}
+
+void slurp_clear_boxes(struct slurp_state *state) {
+	struct slurp_box_layer *layer = get_edit_layer(state);
+	if (layer == NULL) {
+		return;
+	}
+	bool visible = state->running && layer == state->layer;
+	// Start over instead of updating everything for each box
+	bool indexed = layer->hit_index.valid;
+	bool labels_indexed = layer->label_index.valid;
+	hit_index_finish(&layer->hit_index);
+	label_index_finish(&layer->label_index);
+	destroy_choice_rasters(layer, NULL);
+	struct slurp_box *box, *box_tmp;
+	wl_list_for_each_safe(box, box_tmp, &layer->boxes, link) {
+		if (visible) {
+			set_box_outputs_dirty(state, box);
+		}
+		destroy_choice_box(state, layer, box);
+	}
+	layer->edge_index.x.len = layer->edge_index.y.len = 0;
+	if (state->filter.layer == layer) {
+		// The ids of its matches are gone with the label index
+		state->filter.matches_len = 0;
+		state->filter.matched_len = 0;
+	}
+	if ((indexed && !layer_build_hit_index(state, layer)) ||
+			(labels_indexed &&
+				!label_index_build(&layer->label_index, &layer->boxes))) {
+		fprintf(stderr, "allocation failed\n");
+	}
+	if (visible) {
+		refresh_visible_boxes(state);
+	}
+}
+
+void slurp_get_quality_frames(struct slurp_state *state,
+		uint64_t frames[static SLURP_QUALITY_LEVELS]) {
+	memcpy(frames, state->quality_frames, sizeof(state->quality_frames));
+}
+
+void slurp_get_stats(struct slurp_state *state, struct slurp_stats *stats) {
+	*stats = (struct slurp_stats){
+		.motion_events = state->motion_events,
+		.coalesced_motion_events = state->coalesced_motion_events,
+		.shm_allocated = state->shm_stats.allocated,
+		.shm_mapped = state->shm_stats.mapped,
+		.buffer_resizes = state->shm_stats.resizes,
+	};
+}
+
+bool slurp_get_output_stats(struct slurp_state *state, size_t index,
+		struct slurp_output_stats *stats) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (index-- == 0) {
+			*stats = output->stats;
+			return true;
+		}
+	}
+	return false;
+}
+
+int slurp_dispatch_pending(struct slurp_state *state) {
+	return wl_display_dispatch_queue_pending(state->display, state->queue);
+}
+
+int slurp_get_input_fd(struct slurp_state *state) {
+	return state->input_threaded ? state->input.wake_fd : -1;
+}
+
+void slurp_dispatch_input(struct slurp_state *state) {
+	if (!state->input_threaded) {
+		return;
+	}
+	input_thread_clear_wake(&state->input);
+	apply_input(state);
+}
+
+void slurp_set_selection_handler(struct slurp_state *state,
+		slurp_selection_func func, void *data) {
+	state->selection_func = func;
+	state->selection_data = data;
+}
+
+bool slurp_has_failed(struct slurp_state *state) {
+	return state->failed;
+}
+
+const struct slurp_box *slurp_get_result(struct slurp_state *state) {
+	if (state->failed ||
+			(state->result.width == 0 && state->result.height == 0)) {
+		return NULL;
+	}
+	return &state->result;
+}
+
+const struct slurp_box *slurp_find_output(struct slurp_state *state,
+		const struct slurp_box *box) {
+	struct slurp_output *output = output_from_box(state, box);
+	return output ? &output->logical_geometry : NULL;
+}
+
+const struct slurp_box *slurp_get_output(struct slurp_state *state,
+		size_t index) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (index-- == 0) {
+			return &output->logical_geometry;
+		}
+	}
+	return NULL;
+}
+
+static bool write_image(struct slurp_state *state, const char *path) {
+	bool to_stdout = strcmp(path, "-") == 0;
+	FILE *stream = to_stdout ? stdout : fopen(path, "wb");
+	if (stream == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	enum image_format format = to_stdout ?
+		IMAGE_FORMAT_PNG : image_format_from_path(path);
+	trace_begin("write_image");
+	bool ok = write_region_image(state, &state->result, format, stream);
+	trace_end("write_image");
+	if (!to_stdout && fclose(stream) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		fprintf(stderr, "failed to write image to %s\n", path);
+	}
+	return ok;
+}
+
+bool slurp_save_result_image(struct slurp_state *state, const char *path) {
+	if (slurp_get_result(state) == NULL) {
+		return false;
+	}
+	if (state->screencopy_manager == NULL) {
+		fprintf(stderr, "compositor doesn't support wlr-screencopy\n");
+		return false;
+	}
+	slurp_unmap(state);
+
+	trace_begin("capture_region");
+	bool ok = capture_region(state, &state->result);
+	trace_end("capture_region");
+	if (!ok) {
+		fprintf(stderr, "failed to capture selection\n");
+	} else {
+		ok = write_image(state, path);
+	}
+
+	// Don't keep the buffers around, e.g. in a process serving the clipboard
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		capture_finish(&output->capture);
+	}
+	return ok;
+}
+
+static void data_source_handle_send(void *data, struct wl_data_source *source,
+		const char *mime_type, int32_t fd) {
+	struct slurp_state *state = data;
+	size_t offset = 0;
+	while (offset < state->clipboard_len) {
+		ssize_t n = write(fd, &state->clipboard[offset],
+			state->clipboard_len - offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			// The client gave up on the paste
+			break;
+		}
+		offset += n;
+	}
+	close(fd);
+}
+
+static void data_source_handle_cancelled(void *data,
+		struct wl_data_source *source) {
+	struct slurp_state *state = data;
+	wl_data_source_destroy(source);
+	state->data_source = NULL;
+}
+
+static const struct wl_data_source_listener data_source_listener = {
+	.target = noop,
+	.send = data_source_handle_send,
+	.cancelled = data_source_handle_cancelled,
+};
+
+static void data_device_handle_enter(void *data,
+		struct wl_data_device *device, uint32_t serial,
+		struct wl_surface *surface, wl_fixed_t x, wl_fixed_t y,
+		struct wl_data_offer *offer) {
+	// Nothing is ever dropped on the overlay
+	if (offer != NULL) {
+		wl_data_offer_destroy(offer);
+	}
+}
+
+static void data_device_handle_selection(void *data,
+		struct wl_data_device *device, struct wl_data_offer *offer) {
+	if (offer != NULL) {
+		wl_data_offer_destroy(offer);
+	}
+}
+
+static const struct wl_data_device_listener data_device_listener = {
+	.data_offer = noop,
+	.enter = data_device_handle_enter,
+	.leave = noop,
+	.motion = noop,
+	.drop = noop,
+	.selection = data_device_handle_selection,
+};
+
+static const char *const clipboard_mime_types[] = {
+	"text/plain;charset=utf-8",
+	"text/plain",
+	"UTF8_STRING",
+	"TEXT",
+	"STRING",
+};
+
+/**
+ * Free what only the overlay needs, keeping the outputs and the boxes the
+ * result may refer to.
+ */
+static void release_overlay(struct slurp_state *state) {
+	if (state->input_threaded) {
+		input_thread_finish(&state->input);
+		state->input_threaded = false;
+	}
+	struct slurp_box_layer *layer;
+	wl_list_for_each(layer, &state->layers, link) {
+		destroy_choice_rasters(layer, NULL);
+	}
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		finish_buffer(&output->buffers[0]);
+		finish_buffer(&output->buffers[1]);
+		output->current_buffer = NULL;
+		capture_finish(&output->capture);
+	}
+	// The cursor surfaces went with the seats
+	destroy_cursor_themes(state);
+}
+
+bool slurp_offer_clipboard(struct slurp_state *state, const char *data,
+		size_t len) {
+	if (state->data_device_manager == NULL) {
+		fprintf(stderr, "compositor doesn't support wl_data_device_manager\n");
+		return false;
+	}
+	// The compositor only accepts the serial of an input event sent to
+	// the overlay, which must still be mapped
+	if (state->unmapped || state->input_seat == NULL) {
+		fprintf(stderr, "no input event to set the clipboard with\n");
+		return false;
+	}
+
+	char *clipboard = malloc(len > 0 ? len : 1);
+	if (clipboard == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	memcpy(clipboard, data, len);
+	free(state->clipboard);
+	state->clipboard = clipboard;
+	state->clipboard_len = len;
+
+	if (state->data_device == NULL) {
+		state->data_device = wl_data_device_manager_get_data_device(
+			state->data_device_manager, state->input_seat->wl_seat);
+		wl_data_device_add_listener(state->data_device,
+			&data_device_listener, state);
+	}
+	if (state->data_source != NULL) {
+		wl_data_source_destroy(state->data_source);
+	}
+	state->data_source = wl_data_device_manager_create_data_source(
+		state->data_device_manager);
+	wl_data_source_add_listener(state->data_source,
+		&data_source_listener, state);
+	for (size_t i = 0; i < sizeof(clipboard_mime_types) /
+			sizeof(clipboard_mime_types[0]); i++) {
+		wl_data_source_offer(state->data_source, clipboard_mime_types[i]);
+	}
+	wl_data_device_set_selection(state->data_device, state->data_source,
+		state->input_seat->serial);
+
+	// Sent along with the requests unmapping the overlay
+	slurp_unmap(state);
+	release_overlay(state);
+	return state->data_source != NULL;
+}
+
+bool slurp_is_offering(struct slurp_state *state) {
+	return state->data_source != NULL;
+}
@@ -0,0 +1,253 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "box.h"
+#include "json.h"
+#include "sway-ipc.h"
+
+#define IPC_MAGIC "i3-ipc"
+#define IPC_HEADER_SIZE (sizeof(IPC_MAGIC) - 1 + 2 * sizeof(uint32_t))
+#define IPC_GET_TREE 4
+// Far above any real tree, but keeps a broken peer from exhausting memory
+#define IPC_MAX_PAYLOAD (64 * 1024 * 1024)
+
+struct tree_walker {
+	struct json_parser parser;
+	bool borders;
+	sway_ipc_window_func_t func;
+	void *data;
+};
+
+static int ipc_connect(void) {
+	const char *path = getenv("SWAYSOCK");
+	if (path == NULL) {
+		path = getenv("I3SOCK");
+	}
+	if (path == NULL) {
+		fprintf(stderr, "neither SWAYSOCK nor I3SOCK is set\n");
+		return -1;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "IPC socket path is too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "failed to connect to %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool read_full(int fd, void *buf, size_t len) {
+	uint8_t *p = buf;
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len) {
+	const uint8_t *p = buf;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static char *ipc_get_tree(int fd, size_t *len) {
+	uint8_t header[IPC_HEADER_SIZE];
+	uint32_t payload_len = 0, type = IPC_GET_TREE;
+	memcpy(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1);
+	memcpy(header + sizeof(IPC_MAGIC) - 1, &payload_len, sizeof(uint32_t));
+	memcpy(header + sizeof(IPC_MAGIC) - 1 + sizeof(uint32_t), &type,
+		sizeof(uint32_t));
+	if (!write_full(fd, header, sizeof(header)) ||
+			!read_full(fd, header, sizeof(header)) ||
+			memcmp(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1) != 0) {
+		fprintf(stderr, "invalid IPC reply\n");
+		return NULL;
+	}
+	memcpy(&payload_len, header + sizeof(IPC_MAGIC) - 1, sizeof(uint32_t));
+	if (payload_len > IPC_MAX_PAYLOAD) {
+		fprintf(stderr, "IPC reply is too large\n");
+		return NULL;
+	}
+
+	char *payload = malloc(payload_len);
+	if (payload == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	if (!read_full(fd, payload, payload_len)) {
+		fprintf(stderr, "failed to read IPC reply\n");
+		free(payload);
+		return NULL;
+	}
+	*len = payload_len;
+	return payload;
+}
+
+static bool parse_rect(struct json_parser *parser, struct slurp_box *box) {
+	if (json_next(parser) != JSON_OBJECT_START) {
+		return false;
+	}
+	enum json_token token;
+	while ((token = json_next(parser)) == JSON_KEY) {
+		int32_t *field = NULL;
+		if (strcmp(parser->str, "x") == 0) {
+			field = &box->x;
+		} else if (strcmp(parser->str, "y") == 0) {
+			field = &box->y;
+		} else if (strcmp(parser->str, "width") == 0) {
+			field = &box->width;
+		} else if (strcmp(parser->str, "height") == 0) {
+			field = &box->height;
+		}
+		token = json_next(parser);
+		if (field != NULL && token == JSON_NUMBER) {
+			if (!(parser->number >= INT32_MIN && parser->number <= INT32_MAX)) {
+				return false;
+			}
+			*field = (int32_t)parser->number;
+		} else if (!json_skip(parser, token)) {
+			return false;
+		}
+	}
+	return token == JSON_OBJECT_END;
+}
+
+static bool walk_node(struct tree_walker *walker);
+
+static bool walk_nodes(struct tree_walker *walker) {
+	struct json_parser *parser = &walker->parser;
+	enum json_token token = json_next(parser);
+	if (token != JSON_ARRAY_START) {
+		return json_skip(parser, token);
+	}
+	while ((token = json_next(parser)) == JSON_OBJECT_START) {
+		if (!walk_node(walker)) {
+			return false;
+		}
+	}
+	return token == JSON_ARRAY_END;
+}
+
+/**
+ * Walk a node object, after its opening brace. Windows are reported once all
+ * of their keys have been seen, as keys can come in any order. Sway marks
+ * windows with "pid" and hidden ones with "visible", i3 only has "window".
+ */
+static bool walk_node(struct tree_walker *walker) {
+	struct json_parser *parser = &walker->parser;
+	struct slurp_box rect = {0}, window_rect = {0};
+	bool is_window = false, visible = true;
+	char *name = NULL;
+	bool ok = true;
+
+	enum json_token token = JSON_ERROR;
+	while (ok && (token = json_next(parser)) == JSON_KEY) {
+		const char *key = parser->str;
+		if (strcmp(key, "rect") == 0) {
+			ok = parse_rect(parser, &rect);
+		} else if (strcmp(key, "window_rect") == 0) {
+			ok = parse_rect(parser, &window_rect);
+		} else if (strcmp(key, "nodes") == 0 ||
+				strcmp(key, "floating_nodes") == 0) {
+			ok = walk_nodes(walker);
+		} else if (strcmp(key, "pid") == 0 || strcmp(key, "window") == 0) {
+			token = json_next(parser);
+			is_window |= token == JSON_NUMBER;
+			ok = json_skip(parser, token);
+		} else if (strcmp(key, "visible") == 0) {
+			token = json_next(parser);
+			visible = token == JSON_TRUE;
+			ok = json_skip(parser, token);
+		} else if (strcmp(key, "name") == 0) {
+			token = json_next(parser);
+			if (token == JSON_STRING) {
+				free(name);
+				name = strdup(parser->str);
+			} else {
+				ok = json_skip(parser, token);
+			}
+		} else {
+			ok = json_skip(parser, json_next(parser));
+		}
+	}
+	ok = ok && token == JSON_OBJECT_END;
+
+	if (ok && is_window && visible) {
+		struct slurp_box box = rect;
+		if (!walker->borders) {
+			box.x += window_rect.x;
+			box.y += window_rect.y;
+			box.width = window_rect.width;
+			box.height = window_rect.height;
+		}
+		box.label = name;
+		walker->func(&box, walker->data);
+	}
+	free(name);
+	return ok;
+}
+
+bool sway_ipc_get_windows(bool borders, sway_ipc_window_func_t func,
+		void *data) {
+	int fd = ipc_connect();
+	if (fd < 0) {
+		return false;
+	}
+	size_t len;
+	char *tree = ipc_get_tree(fd, &len);
+	close(fd);
+	if (tree == NULL) {
+		return false;
+	}
+
+	struct tree_walker walker = {
+		.borders = borders,
+		.func = func,
+		.data = data,
+	};
+	json_parser_init(&walker.parser, tree, len);
+	bool ok = json_next(&walker.parser) == JSON_OBJECT_START &&
+		walk_node(&walker);
+	if (!ok) {
+		fprintf(stderr, "failed to parse the window tree\n");
+	}
+	json_parser_finish(&walker.parser);
+	free(tree);
+	return ok;
+}
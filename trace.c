@@ -0,0 +1,73 @@
+#define _DEFAULT_SOURCE
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+FILE *trace_file = NULL;
+static bool trace_first_event = true;
+static pid_t trace_pid;
+static _Thread_local pid_t trace_tid;
+
+// The trace covers the whole process, however many selections it runs
+__attribute__((constructor)) static void trace_init(void) {
+	const char *path = getenv("SLURP_TRACE");
+	if (path == NULL || path[0] == '\0') {
+		return;
+	}
+	trace_file = fopen(path, "w");
+	if (trace_file == NULL) {
+		fprintf(stderr, "failed to open trace file %s\n", path);
+		return;
+	}
+	trace_pid = getpid();
+	fprintf(trace_file, "[\n");
+}
+
+__attribute__((destructor)) static void trace_finish(void) {
+	if (trace_file == NULL) {
+		return;
+	}
+	fprintf(trace_file, "\n]\n");
+	fclose(trace_file);
+	trace_file = NULL;
+}
+
+static double trace_timestamp(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void trace_write_separator(void) {
+	if (!trace_first_event) {
+		fprintf(trace_file, ",\n");
+	}
+	trace_first_event = false;
+}
+
+// Events may be written by the input thread too
+void trace_write_event(const char *name, char phase) {
+	if (trace_tid == 0) {
+		trace_tid = syscall(SYS_gettid);
+	}
+	flockfile(trace_file);
+	trace_write_separator();
+	fprintf(trace_file,
+		"{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+		name, phase, trace_timestamp(), (int)trace_pid, (int)trace_tid);
+	funlockfile(trace_file);
+}
+
+void trace_write_counter(const char *name, double value) {
+	flockfile(trace_file);
+	trace_write_separator();
+	fprintf(trace_file,
+		"{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,"
+		"\"args\":{\"value\":%g}}",
+		name, trace_timestamp(), (int)trace_pid, value);
+	funlockfile(trace_file);
+}